@@ -0,0 +1,149 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+// How much of one kind of work may be under way at once.
+struct admission_limits
+{
+  size_t max_in_flight{SIZE_MAX};
+  // of request bodies
+  size_t max_bytes{SIZE_MAX};
+  // work is shed while it takes longer than this on average; 0 for never
+  std::chrono::microseconds latency_target{0};
+};
+
+// Decides, before any work is done, whether a request is taken on or
+// turned away at once, so an overload shows up as quick refusals rather
+// than as every request waiting longer. Latency is followed as a moving
+// average of the admitted requests; while it is over target, requests are
+// only taken when none is under way, so the average recovers as soon as
+// the work does.
+class admission_gate
+{
+public:
+  using clock_t = std::function<std::chrono::steady_clock::time_point()>;
+
+  // Work taken on, until destroyed; or, if false, how long to wait.
+  class ticket
+  {
+  public:
+    ticket(ticket &&other) noexcept
+        : gate_{std::exchange(other.gate_, nullptr)}, bytes_{other.bytes_}, start_{other.start_}, retry_after_{other.retry_after_},
+          timed_{other.timed_}
+    {
+    }
+    ticket(ticket const &) = delete;
+    ticket &operator=(ticket const &) = delete;
+
+    ~ticket()
+    {
+      if (gate_)
+      {
+        gate_->finish(bytes_, timed_ ? std::optional{start_} : std::nullopt);
+      }
+    }
+
+    explicit operator bool() const { return gate_ != nullptr; }
+
+    std::chrono::seconds retry_after() const { return retry_after_; }
+
+    // Leaves the work out of the latency average, for work that lasts as
+    // long as its client makes it, while still counting it under way.
+    void untimed() { timed_ = false; }
+
+  private:
+    friend class admission_gate;
+
+    ticket(admission_gate *gate, size_t bytes, std::chrono::steady_clock::time_point start, std::chrono::seconds retry_after)
+        : gate_{gate}, bytes_{bytes}, start_{start}, retry_after_{retry_after}
+    {
+    }
+
+    admission_gate *gate_;
+    size_t bytes_;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::seconds retry_after_;
+    bool timed_{true};
+  };
+
+  struct stats
+  {
+    size_t in_flight;
+    size_t bytes;
+    uint64_t admitted;
+    uint64_t shed;
+    std::chrono::microseconds latency;
+
+    std::string json() const
+    {
+      return "{\"in_flight\":" + std::to_string(in_flight) + ",\"bytes\":" + std::to_string(bytes) +
+             ",\"admitted\":" + std::to_string(admitted) + ",\"shed\":" + std::to_string(shed) +
+             ",\"latency_us\":" + std::to_string(latency.count()) + '}';
+    }
+  };
+
+  explicit admission_gate(admission_limits limits, clock_t now = std::chrono::steady_clock::now)
+      : limits_{limits}, now_{std::move(now)}
+  {
+  }
+
+  admission_gate(admission_gate const &) = delete;
+
+  ticket admit(size_t bytes)
+  {
+    auto const now{now_()};
+    std::lock_guard lock{mutex_};
+    // a body over max_bytes is still taken alone, or it never would be
+    auto const full{in_flight_ >= limits_.max_in_flight || (in_flight_ > 0 && bytes_ + bytes > limits_.max_bytes)};
+    auto const late{limits_.latency_target.count() > 0 && in_flight_ > 0 && latency_ > limits_.latency_target};
+    if (full || late)
+    {
+      ++shed_;
+      // about the time it takes to get back on target, but never 0
+      auto const wait{late ? std::chrono::ceil<std::chrono::seconds>(latency_) : std::chrono::seconds{1}};
+      return {nullptr, 0, now, std::max(wait, std::chrono::seconds{1})};
+    }
+    ++in_flight_;
+    bytes_ += bytes;
+    ++admitted_;
+    return {this, bytes, now, {}};
+  }
+
+  stats current() const
+  {
+    std::lock_guard lock{mutex_};
+    return {in_flight_, bytes_, admitted_, shed_, latency_};
+  }
+
+private:
+  // the weight of the latest request in the average, as in TCP's RTT
+  static constexpr int smoothing{8};
+
+  void finish(size_t bytes, std::optional<std::chrono::steady_clock::time_point> start)
+  {
+    auto const end{now_()};
+    std::lock_guard lock{mutex_};
+    --in_flight_;
+    bytes_ -= bytes;
+    if (start)
+    {
+      auto const took{std::chrono::duration_cast<std::chrono::microseconds>(end - *start)};
+      latency_ += (took - latency_) / smoothing;
+    }
+  }
+
+  admission_limits limits_;
+  clock_t now_;
+  mutable std::mutex mutex_;
+  size_t in_flight_{};
+  size_t bytes_{};
+  uint64_t admitted_{};
+  uint64_t shed_{};
+  std::chrono::microseconds latency_{};
+};
@@ -0,0 +1,281 @@
+#pragma once
+#include <concepts>
+#include <optional>
+#include <string_view>
+#include "task.h"
+#include "tree-index.h"
+#include "tree-parser.h"
+
+// The asynchronous counterpart of repo_t: every operation returns a task
+// that completes once storage has answered.
+template <typename R>
+concept async_repo = requires(R r, typename R::tree_key_t tree_id, typename R::node_key_t node, int value) {
+  typename R::node_key_t;
+  typename R::tree_key_t;
+  { r.get_parent_by_id(node) } -> std::same_as<task<typename R::node_key_t>>;
+  { r.new_tree() } -> std::same_as<task<typename R::tree_key_t>>;
+  { r.ensure_node(tree_id, value) } -> std::same_as<task<typename R::node_key_t>>;
+  { r.get_value_by_id(node) } -> std::same_as<task<int>>;
+  { r.get_id_by_value(tree_id, value) } -> std::same_as<task<typename R::node_key_t>>;
+  { r.bind_left(node, node) } -> std::same_as<task<void>>;
+  { r.bind_right(node, node) } -> std::same_as<task<void>>;
+  { r.flatten(tree_id) } -> std::same_as<task<flat_tree>>;
+  { r.create_tree(tree_id) } -> std::same_as<task<void>>;
+  { r.add_nodes(tree_id, std::vector<tree_parser::triplet>{}) } -> std::same_as<task<void>>;
+  { r.drop_tree(tree_id) } -> std::same_as<task<void>>;
+  { r.nodes_after(tree_id, std::optional<int>{}, size_t{}) } -> std::same_as<task<std::vector<tree_parser::triplet>>>;
+};
+
+// Repos that store a tree once it is complete, rather than node by node:
+// commit_tree(tree_id) is called after its last node is added.
+template <typename R>
+concept committing_repo = requires(R r, typename R::tree_key_t tree_id) {
+  r.commit_tree(tree_id);
+};
+
+// Repos that remember trees by a hash of their content, so a tree posted
+// again can be found instead of stored twice.
+template <typename R>
+concept deduplicating_repo = requires(R r, typename R::tree_key_t tree_id, uint64_t hash) {
+  r.find_tree_by_hash(hash);
+  r.remember_tree_hash(hash, tree_id);
+};
+
+// Makes an async_repo of a blocking repo_t. Each call hops onto the io
+// executor, where the repo is used, and back onto the executor it came
+// from, or compute if none, so a slow storage call only holds up io, and
+// work kept apart on its own executor stays there. With a single io thread the repo is
+// never used concurrently, which repos such as data_adapter rely on.
+template <typename repo_t>
+class async_adapter
+{
+public:
+  using node_key_t = typename repo_t::node_key_t;
+  using tree_key_t = typename repo_t::tree_key_t;
+
+  async_adapter(repo_t &repo, executor &io, executor &compute)
+      : repo_{repo}, io_{io}, compute_{compute}
+  {
+  }
+
+  task<node_key_t> get_parent_by_id(node_key_t node_id)
+  {
+    return call([node_id](repo_t &r)
+                { return r.get_parent_by_id(node_id); });
+  }
+
+  task<tree_key_t> new_tree()
+  {
+    return call([](repo_t &r)
+                { return r.new_tree(); });
+  }
+
+  task<node_key_t> ensure_node(tree_key_t tree_id, int value)
+  {
+    return call([tree_id, value](repo_t &r)
+                { return r.ensure_node(tree_id, value); });
+  }
+
+  task<int> get_value_by_id(node_key_t node_id)
+  {
+    return call([node_id](repo_t &r)
+                { return r.get_value_by_id(node_id); });
+  }
+
+  task<node_key_t> get_id_by_value(tree_key_t tree_id, int value)
+  {
+    return call([tree_id, value](repo_t &r)
+                { return r.get_id_by_value(tree_id, value); });
+  }
+
+  task<void> bind_left(node_key_t node, node_key_t left)
+  {
+    return call([node, left](repo_t &r)
+                { r.bind_left(node, left); });
+  }
+
+  task<void> bind_right(node_key_t node, node_key_t right)
+  {
+    return call([node, right](repo_t &r)
+                { r.bind_right(node, right); });
+  }
+
+  // The whole tree in one storage round trip.
+  task<flat_tree> flatten(tree_key_t tree_id)
+  {
+    return call([tree_id](repo_t &r)
+                {
+                  if constexpr (requires { { r.flatten(tree_id) } -> std::same_as<flat_tree>; })
+                  {
+                    return r.flatten(tree_id);
+                  }
+                  flat_tree result;
+                  r.visit_nodes(tree_id, [&result](int value, std::optional<int> left, std::optional<int> right)
+                                { result.add(value, left, right); });
+                  return result; });
+  }
+
+  task<void> create_tree(tree_key_t tree_id)
+  {
+    return call([tree_id](repo_t &r)
+                { r.create_tree(tree_id); });
+  }
+
+  task<void> add_nodes(tree_key_t tree_id, std::vector<tree_parser::triplet> nodes)
+  {
+    return call([tree_id, nodes = std::move(nodes)](repo_t &r)
+                { r.add_nodes(tree_id, nodes); });
+  }
+
+  task<void> commit_tree(tree_key_t tree_id)
+    requires committing_repo<repo_t>
+  {
+    return call([tree_id](repo_t &r)
+                { r.commit_tree(tree_id); });
+  }
+
+  task<void> drop_tree(tree_key_t tree_id)
+  {
+    return call([tree_id](repo_t &r)
+                { r.drop_tree(tree_id); });
+  }
+
+  task<std::optional<tree_key_t>> find_tree_by_hash(uint64_t hash)
+    requires deduplicating_repo<repo_t>
+  {
+    return call([hash](repo_t &r)
+                { return std::optional<tree_key_t>{r.find_tree_by_hash(hash)}; });
+  }
+
+  task<void> remember_tree_hash(uint64_t hash, tree_key_t tree_id)
+    requires deduplicating_repo<repo_t>
+  {
+    return call([hash, tree_id](repo_t &r)
+                { r.remember_tree_hash(hash, tree_id); });
+  }
+
+  // A page of at most limit nodes, by increasing value, after the given one.
+  task<std::vector<tree_parser::triplet>> nodes_after(tree_key_t tree_id, std::optional<int> after, size_t limit)
+  {
+    return call([tree_id, after, limit](repo_t &r)
+                {
+                  std::vector<tree_parser::triplet> page;
+                  page.reserve(limit);
+                  r.visit_nodes_after(tree_id, after, limit, [&page](int value, std::optional<int> left, std::optional<int> right)
+                                      { page.push_back({left, value, right}); });
+                  return page; });
+  }
+
+private:
+  template <typename F>
+  auto call(F f) -> task<decltype(f(std::declval<repo_t &>()))>
+  {
+    using result_t = decltype(f(repo_));
+    auto const trace{co_await current_trace{}};
+    auto const from{executor::current()};
+    auto &back{from != nullptr && from != &io_ ? *from : compute_};
+    auto const queued{trace ? trace_now_ns() : 0};
+    co_await io_.schedule();
+    if (trace)
+    {
+      trace->add(trace_phase::io_wait, trace_now_ns() - queued);
+    }
+    std::exception_ptr error;
+    std::conditional_t<std::is_void_v<result_t>, bool, std::optional<result_t>> result{};
+    auto const calls{trace_storage_calls};
+    try
+    {
+      trace_timer timer{trace, trace_phase::storage};
+      if constexpr (std::is_void_v<result_t>)
+        f(repo_);
+      else
+        result.emplace(f(repo_));
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+    if (trace)
+    {
+      trace->add_storage_calls(trace_storage_calls - calls);
+    }
+    // errors too are reported back there
+    co_await back.schedule();
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+    if constexpr (!std::is_void_v<result_t>)
+    {
+      co_return std::move(*result);
+    }
+  }
+
+  repo_t &repo_;
+  executor &io_;
+  executor &compute_;
+};
+
+// An async_repo writing through one async_repo and reading through
+// another, such as a second connection to the same database on an io
+// executor of its own, so that queries don't queue behind the storage
+// calls of ingestion. Trees are only read once stored, so reads never
+// need what the writer holds in memory.
+template <async_repo repo_t>
+class read_write_repo
+{
+public:
+  using node_key_t = typename repo_t::node_key_t;
+  using tree_key_t = typename repo_t::tree_key_t;
+
+  read_write_repo(repo_t &writes, repo_t &reads) : writes_{writes}, reads_{reads} {}
+
+  task<node_key_t> get_parent_by_id(node_key_t node_id) { return reads_.get_parent_by_id(node_id); }
+
+  task<tree_key_t> new_tree() { return writes_.new_tree(); }
+
+  task<node_key_t> ensure_node(tree_key_t tree_id, int value) { return writes_.ensure_node(tree_id, value); }
+
+  task<int> get_value_by_id(node_key_t node_id) { return reads_.get_value_by_id(node_id); }
+
+  task<node_key_t> get_id_by_value(tree_key_t tree_id, int value) { return reads_.get_id_by_value(tree_id, value); }
+
+  task<void> bind_left(node_key_t node, node_key_t left) { return writes_.bind_left(node, left); }
+
+  task<void> bind_right(node_key_t node, node_key_t right) { return writes_.bind_right(node, right); }
+
+  task<flat_tree> flatten(tree_key_t tree_id) { return reads_.flatten(tree_id); }
+
+  task<void> create_tree(tree_key_t tree_id) { return writes_.create_tree(tree_id); }
+
+  task<void> add_nodes(tree_key_t tree_id, std::vector<tree_parser::triplet> nodes) { return writes_.add_nodes(tree_id, std::move(nodes)); }
+
+  task<void> commit_tree(tree_key_t tree_id)
+    requires committing_repo<repo_t>
+  {
+    return writes_.commit_tree(tree_id);
+  }
+
+  task<void> drop_tree(tree_key_t tree_id) { return writes_.drop_tree(tree_id); }
+
+  task<std::optional<tree_key_t>> find_tree_by_hash(uint64_t hash)
+    requires deduplicating_repo<repo_t>
+  {
+    return reads_.find_tree_by_hash(hash);
+  }
+
+  task<void> remember_tree_hash(uint64_t hash, tree_key_t tree_id)
+    requires deduplicating_repo<repo_t>
+  {
+    return writes_.remember_tree_hash(hash, tree_id);
+  }
+
+  task<std::vector<tree_parser::triplet>> nodes_after(tree_key_t tree_id, std::optional<int> after, size_t limit)
+  {
+    return reads_.nodes_after(tree_id, after, limit);
+  }
+
+private:
+  repo_t &writes_;
+  repo_t &reads_;
+};
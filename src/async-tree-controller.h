@@ -0,0 +1,435 @@
+#pragma once
+#include <algorithm>
+#include <exception>
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include "task.h"
+#include "async-repo.h"
+#include "tree-query.h"
+#include "tree-stream.h"
+#include "tiered-repo.h"
+#include "tree-hash.h"
+#include "tree-check.h"
+#include "rcu.h"
+
+// The operations on trees the server offers, as coroutines over an
+// async_repo: they suspend while storage works, so many requests can be in flight on a few
+// threads. Requests are taken by value, as they outlive the event that
+// brought them in.
+template <async_repo repo_t>
+class async_tree_controller
+{
+public:
+  using tree_key_t = typename repo_t::tree_key_t;
+  using node_key_t = typename repo_t::node_key_t;
+  using translator_t = tree_id_translator<tree_key_t>;
+
+  struct request
+  {
+    std::string uri;
+    std::string body;
+    // whether a tree posted again is found rather than stored twice
+    bool deduplicate{true};
+  };
+
+  async_tree_controller(repo_t &data, translator_t translator, size_t succinct_threshold = default_succinct_threshold)
+      : data_{data}, translator_{translator}, succinct_threshold_{succinct_threshold}
+  {
+  }
+
+  // The key of a tree from the id clients know it by.
+  tree_key_t tree_key(std::string const &tree_id) const { return translator_.parse(tree_id); }
+
+  task<int> common_ancestor(tree_key_t tree_id, std::vector<int> values)
+  {
+    auto const query = [&values](query_index_t const &index)
+    {
+      return std::visit([&values](auto const &i)
+                        { return i.common_ancestor(values); },
+                        index);
+    };
+    if (auto const cached{cached_answer(tree_id, query)})
+    {
+      co_return *cached;
+    }
+    if (values.size() == 2)
+    {
+      co_return co_await walk_common_ancestor(tree_id, values[0], values[1]);
+    }
+    auto const index_ptr{co_await build_index(tree_id)};
+    co_return query(*index_ptr);
+  }
+
+  task<std::string> common_ancestor(request r)
+  {
+    std::string tree_id_string;
+    std::vector<int> values;
+    {
+      trace_timer timer{co_await current_trace{}, trace_phase::parse};
+      parse_value_list(r.uri, r.body, tree_id_string, values);
+    }
+    co_return std::to_string(co_await common_ancestor(translator_.parse(tree_id_string), std::move(values)));
+  }
+
+  // The text is parsed and checked to be a single tree before the tree is
+  // created, so a malformed body leaves nothing behind.
+  task<tree_key_t> post_tree(std::string text)
+  {
+    auto triplets{parse_tree(text, co_await current_trace{})};
+    co_return co_await store_tree(std::move(triplets));
+  }
+
+  // As post_tree, but a tree posted before is found instead, by a hash of
+  // its canonical form. A hash may match another tree, so the tree found
+  // is read back and compared before it is taken.
+  task<tree_key_t> post_unique_tree(std::string text)
+    requires deduplicating_repo<repo_t>
+  {
+    auto const trace{co_await current_trace{}};
+    auto triplets{parse_tree(text, trace)};
+    auto const canonical{canonical_tree(triplets)};
+    auto const hash{canonical_tree_hash(canonical)};
+    auto const found{co_await data_.find_tree_by_hash(hash)};
+    if (found.has_value())
+    {
+      auto const same{co_await stored_as(found.value(), canonical)};
+      if (same)
+      {
+        co_return found.value();
+      }
+    }
+    auto const tree_id{co_await store_tree(std::move(triplets))};
+    // kept by the first tree with the hash, if another has it
+    co_await data_.remember_tree_hash(hash, tree_id);
+    co_return tree_id;
+  }
+
+  task<std::string> post_tree(request r)
+  {
+    if constexpr (deduplicating_repo<repo_t>)
+    {
+      if (r.deduplicate)
+      {
+        co_return translator_.to_string(co_await post_unique_tree(std::move(r.body)));
+      }
+    }
+    co_return translator_.to_string(co_await post_tree(std::move(r.body)));
+  }
+
+  task<int> distance(tree_key_t tree_id, int a, int b)
+  {
+    co_return co_await answer(tree_id, [a, b](query_index_t const &index)
+                              { return std::visit([a, b](auto const &i)
+                                                  { return i.distance(a, b); },
+                                                  index); });
+  }
+
+  task<std::string> distance(request r)
+  {
+    tree_key_t tree_id;
+    int a{}, b{};
+    parse_pair(r.uri, tree_id, a, b, co_await current_trace{});
+    co_return std::to_string(co_await distance(tree_id, a, b));
+  }
+
+  task<int> ancestor(tree_key_t tree_id, int value, int k)
+  {
+    co_return co_await answer(tree_id, [value, k](query_index_t const &index)
+                              { return std::visit([value, k](auto const &i)
+                                                  { return i.ancestor(value, k); },
+                                                  index); });
+  }
+
+  task<std::string> ancestor(request r)
+  {
+    tree_key_t tree_id;
+    int value{}, k{};
+    parse_pair(r.uri, tree_id, value, k, co_await current_trace{});
+    co_return std::to_string(co_await ancestor(tree_id, value, k));
+  }
+
+  task<bool> is_ancestor(tree_key_t tree_id, int a, int b)
+  {
+    co_return co_await answer(tree_id, [a, b](query_index_t const &index)
+                              { return std::visit([a, b](auto const &i)
+                                                  { return i.is_ancestor(a, b); },
+                                                  index); });
+  }
+
+  task<std::string> is_ancestor(request r)
+  {
+    tree_key_t tree_id;
+    int a{}, b{};
+    parse_pair(r.uri, tree_id, a, b, co_await current_trace{});
+    co_return std::string{co_await is_ancestor(tree_id, a, b) ? "true" : "false"};
+  }
+
+  // Nodes per storage round trip when moving trees.
+  static constexpr size_t transfer_page{4096};
+
+  // Where an export has got to. Shared with the task filling the next
+  // chunk, as the connection may close meanwhile.
+  struct export_cursor
+  {
+    tree_key_t tree_id;
+    tree_encoder encoder;
+    std::optional<int> after{};
+    bool started{};
+    bool finished{};
+  };
+
+  // uris look like /tree/{id}/export
+  std::shared_ptr<export_cursor> start_export(request const &r, tree_format format) const
+  {
+    return std::make_shared<export_cursor>(translator_.parse(parse_tree_id(r.uri)), tree_encoder{format});
+  }
+
+  // The next page of the tree, encoded. Memory stays bounded by a page
+  // whatever the size of the tree, and the caller decides when to ask for
+  // more.
+  task<std::string> export_chunk(std::shared_ptr<export_cursor> cursor)
+  {
+    auto const page{co_await data_.nodes_after(cursor->tree_id, cursor->after, transfer_page)};
+    std::string result;
+    if (!cursor->started)
+    {
+      if (page.empty())
+      {
+        throw std::runtime_error("Not found.");
+      }
+      result = cursor->encoder.header();
+      cursor->started = true;
+    }
+    for (auto const &node : page)
+    {
+      cursor->encoder.add(node, result);
+    }
+    if (!page.empty())
+    {
+      cursor->after = page.back().value;
+    }
+    cursor->finished = page.size() < transfer_page;
+    co_return result;
+  }
+
+  // Recreates an exported tree under its original id, /tree/{id}/import,
+  // from either form. The body is checked in a first pass, so a malformed
+  // one leaves nothing behind, then decoded again as it goes and stored a
+  // page per transaction. If storing fails, what was stored is dropped.
+  task<std::string> import_tree(request r)
+  {
+    auto const tree_id{translator_.parse(parse_tree_id(r.uri))};
+    std::string_view const body{r.body};
+    constexpr size_t piece{64 * 1024};
+    {
+      trace_timer timer{co_await current_trace{}, trace_phase::parse};
+      tree_decoder check;
+      tree_checker shape;
+      auto const add = [&shape](auto node)
+      { shape.add(node); };
+      for (size_t at{}; at < body.size(); at += piece)
+      {
+        check.feed(body.substr(at, piece), add);
+      }
+      check.finish(add);
+      shape.finish();
+    }
+    co_await data_.create_tree(tree_id);
+    // a tree left half stored would keep its id taken
+    std::exception_ptr error;
+    try
+    {
+      co_await import_nodes(tree_id, body);
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+    if (error)
+    {
+      co_await data_.drop_tree(tree_id);
+      std::rethrow_exception(error);
+    }
+    co_return translator_.to_string(tree_id);
+  }
+
+private:
+  static std::vector<tree_parser::triplet> parse_tree(std::string_view text, trace_span *trace)
+  {
+    trace_timer timer{trace, trace_phase::parse};
+    std::vector<tree_parser::triplet> triplets;
+    tree_parser::parse(text, [&triplets](auto node)
+                       { triplets.push_back(node); });
+    check_tree(triplets);
+    return triplets;
+  }
+
+  // A page of nodes per storage call, as decoded.
+  task<void> import_nodes(tree_key_t tree_id, std::string_view body)
+  {
+    constexpr size_t piece{64 * 1024};
+    tree_decoder decoder;
+    std::vector<tree_parser::triplet> batch;
+    auto const collect = [&batch](auto node)
+    { batch.push_back(node); };
+    for (size_t at{}; at < body.size(); at += piece)
+    {
+      decoder.feed(body.substr(at, piece), collect);
+      if (batch.size() >= transfer_page)
+      {
+        co_await data_.add_nodes(tree_id, std::exchange(batch, {}));
+      }
+    }
+    decoder.finish(collect);
+    if (!batch.empty())
+    {
+      co_await data_.add_nodes(tree_id, std::move(batch));
+    }
+    if constexpr (committing_repo<repo_t>)
+    {
+      co_await data_.commit_tree(tree_id);
+    }
+  }
+
+  // Whether the stored tree has the given canonical form, read a page at
+  // a time as exports are.
+  task<bool> stored_as(tree_key_t tree_id, std::string const &canonical)
+  {
+    std::vector<tree_parser::triplet> stored;
+    std::optional<int> after;
+    for (;;)
+    {
+      auto const page{co_await data_.nodes_after(tree_id, after, transfer_page)};
+      stored.insert(stored.end(), page.begin(), page.end());
+      if (page.size() < transfer_page)
+      {
+        break;
+      }
+      after = page.back().value;
+    }
+    co_return canonical_tree(stored) == canonical;
+  }
+
+  // Under a new id, dropped again if storing fails.
+  task<tree_key_t> store_tree(std::vector<tree_parser::triplet> triplets)
+  {
+    auto const tree_id{co_await data_.new_tree()};
+    std::exception_ptr error;
+    try
+    {
+      co_await store_nodes(tree_id, std::move(triplets));
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+    if (error)
+    {
+      co_await data_.drop_tree(tree_id);
+      std::rethrow_exception(error);
+    }
+    co_return tree_id;
+  }
+
+  // A page of nodes per storage call, as imports are stored.
+  task<void> store_nodes(tree_key_t tree_id, std::vector<tree_parser::triplet> triplets)
+  {
+    for (size_t at{}; at < triplets.size(); at += transfer_page)
+    {
+      std::vector<tree_parser::triplet> page(triplets.begin() + at, triplets.begin() + std::min(triplets.size(), at + transfer_page));
+      co_await data_.add_nodes(tree_id, std::move(page));
+    }
+    if constexpr (committing_repo<repo_t>)
+    {
+      co_await data_.commit_tree(tree_id);
+    }
+  }
+
+  // As tree::find_common_ancestor, one storage call per step. Trees are
+  // checked as they are stored, but one stored before that may loop, so
+  // each walk is guarded against coming round again.
+  task<int> walk_common_ancestor(tree_key_t tree_id, int v1, int v2)
+  {
+    std::vector<node_key_t> ancestors;
+    cycle_guard<node_key_t> first;
+    for (auto a{co_await data_.get_id_by_value(tree_id, v1)}; a != node_key_t(); a = co_await data_.get_parent_by_id(a))
+    {
+      first.step(a);
+      ancestors.push_back(a);
+    }
+    std::sort(ancestors.begin(), ancestors.end());
+    cycle_guard<node_key_t> second;
+    for (auto a{co_await data_.get_id_by_value(tree_id, v2)}; a != node_key_t(); a = co_await data_.get_parent_by_id(a))
+    {
+      if (std::binary_search(ancestors.begin(), ancestors.end(), a))
+      {
+        co_return co_await data_.get_value_by_id(a);
+      }
+      second.step(a);
+    }
+    throw std::runtime_error("No common ancestor.");
+  }
+
+  void parse_pair(std::string_view uri, tree_key_t &tree_id, int &a, int &b, trace_span *trace) const
+  {
+    trace_timer timer{trace, trace_phase::parse};
+    std::string tree_id_string;
+    ::parse_pair(uri, tree_id_string, a, b);
+    tree_id = translator_.parse(tree_id_string);
+  }
+
+  using index_ptr_t = std::shared_ptr<query_index_t const>;
+
+  // What query gives for the tree's index, built first if need be.
+  template <typename F>
+  task<std::invoke_result_t<F, query_index_t const &>> answer(tree_key_t tree_id, F query)
+  {
+    if (auto const cached{cached_answer(tree_id, query)})
+    {
+      co_return *cached;
+    }
+    auto const index_ptr{co_await build_index(tree_id)};
+    co_return query(*index_ptr);
+  }
+
+  // What query gives for the tree's index if it is in memory, asked in
+  // place: no lock is taken, nor a reference to the index. A tiered repo
+  // decides which trees stay compiled in memory. Otherwise, trees not
+  // changing once posted, indexes are built on first use and kept.
+  template <typename F>
+  auto cached_answer(tree_key_t tree_id, F const &query) -> std::optional<std::invoke_result_t<F, query_index_t const &>>
+  {
+    if constexpr (tiered_async_repo<repo_t>)
+    {
+      return data_.with_hot(tree_id, [&query](index_ptr_t const &index)
+                            { return query(*index); });
+    }
+    else
+    {
+      return indexes_.read(tree_id, query);
+    }
+  }
+
+  // Two requests may both build a missing index; the first one stored wins.
+  task<index_ptr_t> build_index(tree_key_t tree_id)
+  {
+    index_ptr_t built{build_query_index(co_await data_.flatten(tree_id), succinct_threshold_)};
+    if constexpr (tiered_async_repo<repo_t>)
+    {
+      co_return data_.keep_hot(tree_id, std::move(built));
+    }
+    else
+    {
+      co_return indexes_.emplace(tree_id, std::move(built));
+    }
+  }
+
+  repo_t &data_;
+  translator_t translator_;
+  size_t succinct_threshold_;
+  rcu_map<tree_key_t, query_index_t> indexes_;
+};
@@ -0,0 +1,216 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Blocking clients for the tools in bench/, a connection per thread.
+
+// A client socket and what was read from it but not yet taken.
+class tcp_connection
+{
+public:
+  tcp_connection(std::string host, std::string port) : host_{std::move(host)}, port_{std::move(port)} {}
+  tcp_connection(tcp_connection const &) = delete;
+
+  ~tcp_connection() { disconnect(); }
+
+protected:
+  bool connect()
+  {
+    addrinfo hints{}, *found{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host_.c_str(), port_.c_str(), &hints, &found) != 0)
+    {
+      return false;
+    }
+    for (auto a{found}; a != nullptr && fd_ < 0; a = a->ai_next)
+    {
+      fd_ = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd_ >= 0 && ::connect(fd_, a->ai_addr, a->ai_addrlen) != 0)
+      {
+        disconnect();
+      }
+    }
+    freeaddrinfo(found);
+    if (fd_ >= 0)
+    {
+      int one{1};
+      setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    buffer_.clear();
+    return fd_ >= 0;
+  }
+
+  void disconnect()
+  {
+    if (fd_ >= 0)
+    {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  bool send_all(std::string_view data)
+  {
+    while (!data.empty())
+    {
+      auto const sent{send(fd_, data.data(), data.size(), MSG_NOSIGNAL)};
+      if (sent <= 0)
+      {
+        return false;
+      }
+      data.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+  }
+
+  // Reads until buffer_ holds at least n bytes.
+  bool fill(size_t n)
+  {
+    char chunk[16 * 1024];
+    while (buffer_.size() < n)
+    {
+      auto const got{recv(fd_, chunk, sizeof(chunk), 0)};
+      if (got <= 0)
+      {
+        return false;
+      }
+      buffer_.append(chunk, static_cast<size_t>(got));
+    }
+    return true;
+  }
+
+  // Reads until buffer_ holds the delimiter, and returns where it starts.
+  size_t fill_until(std::string_view delimiter)
+  {
+    size_t from{};
+    for (;;)
+    {
+      auto const pos{buffer_.find(delimiter, from)};
+      if (pos != std::string::npos)
+      {
+        return pos;
+      }
+      from = buffer_.size() >= delimiter.size() ? buffer_.size() - delimiter.size() + 1 : 0;
+      if (!fill(buffer_.size() + 1))
+      {
+        return std::string::npos;
+      }
+    }
+  }
+
+  std::string host_, port_;
+  int fd_{-1};
+  std::string buffer_;
+};
+
+// HTTP/1.1 over one keep-alive connection, reconnecting when the server
+// closes it.
+class http_connection : public tcp_connection
+{
+public:
+  using tcp_connection::tcp_connection;
+
+  // The status of the reply, whose body goes to body; 0 on network errors.
+  // Extra headers are lines, each ending in \r\n.
+  int request(std::string_view method, std::string_view path, std::string_view payload, std::string &body,
+              std::string_view headers = {})
+  {
+    for (int attempt{}; attempt < 2; ++attempt)
+    {
+      if (fd_ < 0 && !connect())
+      {
+        return 0;
+      }
+      std::string message{method};
+      message += ' ';
+      message += path;
+      message += " HTTP/1.1\r\nHost: " + host_ + "\r\nContent-Length: " + std::to_string(payload.size()) + "\r\n";
+      message += headers;
+      message += "\r\n";
+      message += payload;
+      int status{};
+      if (send_all(message) && (status = read_response(body)) != 0)
+      {
+        return status;
+      }
+      // a kept alive connection may have been closed meanwhile
+      disconnect();
+    }
+    return 0;
+  }
+
+private:
+  int read_response(std::string &body)
+  {
+    body.clear();
+    auto const head_end{fill_until("\r\n\r\n")};
+    if (head_end == std::string::npos)
+    {
+      return 0;
+    }
+    std::string head{buffer_.substr(0, head_end)};
+    buffer_.erase(0, head_end + 4);
+    std::transform(head.begin(), head.end(), head.begin(), [](unsigned char c)
+                   { return static_cast<char>(std::tolower(c)); });
+    auto const space{head.find(' ')};
+    auto const status{space == std::string::npos ? 0 : std::atoi(head.c_str() + space + 1)};
+    auto const header = [&head](std::string_view name) -> std::string
+    {
+      auto const pos{head.find("\r\n" + std::string(name) + ":")};
+      if (pos == std::string::npos)
+        return {};
+      auto const start{head.find_first_not_of(' ', pos + name.size() + 3)};
+      return head.substr(start, head.find("\r\n", start) - start);
+    };
+    auto const closing{header("connection") == "close"};
+    if (header("transfer-encoding") == "chunked")
+    {
+      for (;;)
+      {
+        auto const line_end{fill_until("\r\n")};
+        if (line_end == std::string::npos)
+          return 0;
+        auto const size{std::strtoul(buffer_.c_str(), nullptr, 16)};
+        buffer_.erase(0, line_end + 2);
+        if (!fill(size + 2))
+          return 0;
+        body.append(buffer_, 0, size);
+        buffer_.erase(0, size + 2);
+        if (size == 0)
+          break;
+      }
+    }
+    else if (auto const length{header("content-length")}; !length.empty())
+    {
+      auto const size{std::strtoul(length.c_str(), nullptr, 10)};
+      if (!fill(size))
+        return 0;
+      body = buffer_.substr(0, size);
+      buffer_.erase(0, size);
+    }
+    else
+    {
+      // the body runs until the server closes the connection
+      while (fill(buffer_.size() + 1))
+      {
+      }
+      body.swap(buffer_);
+      buffer_.clear();
+      disconnect();
+    }
+    if (closing)
+    {
+      disconnect();
+    }
+    return status;
+  }
+};
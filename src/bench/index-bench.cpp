@@ -0,0 +1,69 @@
+// Times the sequential and parallel tree_index builders over the same random
+// tree, for a range of pool sizes.
+//
+//   bench-index [nodes] [max threads]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include "../tree-index.h"
+
+namespace
+{
+  flat_tree random_tree(int nodes)
+  {
+    std::mt19937 rng{42};
+    std::vector<int> values(nodes);
+    std::iota(values.begin(), values.end(), 1);
+    std::shuffle(values.begin(), values.end(), rng);
+    flat_tree t;
+    t.ensure(values[0]);
+    std::vector<int> open{values[0], values[0]};
+    for (int next{1}; next < nodes; ++next)
+    {
+      std::uniform_int_distribution<size_t> pick{0, open.size() - 1};
+      auto const slot{pick(rng)};
+      auto const parent{open[slot]};
+      open[slot] = open.back();
+      open.pop_back();
+      t.add(parent, values[next], {});
+      open.push_back(values[next]);
+      open.push_back(values[next]);
+    }
+    return t;
+  }
+
+  // best of a few runs, in milliseconds
+  template <typename F>
+  double time(F const &build)
+  {
+    double best{1e300};
+    for (int run{}; run < 3; ++run)
+    {
+      auto const start{std::chrono::steady_clock::now()};
+      build();
+      best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  auto const nodes{argc > 1 ? std::atoi(argv[1]) : 4000000};
+  auto const max_threads{argc > 2 ? static_cast<size_t>(std::atoi(argv[2])) : thread_pool::default_size()};
+  auto const t{random_tree(nodes)};
+
+  auto const sequential{time([&t]
+                             { tree_index index{t}; })};
+  std::printf("%d nodes\n%-12s %10.1f ms\n", nodes, "sequential", sequential);
+  for (size_t threads{1}; threads <= max_threads; threads *= 2)
+  {
+    thread_pool pool{threads};
+    auto const parallel{time([&t, &pool]
+                             { tree_index index{t, pool}; })};
+    std::printf("%2zu threads   %10.1f ms  %5.2fx\n", threads, parallel, sequential / parallel);
+  }
+}
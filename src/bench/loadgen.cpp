@@ -0,0 +1,333 @@
+// Load generator for a common-ancestor instance, or the docker-compose
+// balancer in front of several. Creates trees through POST /tree, then for
+// a while fires a mix of creates and common ancestor queries over one
+// keep-alive connection per thread, and reports throughput and latency
+// percentiles.
+//
+//   loadgen [--host=localhost] [--port=8080] [--threads=4] [--duration=10]
+//           [--rate=0] [--create=0.05] [--trees=8] [--nodes=1000]
+//           [--shape=random|balanced|chain] [--rpc-port=] [--pipeline=1]
+//
+// With --rate=0 each thread sends its next request as soon as the previous
+// one is answered (closed loop). Otherwise requests are due at a fixed
+// total rate (open loop), and latency counts from when a request was due,
+// so a stalled server can't hide the requests it held back.
+//
+// With --rpc-port, queries go over the binary protocol instead of HTTP,
+// --pipeline of them sent at once per thread, each timed until its reply.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <algorithm>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../latency-histogram.h"
+#include "http-client.h"
+#include "../rpc.h"
+
+namespace
+{
+  using clock_type = std::chrono::steady_clock;
+
+  struct options
+  {
+    std::string host{"localhost"};
+    std::string port{"8080"};
+    size_t threads{4};
+    double duration{10};
+    double rate{};
+    double create{0.05};
+    size_t trees{8};
+    int nodes{1000};
+    std::string shape{"random"};
+    std::string rpc_port;
+    size_t pipeline{1};
+  };
+
+  options parse_options(int argc, char **argv)
+  {
+    options o;
+    for (int i{1}; i < argc; ++i)
+    {
+      std::string_view arg{argv[i]};
+      auto const eq{arg.find('=')};
+      if (!arg.starts_with("--") || eq == std::string_view::npos)
+      {
+        throw std::runtime_error("unexpected argument " + std::string(arg));
+      }
+      auto const name{arg.substr(2, eq - 2)};
+      std::string const value{arg.substr(eq + 1)};
+      if (name == "host")
+        o.host = value;
+      else if (name == "port")
+        o.port = value;
+      else if (name == "threads")
+        o.threads = std::max(1, std::atoi(value.c_str()));
+      else if (name == "duration")
+        o.duration = std::atof(value.c_str());
+      else if (name == "rate")
+        o.rate = std::atof(value.c_str());
+      else if (name == "create")
+        o.create = std::atof(value.c_str());
+      else if (name == "trees")
+        o.trees = std::max(1, std::atoi(value.c_str()));
+      else if (name == "nodes")
+        o.nodes = std::max(2, std::atoi(value.c_str()));
+      else if (name == "shape")
+        o.shape = value;
+      else if (name == "rpc-port")
+        o.rpc_port = value;
+      else if (name == "pipeline")
+        o.pipeline = std::max(1, std::atoi(value.c_str()));
+      else
+        throw std::runtime_error("unknown option " + std::string(name));
+    }
+    if (o.shape != "random" && o.shape != "balanced" && o.shape != "chain")
+    {
+      throw std::runtime_error("unknown shape " + o.shape);
+    }
+    return o;
+  }
+
+  // A tree over the values 1..nodes, in the bracket grammar.
+  std::string tree_text(std::string const &shape, int nodes, std::mt19937 &rng)
+  {
+    std::string result;
+    auto const add = [&result](int value, int left, int right)
+    {
+      result += '[';
+      if (left)
+        result += std::to_string(left) + '<';
+      result += std::to_string(value);
+      if (right)
+        result += '>' + std::to_string(right);
+      result += ']';
+    };
+    if (shape == "chain")
+    {
+      for (int v{1}; v < nodes; ++v)
+        add(v, v + 1, 0);
+    }
+    else if (shape == "balanced")
+    {
+      for (int v{1}; 2 * v <= nodes; ++v)
+        add(v, 2 * v, 2 * v + 1 <= nodes ? 2 * v + 1 : 0);
+    }
+    else
+    {
+      // each new node takes a free child slot picked at random
+      std::vector<std::pair<int, bool>> slots{{1, true}, {1, false}};
+      std::vector<std::pair<int, int>> children(nodes + 1);
+      for (int v{2}; v <= nodes; ++v)
+      {
+        std::uniform_int_distribution<size_t> pick{0, slots.size() - 1};
+        auto const slot{pick(rng)};
+        auto const [parent, left] = slots[slot];
+        slots[slot] = slots.back();
+        slots.pop_back();
+        (left ? children[parent].first : children[parent].second) = v;
+        slots.push_back({v, true});
+        slots.push_back({v, false});
+      }
+      for (int v{1}; v <= nodes; ++v)
+      {
+        if (children[v].first || children[v].second)
+          add(v, children[v].first, children[v].second);
+      }
+    }
+    return result;
+  }
+
+  // The binary protocol over one connection, with requests sent in
+  // batches and their replies read back.
+  class rpc_connection : public tcp_connection
+  {
+  public:
+    using tcp_connection::tcp_connection;
+
+    // Sends the requests at once, then calls on_reply with each reply; false
+    // on network errors, after which the connection is opened again.
+    template <typename F>
+    bool call(std::vector<rpc_request> const &requests, F on_reply)
+    {
+      if (fd_ < 0 && !connect())
+      {
+        return false;
+      }
+      std::string message;
+      for (auto const &r : requests)
+      {
+        message += encode(r);
+      }
+      if (!send_all(message))
+      {
+        disconnect();
+        return false;
+      }
+      for (size_t replied{}; replied < requests.size();)
+      {
+        auto const used{rpc_decode<rpc_reply>(buffer_, [&](rpc_reply r)
+                                              {
+                                                ++replied;
+                                                on_reply(r); })};
+        buffer_.erase(0, used);
+        if (replied < requests.size() && !fill(buffer_.size() + 1))
+        {
+          disconnect();
+          return false;
+        }
+      }
+      return true;
+    }
+  };
+
+  struct results
+  {
+    latency_histogram creates, queries;
+    uint64_t errors{};
+
+    void merge(results const &other)
+    {
+      creates.merge(other.creates);
+      queries.merge(other.queries);
+      errors += other.errors;
+    }
+  };
+
+  void print(char const *kind, latency_histogram const &h, double seconds)
+  {
+    auto const ms = [](uint64_t us)
+    { return us / 1000.0; };
+    std::printf("%-8s %10llu %10.1f %9.2f %9.2f %9.2f %9.2f %9.2f\n", kind, static_cast<unsigned long long>(h.count()), h.count() / seconds,
+                ms(h.percentile(0.5)), ms(h.percentile(0.9)), ms(h.percentile(0.99)), ms(h.percentile(0.999)), ms(h.max()));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  try
+  {
+    auto const o{parse_options(argc, argv)};
+    std::mt19937 rng{1};
+
+    std::vector<std::string> trees;
+    {
+      http_connection setup{o.host, o.port};
+      std::string body;
+      for (size_t i{}; i < o.trees; ++i)
+      {
+        auto const status{setup.request("POST", "/tree", tree_text(o.shape, o.nodes, rng), body)};
+        if (status != 200)
+        {
+          throw std::runtime_error("creating a tree failed with status " + std::to_string(status) + ": " + body);
+        }
+        trees.push_back(body);
+      }
+    }
+    // trees created while measuring are all alike, and made up front
+    auto const create_body{tree_text(o.shape, o.nodes, rng)};
+
+    std::vector<results> per_thread(o.threads);
+    std::vector<std::thread> threads;
+    auto const start{clock_type::now()};
+    auto const deadline{start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(o.duration))};
+    for (size_t t{}; t < o.threads; ++t)
+    {
+      threads.emplace_back([&, t]
+                           {
+                             auto &r{per_thread[t]};
+                             std::mt19937 rng{static_cast<unsigned>(t + 2)};
+                             std::uniform_real_distribution<double> coin{0, 1};
+                             std::uniform_int_distribution<size_t> tree{0, trees.size() - 1};
+                             std::uniform_int_distribution<int> value{1, o.nodes};
+                             http_connection connection{o.host, o.port};
+                             rpc_connection rpc{o.host, o.rpc_port};
+                             std::vector<rpc_request> batch;
+                             std::string body;
+                             // in open loop, this thread's share of the rate
+                             auto const interval{o.rate > 0 ? std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(o.threads / o.rate)) : clock_type::duration{}};
+                             clock_type::time_point due{start + interval * static_cast<long>(t) / static_cast<long>(o.threads)};
+                             for (;;)
+                             {
+                               if (o.rate > 0)
+                               {
+                                 std::this_thread::sleep_until(due);
+                               }
+                               auto const sent{o.rate > 0 ? due : clock_type::now()};
+                               if (sent >= deadline)
+                               {
+                                 break;
+                               }
+                               auto const create{coin(rng) < o.create};
+                               if (!create && !o.rpc_port.empty())
+                               {
+                                 batch.clear();
+                                 for (uint32_t i{}; i < o.pipeline; ++i)
+                                 {
+                                   batch.push_back({i, rpc_op::common_ancestor, trees[tree(rng)], {value(rng), value(rng)}});
+                                 }
+                                 auto const answered{rpc.call(batch, [&](rpc_reply const &reply)
+                                                              {
+                                                                r.errors += reply.status != rpc_status::ok;
+                                                                r.queries.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - sent).count())); })};
+                                 r.errors += !answered;
+                                 due += interval;
+                                 continue;
+                               }
+                               int status;
+                               if (create)
+                               {
+                                 status = connection.request("POST", "/tree", create_body, body);
+                               }
+                               else
+                               {
+                                 auto const path{"/tree/" + trees[tree(rng)] + "/common-ancestor/" + std::to_string(value(rng)) + "/" + std::to_string(value(rng))};
+                                 status = connection.request("GET", path, {}, body);
+                               }
+                               auto const us{std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - sent).count()};
+                               if (status != 200)
+                               {
+                                 ++r.errors;
+                               }
+                               (create ? r.creates : r.queries).record(static_cast<uint64_t>(us));
+                               due += interval;
+                             } });
+    }
+    for (auto &t : threads)
+    {
+      t.join();
+    }
+    auto const seconds{std::chrono::duration<double>(clock_type::now() - start).count()};
+
+    results total;
+    for (auto const &r : per_thread)
+    {
+      total.merge(r);
+    }
+    latency_histogram all{total.creates};
+    all.merge(total.queries);
+    std::printf("%s loop, %zu threads, %.1f s, %zu trees of %d nodes (%s), %llu errors\n",
+                o.rate > 0 ? "open" : "closed", o.threads, seconds, o.trees, o.nodes, o.shape.c_str(),
+                static_cast<unsigned long long>(total.errors));
+    std::printf("%-8s %10s %10s %9s %9s %9s %9s %9s\n", "", "requests", "per s", "p50 ms", "p90 ms", "p99 ms", "p999 ms", "max ms");
+    print("create", total.creates, seconds);
+    print("query", total.queries, seconds);
+    print("all", all, seconds);
+    return total.errors ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+  catch (std::exception const &e)
+  {
+    std::fprintf(stderr, "loadgen: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+}
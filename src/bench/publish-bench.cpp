@@ -0,0 +1,161 @@
+// Counts the path queries answered from in-memory indexes by 1, 2, 4...
+// reader threads while a writer publishes and drops indexes without pause,
+// with the indexes published in an rcu_map, and for comparison in a map
+// under a mutex, read by copying the pointer out, as the server did before.
+//
+//   bench-publish [max threads] [seconds per run]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../rcu.h"
+#include "../tree-index.h"
+
+namespace
+{
+  using index_ptr = std::shared_ptr<tree_index const>;
+
+  constexpr int trees{256};
+  constexpr int nodes{1000};
+
+  index_ptr random_index(std::mt19937 &rng)
+  {
+    flat_tree t;
+    t.ensure(1);
+    for (int value{2}; value <= nodes; ++value)
+    {
+      std::uniform_int_distribution<int> parent{1, value - 1};
+      t.add(parent(rng), value, {});
+    }
+    return std::make_shared<tree_index const>(t);
+  }
+
+  class locked_map
+  {
+  public:
+    template <typename F>
+    bool read(int key, F f)
+    {
+      index_ptr index;
+      {
+        std::lock_guard lock{mutex_};
+        auto pos{map_.find(key)};
+        if (pos == map_.end())
+          return false;
+        index = pos->second;
+      }
+      f(*index);
+      return true;
+    }
+
+    void insert(int key, index_ptr index)
+    {
+      std::lock_guard lock{mutex_};
+      map_[key] = std::move(index);
+    }
+
+    void erase(int key)
+    {
+      std::lock_guard lock{mutex_};
+      map_.erase(key);
+    }
+
+  private:
+    std::mutex mutex_;
+    std::unordered_map<int, index_ptr> map_;
+  };
+
+  class published_map
+  {
+  public:
+    template <typename F>
+    bool read(int key, F f)
+    {
+      return map_.read(key, [&f](tree_index const &index)
+                       { f(index); return true; })
+          .has_value();
+    }
+
+    void insert(int key, index_ptr index) { map_.insert(key, std::move(index)); }
+
+    void erase(int key) { map_.erase(key); }
+
+  private:
+    rcu_map<int, tree_index> map_;
+  };
+
+  // queries per second over all readers
+  template <typename map_t>
+  double run(std::vector<index_ptr> const &indexes, size_t readers, std::chrono::milliseconds duration)
+  {
+    map_t map;
+    for (int key{}; key < trees; ++key)
+    {
+      map.insert(key, indexes[key]);
+    }
+    std::atomic<bool> done{};
+    std::atomic<uint64_t> answered{};
+    std::vector<std::thread> threads;
+    for (size_t r{}; r < readers; ++r)
+    {
+      threads.emplace_back([&map, &done, &answered, r]
+                           {
+                             std::mt19937 rng{static_cast<unsigned>(r)};
+                             std::uniform_int_distribution<int> key{0, trees - 1}, value{1, nodes};
+                             uint64_t n{}, sink{};
+                             while (!done.load(std::memory_order_relaxed))
+                             {
+                               auto const a{value(rng)}, b{value(rng)};
+                               n += map.read(key(rng), [&sink, a, b](tree_index const &index)
+                                             { sink += index.distance(a, b); });
+                             }
+                             answered += n + (sink == 0); });
+    }
+    // ingestion: every tree replaced, and a tenth of them dropped and
+    // published again, over and over
+    threads.emplace_back([&map, &done, &indexes]
+                         {
+                           for (size_t i{}; !done.load(std::memory_order_relaxed); ++i)
+                           {
+                             auto const key{static_cast<int>(i % trees)};
+                             if (i % 10 == 0)
+                               map.erase(key);
+                             map.insert(key, indexes[(i + 1) % indexes.size()]);
+                           } });
+    std::this_thread::sleep_for(duration);
+    done = true;
+    for (auto &t : threads)
+    {
+      t.join();
+    }
+    return answered / std::chrono::duration<double>(duration).count();
+  }
+}
+
+int main(int argc, char **argv)
+{
+  auto const max_threads{argc > 1 ? static_cast<size_t>(std::atoi(argv[1])) : std::max(std::thread::hardware_concurrency(), 1u)};
+  std::chrono::milliseconds const duration{argc > 2 ? std::atoi(argv[2]) * 1000 : 2000};
+  std::mt19937 rng{42};
+  std::vector<index_ptr> indexes;
+  for (int i{}; i < trees * 2; ++i)
+  {
+    indexes.push_back(random_index(rng));
+  }
+
+  std::printf("%d trees of %d nodes, queries per second\n%-12s %14s %14s\n", trees, nodes, "readers", "mutex", "rcu");
+  for (size_t readers{1}; readers <= max_threads; readers *= 2)
+  {
+    auto const locked{run<locked_map>(indexes, readers, duration)};
+    auto const published{run<published_map>(indexes, readers, duration)};
+    std::printf("%-12zu %14.0f %14.0f  %5.2fx\n", readers, locked, published, published / locked);
+  }
+}
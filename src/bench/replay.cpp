@@ -0,0 +1,295 @@
+// Replays a capture taken with --capture against a running instance, each
+// request when it arrived, scaled by --speed, and reports latency
+// percentiles by method. With --out, writes down the status, latency and
+// a hash of the response of each request, so that two builds replaying the
+// same capture can be compared with --compare.
+//
+//   replay --log=FILE [--host=localhost] [--port=8080] [--speed=1]
+//          [--connections=4] [--out=FILE]
+//   replay --compare FILE FILE
+//
+// Requests go to the connections in turn, and latency counts from when a
+// request was due, as loadgen's open loop does. --speed=0 sends them as
+// fast as the connections go. Requests captured with --capture-hashes have
+// no body to send, and are left out. A tree id in a uri is replaced by the
+// one the post that created it got in the replay, waiting for its answer
+// if need be, so the instance can start from an empty store.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../capture.h"
+#include "../latency-histogram.h"
+#include "http-client.h"
+
+namespace
+{
+  using clock_type = std::chrono::steady_clock;
+
+  struct options
+  {
+    std::string log;
+    std::string host{"localhost"};
+    std::string port{"8080"};
+    double speed{1};
+    size_t connections{4};
+    std::string out;
+  };
+
+  options parse_options(int argc, char **argv)
+  {
+    options o;
+    for (int i{1}; i < argc; ++i)
+    {
+      std::string_view arg{argv[i]};
+      auto const eq{arg.find('=')};
+      if (!arg.starts_with("--") || eq == std::string_view::npos)
+      {
+        throw std::runtime_error("unexpected argument " + std::string(arg));
+      }
+      auto const name{arg.substr(2, eq - 2)};
+      std::string const value{arg.substr(eq + 1)};
+      if (name == "log")
+        o.log = value;
+      else if (name == "host")
+        o.host = value;
+      else if (name == "port")
+        o.port = value;
+      else if (name == "speed")
+        o.speed = std::max(0.0, std::atof(value.c_str()));
+      else if (name == "connections")
+        o.connections = std::max(1, std::atoi(value.c_str()));
+      else if (name == "out")
+        o.out = value;
+      else
+        throw std::runtime_error("unknown option --" + std::string(name));
+    }
+    if (o.log.empty())
+    {
+      throw std::runtime_error("--log= is needed");
+    }
+    return o;
+  }
+
+  std::string read_file(std::string const &path)
+  {
+    std::ifstream in{path, std::ios::binary};
+    if (!in)
+    {
+      throw std::runtime_error("can't read " + path);
+    }
+    return {std::istreambuf_iterator<char>{in}, {}};
+  }
+
+  // what a request got, a line of the results
+  struct outcome
+  {
+    size_t index;
+    int status;
+    uint64_t latency_us;
+    uint64_t response_hash;
+    std::string request;
+  };
+
+  void print_header()
+  {
+    std::printf("%-8s %10s %9s %9s %9s %9s %9s\n", "", "requests", "p50 ms", "p90 ms", "p99 ms", "p999 ms", "max ms");
+  }
+
+  void print(std::string const &kind, latency_histogram const &h)
+  {
+    auto const ms = [](uint64_t us)
+    { return us / 1000.0; };
+    std::printf("%-8s %10llu %9.2f %9.2f %9.2f %9.2f %9.2f\n", kind.c_str(), static_cast<unsigned long long>(h.count()),
+                ms(h.percentile(0.5)), ms(h.percentile(0.9)), ms(h.percentile(0.99)), ms(h.percentile(0.999)), ms(h.max()));
+  }
+
+  int replay(options const &o)
+  {
+    std::vector<captured_request> requests;
+    // by their place in the capture, of those kept
+    std::unordered_map<uint64_t, size_t> kept;
+    std::vector<std::optional<std::string>> answers;
+    uint64_t read{};
+    size_t hashed{};
+    read_capture(
+        read_file(o.log), [&](captured_request r)
+        {
+          auto const place{read++};
+          if (r.body_kind == capture_body::hash)
+          {
+            ++hashed;
+            return;
+          }
+          kept.emplace(place, requests.size());
+          requests.push_back(std::move(r));
+          answers.emplace_back(); },
+        [&](captured_response r)
+        {
+          auto const pos{kept.find(r.request)};
+          if (pos != kept.end())
+            answers[pos->second] = std::move(r.body); });
+    replay_ids ids{answers};
+
+    std::vector<outcome> outcomes(requests.size());
+    std::vector<std::map<std::string, latency_histogram>> per_connection(o.connections);
+    std::vector<std::thread> threads;
+    auto const start{clock_type::now()};
+    for (size_t c{}; c < o.connections; ++c)
+    {
+      threads.emplace_back([&, c]
+                           {
+                             http_connection connection{o.host, o.port};
+                             std::string body;
+                             for (auto i{c}; i < requests.size(); i += o.connections)
+                             {
+                               auto const &r{requests[i]};
+                               auto const uri{ids.map(r.uri, i)};
+                               auto sent{clock_type::now()};
+                               if (o.speed > 0)
+                               {
+                                 sent = start + std::chrono::duration_cast<clock_type::duration>(r.arrival / o.speed);
+                                 std::this_thread::sleep_until(sent);
+                               }
+                               auto const dedup_off{(r.flags & captured_request::dedup_off) != 0};
+                               auto const status{connection.request(r.method, uri, r.body, body,
+                                                                    dedup_off ? "X-Tree-Dedup: off\r\n" : "")};
+                               if (answers[i])
+                               {
+                                 ids.answered(i, status == 200 ? body : *answers[i]);
+                               }
+                               auto const us{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - sent).count())};
+                               per_connection[c][r.method].record(us);
+                               outcomes[i] = {i, status, us, xxh64(body), r.method + ' ' + r.uri};
+                             } });
+    }
+    for (auto &t : threads)
+    {
+      t.join();
+    }
+    auto const seconds{std::chrono::duration<double>(clock_type::now() - start).count()};
+
+    std::map<std::string, latency_histogram> by_method;
+    latency_histogram all;
+    for (auto const &methods : per_connection)
+    {
+      for (auto const &[method, h] : methods)
+      {
+        by_method[method].merge(h);
+        all.merge(h);
+      }
+    }
+    size_t failed{};
+    for (auto const &result : outcomes)
+    {
+      failed += result.status == 0;
+    }
+    std::printf("%zu requests in %.1f s over %zu connections, %zu unanswered, %zu left out for want of a body\n",
+                requests.size(), seconds, o.connections, failed, hashed);
+    print_header();
+    for (auto const &[method, h] : by_method)
+    {
+      print(method, h);
+    }
+    print("all", all);
+
+    if (!o.out.empty())
+    {
+      std::ofstream out{o.out};
+      for (auto const &result : outcomes)
+      {
+        out << result.index << '\t' << result.status << '\t' << result.latency_us << '\t' << result.response_hash << '\t'
+            << result.request << '\n';
+      }
+      if (!out)
+      {
+        throw std::runtime_error("can't write " + o.out);
+      }
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  std::vector<outcome> read_results(std::string const &path)
+  {
+    std::istringstream in{read_file(path)};
+    std::vector<outcome> results;
+    for (std::string line; std::getline(in, line);)
+    {
+      std::istringstream fields{line};
+      outcome r{};
+      if (!(fields >> r.index >> r.status >> r.latency_us >> r.response_hash))
+      {
+        throw std::runtime_error(path + " isn't the output of --out");
+      }
+      fields.ignore(1);
+      std::getline(fields, r.request);
+      results.push_back(std::move(r));
+    }
+    return results;
+  }
+
+  // Both latency distributions, and the requests whose status or response
+  // differ. The ids posts are answered with only match when both builds
+  // started from the same store.
+  int compare(std::string const &a_path, std::string const &b_path)
+  {
+    auto const a{read_results(a_path)}, b{read_results(b_path)};
+    if (a.size() != b.size())
+    {
+      throw std::runtime_error("the results are of different captures, " + std::to_string(a.size()) + " and " +
+                               std::to_string(b.size()) + " requests");
+    }
+    latency_histogram a_latency, b_latency;
+    size_t statuses{}, responses{}, listed{};
+    for (size_t i{}; i < a.size(); ++i)
+    {
+      a_latency.record(a[i].latency_us);
+      b_latency.record(b[i].latency_us);
+      auto const status{a[i].status != b[i].status};
+      auto const response{!status && a[i].response_hash != b[i].response_hash};
+      statuses += status;
+      responses += response;
+      if ((status || response) && listed++ < 10)
+      {
+        std::printf("#%zu %s: %d and %d%s\n", a[i].index, a[i].request.c_str(), a[i].status, b[i].status,
+                    response ? ", responses differ" : "");
+      }
+    }
+    std::printf("%zu requests, %zu with another status, %zu with another response\n", a.size(), statuses, responses);
+    print_header();
+    print("a", a_latency);
+    print("b", b_latency);
+    return statuses || responses ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  try
+  {
+    if (argc > 1 && std::string_view{argv[1]} == "--compare")
+    {
+      if (argc != 4)
+      {
+        throw std::runtime_error("--compare takes two files written with --out");
+      }
+      return compare(argv[2], argv[3]);
+    }
+    return replay(parse_options(argc, argv));
+  }
+  catch (std::exception const &e)
+  {
+    std::fprintf(stderr, "replay: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,682 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "version.h"
+#if !defined(VERSION)
+#define VERSION "test"
+#endif
+
+#include "sqlitedb.h"
+#include "tree-index.h"
+#include "tree-parser.h"
+
+// A finished tree as a packed_adapter stores it, in one record:
+//
+//   "TRPK", version, flags, count          4 x 4 bytes
+//   values                                 count x int32
+//   parents, -1 for roots                  count x int32
+//   sides, 0 root, 1 left, 2 right child   count x uint8, padded to 4
+//   positions by increasing value          count x int32, if flags & 1
+//
+// all little-endian, so on most hosts arrays are copied out as they are.
+struct packed_tree
+{
+  static constexpr std::string_view magic{"TRPK"};
+  static constexpr uint32_t version{1};
+  static constexpr uint32_t has_value_order{1};
+
+  enum side : uint8_t
+  {
+    root,
+    left,
+    right
+  };
+
+  std::vector<int> values;
+  std::vector<int32_t> parents;
+  std::vector<uint8_t> sides;
+  std::vector<int32_t> by_value;
+
+  size_t size() const { return values.size(); }
+
+  // The position of the node with the value, or flat_tree::none.
+  int32_t find(int value) const
+  {
+    auto const pos{std::lower_bound(by_value.begin(), by_value.end(), value, [this](int32_t p, int v)
+                                    { return values[p] < v; })};
+    return pos == by_value.end() || values[*pos] != value ? flat_tree::none : *pos;
+  }
+
+  std::string encode()
+  {
+    if (by_value.size() != size())
+    {
+      by_value.resize(size());
+      std::iota(by_value.begin(), by_value.end(), 0);
+      std::sort(by_value.begin(), by_value.end(), [this](int32_t a, int32_t b)
+                { return values[a] < values[b]; });
+    }
+    auto const count{static_cast<uint32_t>(size())};
+    std::string result{magic};
+    put(result, version);
+    put(result, has_value_order);
+    put(result, count);
+    put_array(result, values);
+    put_array(result, parents);
+    result.append(reinterpret_cast<char const *>(sides.data()), sides.size());
+    result.append(padding(sides.size()), '\0');
+    put_array(result, by_value);
+    return result;
+  }
+
+  static packed_tree decode(std::string_view body)
+  {
+    if (body.size() < 16 || body.substr(0, 4) != magic)
+    {
+      throw std::runtime_error("Corrupt tree.");
+    }
+    if (get(body, 4) != version)
+    {
+      throw std::runtime_error("Unsupported tree version.");
+    }
+    auto const flags{get(body, 8)};
+    size_t const count{get(body, 12)};
+    auto const with_order{(flags & has_value_order) != 0};
+    if (body.size() != 16 + 8 * count + count + padding(count) + (with_order ? 4 * count : 0))
+    {
+      throw std::runtime_error("Corrupt tree.");
+    }
+    packed_tree result;
+    size_t at{16};
+    get_array(body, at, result.values, count);
+    get_array(body, at, result.parents, count);
+    result.sides.assign(body.begin() + at, body.begin() + at + count);
+    at += count + padding(count);
+    // roots and only roots have no side, and each side of a node one child
+    // at most, as loaded_tree relies on
+    std::vector<uint8_t> children(count);
+    for (size_t i{}; i < count; ++i)
+    {
+      auto const parent{result.parents[i]};
+      auto const side{result.sides[i]};
+      if (parent < flat_tree::none || parent >= static_cast<int32_t>(count) || side > right ||
+          (parent == flat_tree::none) != (side == root))
+      {
+        throw std::runtime_error("Corrupt tree.");
+      }
+      if (side != root)
+      {
+        // left and right are bits of their own
+        if (children[parent] & side)
+        {
+          throw std::runtime_error("Corrupt tree.");
+        }
+        children[parent] |= side;
+      }
+    }
+    if (with_order)
+    {
+      get_array(body, at, result.by_value, count);
+      if (std::any_of(result.by_value.begin(), result.by_value.end(), [count](int32_t p)
+                      { return p < 0 || p >= static_cast<int32_t>(count); }))
+      {
+        throw std::runtime_error("Corrupt tree.");
+      }
+    }
+    else
+    {
+      result.by_value.resize(count);
+      std::iota(result.by_value.begin(), result.by_value.end(), 0);
+      std::sort(result.by_value.begin(), result.by_value.end(), [&result](int32_t a, int32_t b)
+                { return result.values[a] < result.values[b]; });
+    }
+    return result;
+  }
+
+private:
+  static size_t padding(size_t bytes) { return (4 - bytes % 4) % 4; }
+
+  static void put(std::string &out, uint32_t word)
+  {
+    for (int shift{}; shift < 32; shift += 8)
+    {
+      out += static_cast<char>((word >> shift) & 0xff);
+    }
+  }
+
+  static uint32_t get(std::string_view in, size_t at)
+  {
+    uint32_t word{};
+    for (int i{3}; i >= 0; --i)
+    {
+      word = (word << 8) | static_cast<uint8_t>(in[at + i]);
+    }
+    return word;
+  }
+
+  template <typename T>
+  static void put_array(std::string &out, std::vector<T> const &array)
+  {
+    static_assert(sizeof(T) == 4);
+    if constexpr (std::endian::native == std::endian::little)
+    {
+      out.append(reinterpret_cast<char const *>(array.data()), array.size() * 4);
+    }
+    else
+    {
+      for (auto v : array)
+        put(out, static_cast<uint32_t>(v));
+    }
+  }
+
+  template <typename T>
+  static void get_array(std::string_view in, size_t &at, std::vector<T> &array, size_t count)
+  {
+    static_assert(sizeof(T) == 4);
+    array.resize(count);
+    if constexpr (std::endian::native == std::endian::little)
+    {
+      std::memcpy(array.data(), in.data() + at, count * 4);
+    }
+    else
+    {
+      for (size_t i{}; i < count; ++i)
+        array[i] = static_cast<T>(get(in, at + 4 * i));
+    }
+    at += count * 4;
+  }
+};
+
+// Where a packed_adapter keeps finished trees, each as one encoded
+// packed_tree, and the trees' content hashes.
+template <typename S>
+concept packed_tree_store = requires(S s, int64_t id, std::string_view body, std::vector<std::string> const &bodies, uint64_t hash) {
+  // a new tree id, never handed out before
+  { s.reserve() } -> std::same_as<int64_t>;
+  // takes the given id, or throws if it is taken
+  { s.claim(id) };
+  // gives back an id reserved or claimed whose tree was never written
+  { s.release(id) };
+  { s.write(id, body) };
+  // the body written for the id, if any
+  { s.read(id) } -> std::same_as<std::optional<std::string>>;
+  // writes new trees at once, returning their ids
+  { s.write_all(bodies) } -> std::same_as<std::vector<int64_t>>;
+  { s.find_hash(hash) } -> std::same_as<std::optional<int64_t>>;
+  { s.remember_hash(hash, id) };
+};
+
+// Stores packed trees as rows of a SQLite table, which processes can share.
+class sqlite_tree_store
+{
+public:
+  explicit sqlite_tree_store(std::string const &file = "trees-blob-" VERSION ".db")
+  {
+    auto rc{db_.open(file)};
+    if (rc != SQLITE_OK)
+    {
+      throw std::runtime_error("unable to open the database");
+    }
+    db_.create_table("tree_blob", std::array<std::string_view, 2>{"id INTEGER PRIMARY KEY", "body BLOB"}, true);
+    db_.create_table("tree_hash", std::array<std::string_view, 2>{"hash INTEGER PRIMARY KEY", "tree INTEGER"}, true);
+  }
+
+  // The id is taken by a row without a body, so that processes sharing
+  // the file never hand out the same one.
+  int64_t reserve()
+  {
+    int64_t id{};
+    db_.exec("INSERT INTO tree_blob (body) VALUES (NULL)");
+    db_.exec("SELECT last_insert_rowid()", [&id](auto values, auto columns)
+             { id = std::atoll(std::string(values.front()).c_str()); });
+    if (id == 0)
+    {
+      throw std::runtime_error("couldn't obtain last tree id");
+    }
+    return id;
+  }
+
+  void claim(int64_t id)
+  {
+    sqlitedb::int64_parameter id_param{id};
+    bool exists{};
+    db_.exec("SELECT id FROM tree_blob WHERE id = ?", [&exists](auto values, auto columns)
+             { exists = true; },
+             {&id_param});
+    if (exists)
+    {
+      throw std::runtime_error("Tree already exists.");
+    }
+    db_.exec("INSERT INTO tree_blob (id, body) VALUES (?, NULL)", {&id_param});
+  }
+
+  // Only a row without a body, so a stored tree is never lost.
+  void release(int64_t id)
+  {
+    sqlitedb::int64_parameter id_param{id};
+    db_.exec("DELETE FROM tree_blob WHERE id = ? AND body IS NULL", {&id_param});
+  }
+
+  // In a single UPDATE of the row.
+  void write(int64_t id, std::string_view body)
+  {
+    sqlitedb::int64_parameter id_param{id};
+    sqlitedb::blob_parameter body_param{body};
+    db_.exec("UPDATE tree_blob SET body = ?2 WHERE id = ?1", {&id_param, &body_param});
+  }
+
+  // In a single transaction, an INSERT each.
+  std::vector<int64_t> write_all(std::vector<std::string> const &bodies)
+  {
+    sqlitedb::transaction tx{db_};
+    sqlitedb::statement insert{db_, "INSERT INTO tree_blob (body) VALUES (?)"};
+    std::vector<int64_t> ids;
+    ids.reserve(bodies.size());
+    for (auto const &body : bodies)
+    {
+      sqlitedb::blob_parameter body_param{body};
+      insert.run({&body_param});
+      ids.push_back(db_.last_insert_rowid());
+    }
+    tx.commit();
+    return ids;
+  }
+
+  std::optional<std::string> read(int64_t id) const { return db_.read_blob("tree_blob", "body", id); }
+
+  std::optional<int64_t> find_hash(uint64_t hash) const
+  {
+    sqlitedb::int64_parameter hash_param{static_cast<sqlite3_int64>(hash)};
+    std::optional<int64_t> result;
+    db_.exec("SELECT tree FROM tree_hash WHERE hash = ?", [&result](auto values, auto columns)
+             { result = std::atoll(std::string(values.front()).c_str()); },
+             {&hash_param});
+    return result;
+  }
+
+  void remember_hash(uint64_t hash, int64_t id)
+  {
+    sqlitedb::int64_parameter hash_param{static_cast<sqlite3_int64>(hash)};
+    sqlitedb::int64_parameter tree_id_param{id};
+    db_.exec("INSERT INTO tree_hash (hash, tree) VALUES (?, ?) ON CONFLICT(hash) DO NOTHING", {&hash_param, &tree_id_param});
+  }
+
+private:
+  sqlitedb db_;
+};
+
+// The repo_t of data_adapter, storing each tree as a single packed_tree
+// in a packed_tree_store instead of a row per node. Trees are built in
+// memory and stored by commit_tree in one write, after which they don't
+// change; they load with one read. Node keys are the tree id in the high
+// 32 bits and the node's position plus one in the low ones, so 0 is no
+// node.
+template <packed_tree_store store_t>
+class packed_adapter
+{
+public:
+  using node_key_t = int64_t;
+  using tree_key_t = std::string;
+
+  // with the arguments of the store
+  template <typename... args_t>
+  explicit packed_adapter(args_t &&...args) : store_{std::forward<args_t>(args)...}
+  {
+  }
+
+  packed_adapter(const packed_adapter &) = delete;
+  packed_adapter(packed_adapter &&) = delete;
+
+  node_key_t get_parent_by_id(node_key_t node_id) const
+  {
+    auto const &t{tree_of(node_id)};
+    auto const parent{t.parents[position(t, node_id)]};
+    return parent == flat_tree::none ? node_key_t() : key(node_id >> 32, parent);
+  }
+
+  tree_key_t new_tree()
+  {
+    auto const id{store_.reserve()};
+    pending_[id];
+    return std::to_string(id);
+  }
+
+  node_key_t ensure_node(tree_key_t const &tree_id, int value)
+  {
+    auto const id{rowid(tree_id)};
+    return key(id, building(id).ensure(value));
+  }
+
+  int get_value_by_id(node_key_t node_id) const
+  {
+    auto const &t{tree_of(node_id)};
+    return t.values[position(t, node_id)];
+  }
+
+  node_key_t get_id_by_value(tree_key_t const &tree_id, int value) const
+  {
+    auto const id{rowid(tree_id)};
+    auto const pending{pending_.find(id)};
+    auto const pos{pending != pending_.end() ? pending->second.find(value) : stored(id).tree.find(value)};
+    if (pos == flat_tree::none)
+    {
+      throw std::runtime_error("Not found.");
+    }
+    return key(id, pos);
+  }
+
+  void bind_left(node_key_t node, node_key_t left) { bind(node, left, packed_tree::left); }
+
+  void bind_right(node_key_t node, node_key_t right) { bind(node, right, packed_tree::right); }
+
+  // Calls cb(value, left value, right value) once per node of the tree.
+  template <typename T>
+  void visit_nodes(tree_key_t const &tree_id, T cb) const
+  {
+    auto const t{find_stored(rowid(tree_id))};
+    if (t)
+    {
+      for (size_t i{}; i < t->tree.size(); ++i)
+      {
+        visit(*t, static_cast<int32_t>(i), cb);
+      }
+    }
+  }
+
+  // As visit_nodes, into the arrays the index is built from, without
+  // going through a node at a time.
+  flat_tree flatten(tree_key_t const &tree_id) const
+  {
+    auto const id{rowid(tree_id)};
+    if (last_ && last_id_ == id)
+    {
+      return {last_->tree.values, last_->tree.parents};
+    }
+    auto body{store_.read(id)};
+    if (!body)
+    {
+      return {};
+    }
+    auto t{packed_tree::decode(*body)};
+    return {std::move(t.values), std::move(t.parents)};
+  }
+
+  // Creates the tree with the given id, as when it's moved from another instance.
+  void create_tree(tree_key_t const &tree_id)
+  {
+    auto const id{rowid(tree_id)};
+    if (pending_.count(id))
+    {
+      throw std::runtime_error("Tree already exists.");
+    }
+    store_.claim(id);
+    pending_[id];
+  }
+
+  void add_nodes(tree_key_t const &tree_id, std::vector<tree_parser::triplet> const &nodes) { building(rowid(tree_id)).add(nodes); }
+
+  // Stores the tree built so far, in a single write.
+  void commit_tree(tree_key_t const &tree_id)
+  {
+    auto const id{rowid(tree_id)};
+    auto pos{pending_.find(id)};
+    if (pos == pending_.end())
+    {
+      throw std::runtime_error("Not found.");
+    }
+    store_.write(id, pos->second.tree.encode());
+    pending_.erase(pos);
+  }
+
+  // Gives up on a tree not committed yet, as when storing it failed.
+  void drop_tree(tree_key_t const &tree_id)
+  {
+    auto const id{rowid(tree_id)};
+    if (pending_.erase(id))
+    {
+      store_.release(id);
+    }
+  }
+
+  // A whole tree as store_trees takes it, encoded.
+  using bulk_tree = std::string;
+
+  // Can be called from any thread, leaving store_trees only the writes.
+  static bulk_tree pack(std::vector<tree_parser::triplet> const &nodes)
+  {
+    pending_tree t;
+    t.add(nodes);
+    return t.tree.encode();
+  }
+
+  // Stores whole trees at once, as new trees, and returns their ids.
+  std::vector<tree_key_t> store_trees(std::vector<bulk_tree> const &trees)
+  {
+    std::vector<tree_key_t> ids;
+    ids.reserve(trees.size());
+    for (auto const id : store_.write_all(trees))
+    {
+      ids.push_back(std::to_string(id));
+    }
+    return ids;
+  }
+
+  // As visit_nodes, but at most limit nodes, by increasing value, those
+  // after the given one.
+  template <typename T>
+  void visit_nodes_after(tree_key_t const &tree_id, std::optional<int> after, size_t limit, T cb) const
+  {
+    auto const t{find_stored(rowid(tree_id))};
+    if (!t)
+    {
+      return;
+    }
+    auto const &order{t->tree.by_value};
+    auto pos{order.begin()};
+    if (after.has_value())
+    {
+      pos = std::upper_bound(order.begin(), order.end(), after.value(), [t](int v, int32_t p)
+                             { return v < t->tree.values[p]; });
+    }
+    for (; pos != order.end() && limit > 0; ++pos, --limit)
+    {
+      visit(*t, *pos, cb);
+    }
+  }
+
+  // The tree posted with the given content hash, if any.
+  std::optional<tree_key_t> find_tree_by_hash(uint64_t hash) const
+  {
+    auto const id{store_.find_hash(hash)};
+    if (!id)
+    {
+      return {};
+    }
+    return std::to_string(*id);
+  }
+
+  // The first tree remembered for a hash stays.
+  void remember_tree_hash(uint64_t hash, tree_key_t const &tree_id) { store_.remember_hash(hash, rowid(tree_id)); }
+
+private:
+  // A tree being built: positions by value, until it is stored.
+  struct pending_tree
+  {
+    packed_tree tree;
+    std::unordered_map<int, int32_t> positions;
+
+    int32_t ensure(int value)
+    {
+      auto [pos, inserted] = positions.try_emplace(value, static_cast<int32_t>(tree.size()));
+      if (inserted)
+      {
+        tree.values.push_back(value);
+        tree.parents.push_back(flat_tree::none);
+        tree.sides.push_back(packed_tree::root);
+      }
+      return pos->second;
+    }
+
+    int32_t find(int value) const
+    {
+      auto pos{positions.find(value)};
+      return pos == positions.end() ? flat_tree::none : pos->second;
+    }
+
+    // Binding the same child again is harmless, another parent isn't.
+    void bind(int32_t parent, int32_t child, packed_tree::side side)
+    {
+      if (tree.parents[child] != flat_tree::none && (tree.parents[child] != parent || tree.sides[child] != side))
+      {
+        throw std::runtime_error("Node " + std::to_string(tree.values[child]) + " has two parents.");
+      }
+      tree.parents[child] = parent;
+      tree.sides[child] = side;
+    }
+
+    void add(std::vector<tree_parser::triplet> const &nodes)
+    {
+      for (auto const &node : nodes)
+      {
+        auto const this_node{ensure(node.value)};
+        if (node.left.has_value())
+        {
+          bind(this_node, ensure(node.left.value()), packed_tree::left);
+        }
+        if (node.right.has_value())
+        {
+          bind(this_node, ensure(node.right.value()), packed_tree::right);
+        }
+      }
+    }
+  };
+
+  // A stored tree, with the children of each node.
+  struct loaded_tree
+  {
+    packed_tree tree;
+    std::vector<int32_t> left;
+    std::vector<int32_t> right;
+
+    explicit loaded_tree(packed_tree t)
+        : tree{std::move(t)}, left(tree.size(), flat_tree::none), right(tree.size(), flat_tree::none)
+    {
+      for (size_t i{}; i < tree.size(); ++i)
+      {
+        if (tree.sides[i] == packed_tree::left)
+          left[tree.parents[i]] = static_cast<int32_t>(i);
+        else if (tree.sides[i] == packed_tree::right)
+          right[tree.parents[i]] = static_cast<int32_t>(i);
+      }
+    }
+  };
+
+  static node_key_t key(int64_t tree_id, int32_t position) { return (tree_id << 32) | (position + 1); }
+
+  static int64_t rowid(tree_key_t const &tree_id)
+  {
+    int64_t id{};
+    auto const [end, error]{std::from_chars(tree_id.data(), tree_id.data() + tree_id.size(), id)};
+    if (error != std::errc{} || end != tree_id.data() + tree_id.size() || id < 0 || id > INT32_MAX)
+    {
+      throw std::runtime_error("Not found.");
+    }
+    return id;
+  }
+
+  static size_t position(packed_tree const &t, node_key_t node_id)
+  {
+    auto const pos{static_cast<size_t>(node_id & 0xffffffff)};
+    if (pos == 0 || pos > t.size())
+    {
+      throw std::runtime_error("Not found.");
+    }
+    return pos - 1;
+  }
+
+  template <typename T>
+  static void visit(loaded_tree const &t, int32_t node, T &cb)
+  {
+    auto const value_of = [&t](int32_t child) -> std::optional<int>
+    {
+      if (child == flat_tree::none)
+        return {};
+      return t.tree.values[child];
+    };
+    cb(t.tree.values[node], value_of(t.left[node]), value_of(t.right[node]));
+  }
+
+  pending_tree &building(int64_t id)
+  {
+    auto pos{pending_.find(id)};
+    if (pos == pending_.end())
+    {
+      throw std::runtime_error(find_stored(id) ? "Tree already stored." : "Not found.");
+    }
+    return pos->second;
+  }
+
+  void bind(node_key_t node, node_key_t child, packed_tree::side side)
+  {
+    auto &t{building(node >> 32)};
+    if (child >> 32 != node >> 32)
+    {
+      throw std::runtime_error("Nodes of different trees.");
+    }
+    t.bind(static_cast<int32_t>(position(t.tree, node)), static_cast<int32_t>(position(t.tree, child)), side);
+  }
+
+  packed_tree const &tree_of(node_key_t node_id) const
+  {
+    auto const id{node_id >> 32};
+    auto const pending{pending_.find(id)};
+    return pending != pending_.end() ? pending->second.tree : stored(id).tree;
+  }
+
+  loaded_tree const &stored(int64_t id) const
+  {
+    auto const t{find_stored(id)};
+    if (!t)
+    {
+      throw std::runtime_error("Not found.");
+    }
+    return *t;
+  }
+
+  // Walks read a tree a node at a time, so the last one read is kept.
+  std::shared_ptr<loaded_tree const> find_stored(int64_t id) const
+  {
+    if (last_ && last_id_ == id)
+    {
+      return last_;
+    }
+    auto body{store_.read(id)};
+    if (!body)
+    {
+      return nullptr;
+    }
+    last_ = std::make_shared<loaded_tree const>(packed_tree::decode(*body));
+    last_id_ = id;
+    return last_;
+  }
+
+  store_t store_;
+  std::unordered_map<int64_t, pending_tree> pending_;
+  mutable std::shared_ptr<loaded_tree const> last_;
+  mutable int64_t last_id_{};
+};
+
+using blob_adapter = packed_adapter<sqlite_tree_store>;
@@ -0,0 +1,423 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "tree-hash.h"
+
+// Requests as an instance received them, and the answers to those that
+// create trees, written down to be replayed later against another build. A
+// capture starts with "TRCP" and the version, then has a record per request
+// or answer, all little-endian:
+//
+//   record   kind, 0 request, 1 response                 u8
+//   request  arrival, µs since the capture began         u64
+//            flags, 1 for X-Tree-Dedup: off              u8
+//            method length, method                       u8 + bytes
+//            uri length, uri                             u16 + bytes
+//            body kind, 0 none, 1 whole, 2 hash          u8
+//            body length                                 u32, unless none
+//            body, or its XXH64                          bytes or u64
+//   response request, by its place among the requests   u64
+//            body length, body                           u32 + bytes
+//
+// Version 1 captures have requests only, without the kind. A capture cut
+// short by a crash ends in a partial record, which readers leave out.
+inline constexpr std::string_view capture_magic{"TRCP"};
+inline constexpr uint32_t capture_version{2};
+
+enum class capture_body : uint8_t
+{
+  none,
+  whole,
+  hash
+};
+
+struct captured_request
+{
+  static constexpr uint8_t dedup_off{1};
+
+  std::chrono::microseconds arrival;
+  uint8_t flags;
+  std::string method;
+  std::string uri;
+  capture_body body_kind;
+  uint32_t body_length;
+  // whole, if kept
+  std::string body;
+  // of the body, if only that was kept
+  uint64_t body_hash;
+};
+
+// What a request was answered with, such as the id of a posted tree.
+struct captured_response
+{
+  // the first request read being 0
+  uint64_t request;
+  std::string body;
+};
+
+struct capture_options
+{
+  // bodies, or only their hash, which is shorter but can't be replayed
+  bool bodies{true};
+  // beyond which requests are counted but not kept
+  uint64_t max_bytes{uint64_t{1} << 30};
+};
+
+namespace capture_detail
+{
+  inline void put(std::string &out, uint64_t v, int bytes)
+  {
+    for (int shift{}; shift < bytes * 8; shift += 8)
+      out += static_cast<char>((v >> shift) & 0xff);
+  }
+
+  // Reads from a capture, throwing if it runs short.
+  struct reader
+  {
+    std::string_view data;
+
+    uint64_t get(int bytes)
+    {
+      if (data.size() < static_cast<size_t>(bytes))
+      {
+        throw std::out_of_range("Truncated record.");
+      }
+      uint64_t v{};
+      for (int i{bytes - 1}; i >= 0; --i)
+        v = (v << 8) | static_cast<uint8_t>(data[i]);
+      data.remove_prefix(bytes);
+      return v;
+    }
+
+    std::string_view take(size_t n)
+    {
+      if (data.size() < n)
+      {
+        throw std::out_of_range("Truncated record.");
+      }
+      auto const result{data.substr(0, n)};
+      data.remove_prefix(n);
+      return result;
+    }
+  };
+}
+
+// Writes a capture. The event loop only appends to a buffer, which a
+// thread of its own writes out every flush_interval, or as soon as it
+// holds flush_bytes, so capturing costs a request a copy of its uri and
+// body.
+class capture_writer
+{
+public:
+  struct stats
+  {
+    uint64_t records;
+    uint64_t dropped;
+    uint64_t bytes;
+
+    std::string json() const
+    {
+      return "{\"records\":" + std::to_string(records) + ",\"dropped\":" + std::to_string(dropped) +
+             ",\"bytes\":" + std::to_string(bytes) + '}';
+    }
+  };
+
+  capture_writer(std::string const &path, capture_options options = {})
+      : options_{options}, start_{std::chrono::steady_clock::now()}
+  {
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+      throw std::runtime_error("unable to open the capture " + path);
+    }
+    buffer_ = capture_magic;
+    capture_detail::put(buffer_, capture_version, 4);
+    bytes_ = buffer_.size();
+    flusher_ = std::thread{[this]
+                           { flush_periodically(); }};
+  }
+
+  capture_writer(capture_writer const &) = delete;
+
+  ~capture_writer()
+  {
+    {
+      std::lock_guard lock{mutex_};
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    flusher_.join();
+    close(fd_);
+  }
+
+  // The place of the request among those kept, for respond, unless it
+  // wasn't kept.
+  std::optional<uint64_t> record(std::string_view method, std::string_view uri, std::string_view body, uint8_t flags = 0)
+  {
+    method = method.substr(0, UINT8_MAX);
+    uri = uri.substr(0, UINT16_MAX);
+    auto const arrival{std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_)};
+    auto const kind{body.empty() ? capture_body::none : options_.bodies ? capture_body::whole
+                                                                        : capture_body::hash};
+    auto const size{1 + 8 + 1 + 1 + method.size() + 2 + uri.size() + 1 +
+                    (kind == capture_body::none ? 0 : 4 + (kind == capture_body::whole ? body.size() : 8))};
+    std::lock_guard lock{mutex_};
+    if (bytes_ + size > options_.max_bytes)
+    {
+      ++dropped_;
+      return std::nullopt;
+    }
+    using capture_detail::put;
+    put(buffer_, request_record, 1);
+    put(buffer_, static_cast<uint64_t>(arrival.count()), 8);
+    put(buffer_, flags, 1);
+    put(buffer_, method.size(), 1);
+    buffer_ += method;
+    put(buffer_, uri.size(), 2);
+    buffer_ += uri;
+    put(buffer_, static_cast<uint8_t>(kind), 1);
+    if (kind != capture_body::none)
+    {
+      put(buffer_, body.size(), 4);
+      if (kind == capture_body::whole)
+        buffer_ += body;
+      else
+        put(buffer_, xxh64(body), 8);
+    }
+    bytes_ += size;
+    if (buffer_.size() >= flush_bytes)
+    {
+      wake_.notify_one();
+    }
+    return records_++;
+  }
+
+  // Writes down the answer to a request record returned, unless the
+  // capture is full.
+  void respond(uint64_t request, std::string_view body)
+  {
+    body = body.substr(0, UINT32_MAX);
+    auto const size{1 + 8 + 4 + body.size()};
+    std::lock_guard lock{mutex_};
+    if (bytes_ + size > options_.max_bytes)
+    {
+      return;
+    }
+    using capture_detail::put;
+    put(buffer_, response_record, 1);
+    put(buffer_, request, 8);
+    put(buffer_, body.size(), 4);
+    buffer_ += body;
+    bytes_ += size;
+  }
+
+  stats current() const
+  {
+    std::lock_guard lock{mutex_};
+    return {records_, dropped_, bytes_};
+  }
+
+private:
+  static constexpr uint8_t request_record{0};
+  static constexpr uint8_t response_record{1};
+  static constexpr size_t flush_bytes{1 << 20};
+  static constexpr std::chrono::milliseconds flush_interval{100};
+
+  void flush_periodically()
+  {
+    std::string writing;
+    std::unique_lock lock{mutex_};
+    for (;;)
+    {
+      wake_.wait_for(lock, flush_interval, [this]
+                     { return stopping_ || buffer_.size() >= flush_bytes; });
+      writing.swap(buffer_);
+      auto const last{stopping_};
+      lock.unlock();
+      write_all(writing);
+      writing.clear();
+      if (last)
+      {
+        return;
+      }
+      lock.lock();
+    }
+  }
+
+  // What can't be written is lost: a capture mustn't stop the server.
+  void write_all(std::string_view data)
+  {
+    while (!data.empty())
+    {
+      auto const put{::write(fd_, data.data(), data.size())};
+      if (put < 0 && errno == EINTR)
+        continue;
+      if (put <= 0)
+        return;
+      data.remove_prefix(static_cast<size_t>(put));
+    }
+  }
+
+  capture_options options_;
+  std::chrono::steady_clock::time_point start_;
+  int fd_{-1};
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::string buffer_;
+  uint64_t records_{};
+  uint64_t dropped_{};
+  uint64_t bytes_{};
+  bool stopping_{};
+  std::thread flusher_;
+};
+
+// For a replay, the ids the replayed posts got, in place of those their
+// captured answers named.
+class replay_ids
+{
+public:
+  // answers[i] being what request i was answered with when captured, if
+  // it created a tree
+  explicit replay_ids(std::vector<std::optional<std::string>> const &answers) : ids_(answers.size())
+  {
+    for (size_t i{}; i < answers.size(); ++i)
+    {
+      if (answers[i])
+      {
+        // the first post of a deduplicated tree created it
+        created_by_.emplace(*answers[i], i);
+      }
+    }
+  }
+
+  // The uri of request i with the tree it names, if one an earlier
+  // request created, replaced by the id that one got.
+  std::string map(std::string const &uri, size_t i)
+  {
+    constexpr std::string_view prefix{"/tree/"};
+    if (!uri.starts_with(prefix))
+    {
+      return uri;
+    }
+    auto const end{std::min(uri.find_first_of("/?", prefix.size()), uri.size())};
+    auto const pos{created_by_.find(uri.substr(prefix.size(), end - prefix.size()))};
+    if (pos == created_by_.end() || pos->second >= i)
+    {
+      return uri;
+    }
+    std::unique_lock lock{mutex_};
+    answered_.wait(lock, [this, creator = pos->second]
+                   { return ids_[creator].has_value(); });
+    return std::string{prefix} + *ids_[pos->second] + uri.substr(end);
+  }
+
+  // What request i was answered with, or the id it was captured with
+  // if it failed.
+  void answered(size_t i, std::string id)
+  {
+    {
+      std::lock_guard lock{mutex_};
+      ids_[i] = std::move(id);
+    }
+    answered_.notify_all();
+  }
+
+private:
+  std::unordered_map<std::string, size_t> created_by_;
+  std::mutex mutex_;
+  std::condition_variable answered_;
+  std::vector<std::optional<std::string>> ids_;
+};
+
+// Calls on_request with each whole request of a capture, and on_response
+// with each answer, in order, leaving out a partial record at the end.
+// Throws if it isn't a capture.
+template <typename F, typename G>
+void read_capture(std::string_view data, F on_request, G on_response)
+{
+  capture_detail::reader in{data};
+  uint64_t version{};
+  try
+  {
+    if (in.take(capture_magic.size()) != capture_magic)
+    {
+      throw std::runtime_error("Not a capture.");
+    }
+    version = in.get(4);
+  }
+  catch (std::out_of_range const &)
+  {
+    throw std::runtime_error("Not a capture.");
+  }
+  if (version == 0 || version > capture_version)
+  {
+    throw std::runtime_error("Not a capture.");
+  }
+  while (!in.data.empty())
+  {
+    captured_request r{};
+    std::optional<captured_response> response;
+    try
+    {
+      auto const kind{version == 1 ? 0 : in.get(1)};
+      if (kind == 1)
+      {
+        response.emplace();
+        response->request = in.get(8);
+        response->body = in.take(in.get(4));
+      }
+      else if (kind != 0)
+      {
+        throw std::runtime_error("Corrupt capture.");
+      }
+      else
+      {
+        r.arrival = std::chrono::microseconds{in.get(8)};
+        r.flags = static_cast<uint8_t>(in.get(1));
+        r.method = in.take(in.get(1));
+        r.uri = in.take(in.get(2));
+        r.body_kind = static_cast<capture_body>(in.get(1));
+        if (r.body_kind > capture_body::hash)
+        {
+          throw std::runtime_error("Corrupt capture.");
+        }
+        if (r.body_kind != capture_body::none)
+        {
+          r.body_length = static_cast<uint32_t>(in.get(4));
+          if (r.body_kind == capture_body::whole)
+            r.body = in.take(r.body_length);
+          else
+            r.body_hash = in.get(8);
+        }
+      }
+    }
+    catch (std::out_of_range const &)
+    {
+      return;
+    }
+    if (response)
+      on_response(std::move(*response));
+    else
+      on_request(std::move(r));
+  }
+}
+
+template <typename F>
+void read_capture(std::string_view data, F on_request)
+{
+  read_capture(data, std::move(on_request), [](captured_response)
+               {});
+}
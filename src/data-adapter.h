@@ -9,6 +9,8 @@
 #include <functional>
 #include <numeric>
 #include <memory>
+#include <optional>
+#include <unordered_map>
 
 #include "version.h"
 #if !defined(VERSION)
@@ -24,9 +26,9 @@ public:
   using node_key_t = std::string;
   using tree_key_t = std::string;
 
-  data_adapter()
+  explicit data_adapter(std::string const &file = "trees-" VERSION ".db")
   {
-    auto rc{db_.open("trees-" VERSION ".db")};
+    auto rc{db_.open(file)};
     if (rc != SQLITE_OK)
     {
       throw std::runtime_error("unable to open the database");
@@ -36,6 +38,7 @@ public:
       db_.drop_table("config", true);
       db_.drop_table("node", true);
       db_.drop_table("tree", true);
+      db_.drop_table("tree_hash", true);
 
       db_.create_table("config", std::array<std::string_view, 2>{
                                  "item TEXT PRIMARY KEY",
@@ -53,6 +56,10 @@ public:
                                "UNIQUE (node_tree,value)"});
       db_.upsert_string("config", "item", "content", "version", VERSION);
     }
+    db_.create_table("tree_hash", std::array<std::string_view, 2>{
+                                      "hash INTEGER PRIMARY KEY",
+                                      "tree INTEGER"},
+                     true);
   }
 
   data_adapter(const data_adapter &) = delete;
@@ -156,6 +163,203 @@ public:
     db_.exec("UPDATE node SET right = ? WHERE id = ?", {&right_param, &node_param});
   }
 
+  // Calls cb(value, left value, right value) once per node of the tree.
+  template <typename T>
+  void visit_nodes(std::string_view tree_id, T cb) const
+  {
+    sqlitedb::string_parameter tree_id_param{std::string(tree_id)};
+    db_.exec("SELECT n.value, l.value, r.value FROM node n "
+             "LEFT JOIN node l ON l.id = n.left "
+             "LEFT JOIN node r ON r.id = n.right "
+             "WHERE n.node_tree = ?",
+             [&cb](auto values, auto columns)
+             {
+               auto const optional_int = [](std::string_view v) -> std::optional<int>
+               {
+                 if (v.empty())
+                   return {};
+                 return std::atoi(std::string(v).c_str());
+               };
+               cb(std::atoi(std::string(values[0]).c_str()), optional_int(values[1]), optional_int(values[2]));
+             },
+             {&tree_id_param});
+  }
+
+  // Creates the tree with the given id, as when it's moved from another instance.
+  void create_tree(std::string const &tree_id) const
+  {
+    sqlitedb::string_parameter tree_id_param{tree_id};
+    bool exists{};
+    db_.exec("SELECT id FROM tree WHERE id = ?", [&exists](auto values, auto columns)
+             { exists = true; },
+             {&tree_id_param});
+    if (exists)
+    {
+      throw std::runtime_error("Tree already exists.");
+    }
+    db_.exec("INSERT INTO tree (id) VALUES(?)", {&tree_id_param});
+  }
+
+  // Adds the nodes in a single transaction.
+  void add_nodes(std::string const &tree_id, std::vector<tree_parser::triplet> const &nodes) const
+  {
+    sqlitedb::transaction tx{db_};
+    for (auto const &node : nodes)
+    {
+      auto const this_node{ensure_node(tree_id, node.value)};
+      if (node.left.has_value())
+      {
+        bind_left(this_node, ensure_node(tree_id, node.left.value()));
+      }
+      if (node.right.has_value())
+      {
+        bind_right(this_node, ensure_node(tree_id, node.right.value()));
+      }
+    }
+    tx.commit();
+  }
+
+  // Removes the tree and its nodes, as when storing it failed.
+  void drop_tree(std::string const &tree_id) const
+  {
+    sqlitedb::string_parameter tree_id_param{tree_id};
+    sqlitedb::transaction tx{db_};
+    db_.exec("DELETE FROM node WHERE node_tree = ?", {&tree_id_param});
+    db_.exec("DELETE FROM tree WHERE id = ?", {&tree_id_param});
+    tx.commit();
+  }
+
+  // A whole tree as store_trees takes it: its nodes by position, with the
+  // positions of their children, or -1.
+  struct bulk_tree
+  {
+    std::vector<int> values;
+    std::vector<int32_t> left;
+    std::vector<int32_t> right;
+  };
+
+  // Can be called from any thread, the work of store_trees being the
+  // storage itself.
+  static bulk_tree pack(std::vector<tree_parser::triplet> const &nodes)
+  {
+    bulk_tree t;
+    std::unordered_map<int, int32_t> positions;
+    auto const ensure = [&t, &positions](int value)
+    {
+      auto [pos, inserted] = positions.try_emplace(value, static_cast<int32_t>(t.values.size()));
+      if (inserted)
+      {
+        t.values.push_back(value);
+        t.left.push_back(-1);
+        t.right.push_back(-1);
+      }
+      return pos->second;
+    };
+    for (auto const &node : nodes)
+    {
+      auto const this_node{ensure(node.value)};
+      if (node.left.has_value())
+      {
+        auto const left{ensure(node.left.value())};
+        t.left[this_node] = left;
+      }
+      if (node.right.has_value())
+      {
+        auto const right{ensure(node.right.value())};
+        t.right[this_node] = right;
+      }
+    }
+    return t;
+  }
+
+  // Stores whole trees in a single transaction, as new trees, and returns
+  // their ids. Node ids are handed out here, following the largest one,
+  // which the transaction's write lock keeps, so each node is one INSERT
+  // of a statement prepared once, with no lookups.
+  std::vector<std::string> store_trees(std::vector<bulk_tree> const &trees) const
+  {
+    sqlitedb::transaction tx{db_};
+    sqlite3_int64 next_node{1};
+    db_.exec("SELECT MAX(id) FROM node", [&next_node](auto values, auto columns)
+             { next_node = std::atoll(std::string(values.front()).c_str()) + 1; });
+    sqlitedb::statement add_tree{db_, "INSERT INTO tree DEFAULT VALUES"};
+    sqlitedb::statement add_node{db_, "INSERT INTO node (id,value,left,right,node_tree) VALUES(?,?,?,?,?)"};
+    sqlitedb::null_parameter none;
+    std::vector<std::string> ids;
+    ids.reserve(trees.size());
+    for (auto const &t : trees)
+    {
+      add_tree.run();
+      sqlitedb::int64_parameter tree_param{db_.last_insert_rowid()};
+      auto const first{next_node};
+      for (size_t i{}; i < t.values.size(); ++i)
+      {
+        sqlitedb::int64_parameter id_param{first + static_cast<sqlite3_int64>(i)};
+        sqlitedb::int_parameter value_param{t.values[i]};
+        sqlitedb::int64_parameter left_param{first + t.left[i]}, right_param{first + t.right[i]};
+        add_node.run({&id_param, &value_param, t.left[i] < 0 ? &none : static_cast<sqlitedb::parameter *>(&left_param),
+                      t.right[i] < 0 ? &none : static_cast<sqlitedb::parameter *>(&right_param), &tree_param});
+      }
+      next_node += static_cast<sqlite3_int64>(t.values.size());
+      ids.push_back(std::to_string(tree_param.value));
+    }
+    tx.commit();
+    return ids;
+  }
+
+  // As visit_nodes, but at most limit nodes, by increasing value, those
+  // after the given one. Paging on the (node_tree,value) index keeps each
+  // page as cheap as the first.
+  template <typename T>
+  void visit_nodes_after(std::string_view tree_id, std::optional<int> after, size_t limit, T cb) const
+  {
+    sqlitedb::string_parameter tree_id_param{std::string(tree_id)};
+    sqlitedb::int_parameter after_param{after.value_or(0)};
+    sqlitedb::int_parameter limit_param{static_cast<int>(limit)};
+    std::vector<sqlitedb::parameter *> parameters{&tree_id_param};
+    if (after.has_value())
+    {
+      parameters.push_back(&after_param);
+    }
+    parameters.push_back(&limit_param);
+    db_.exec(std::string{"SELECT n.value, l.value, r.value FROM node n "
+                         "LEFT JOIN node l ON l.id = n.left "
+                         "LEFT JOIN node r ON r.id = n.right "
+                         "WHERE n.node_tree = ? "} +
+                 (after.has_value() ? "AND n.value > ? " : "") +
+                 "ORDER BY n.value LIMIT ?",
+             [&cb](auto values, auto columns)
+             {
+               auto const optional_int = [](std::string_view v) -> std::optional<int>
+               {
+                 if (v.empty())
+                   return {};
+                 return std::atoi(std::string(v).c_str());
+               };
+               cb(std::atoi(std::string(values[0]).c_str()), optional_int(values[1]), optional_int(values[2]));
+             },
+             parameters);
+  }
+
+  // The tree posted with the given content hash, if any.
+  std::optional<std::string> find_tree_by_hash(uint64_t hash) const
+  {
+    sqlitedb::int64_parameter hash_param{static_cast<sqlite3_int64>(hash)};
+    std::optional<std::string> result;
+    db_.exec("SELECT tree FROM tree_hash WHERE hash = ?", [&result](auto values, auto columns)
+             { result = values.front(); },
+             {&hash_param});
+    return result;
+  }
+
+  // The first tree remembered for a hash stays.
+  void remember_tree_hash(uint64_t hash, std::string const &tree_id) const
+  {
+    sqlitedb::int64_parameter hash_param{static_cast<sqlite3_int64>(hash)};
+    sqlitedb::string_parameter tree_id_param{tree_id};
+    db_.exec("INSERT INTO tree_hash (hash, tree) VALUES (?, ?) ON CONFLICT(hash) DO NOTHING", {&hash_param, &tree_id_param});
+  }
+
   std::string version() const
   {
     std::string result;
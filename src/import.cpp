@@ -0,0 +1,205 @@
+// Loads trees straight into the store a server opens, at a rate POSTing
+// them can't reach: a tree per line, in the body format of POST /tree,
+// parsed across the cores while the previous batch is written, a batch per
+// transaction, small enough for a server's writes to wait out. Prints the
+// id of each tree, in input order, as POST /tree would return it, and with
+// -b prefixed as behind the balancer. The row and blob stores can be
+// loaded while a server runs; the log store belongs to one process at a
+// time.
+//
+//   common-ancestor-import [--store=rows|blob|log] [--batch=N] [--nodes=N] [-b] [file]
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "data-adapter.h"
+#include "blob-adapter.h"
+#include "log-adapter.h"
+#include "thread-pool.h"
+#include "tree-check.h"
+#include "tree-parser.h"
+
+namespace
+{
+  struct import_options
+  {
+    std::string store{"rows"};
+    // trees per transaction
+    size_t batch{4096};
+    // and nodes, a batch taking a fraction of a second at the row store's
+    // 290000 a second, against the 5 s a server waits for the lock
+    size_t nodes{65536};
+    std::string prefix;
+    std::string file;
+  };
+
+  // The lines, parsed, checked and packed for repo_t in parallel. Throws
+  // for the first line that isn't a tree, naming it.
+  template <typename repo_t>
+  std::vector<typename repo_t::bulk_tree> pack(std::vector<std::string> const &lines, std::vector<size_t> const &numbers)
+  {
+    std::vector<typename repo_t::bulk_tree> trees(lines.size());
+    std::vector<std::string> errors(lines.size());
+    thread_pool::shared().parallel_for(lines.size(), 16, [&](size_t begin, size_t end)
+                                       {
+                                         for (auto i{begin}; i < end; ++i)
+                                         {
+                                           try
+                                           {
+                                             std::vector<tree_parser::triplet> nodes;
+                                             tree_parser::parse(lines[i], [&nodes](auto node)
+                                                                { nodes.push_back(node); });
+                                             check_tree(nodes);
+                                             trees[i] = repo_t::pack(nodes);
+                                           }
+                                           catch (std::exception const &e)
+                                           {
+                                             errors[i] = e.what();
+                                           }
+                                         } });
+    for (size_t i{}; i < lines.size(); ++i)
+    {
+      if (!errors[i].empty())
+      {
+        throw std::runtime_error("line " + std::to_string(numbers[i]) + ": " + errors[i]);
+      }
+    }
+    return trees;
+  }
+
+  // Trees of the batches before a bad line's are stored, and their ids
+  // printed, all the same; none of its own batch is.
+  template <typename repo_t>
+  int import(repo_t &repo, std::istream &in, import_options const &options)
+  {
+    std::future<std::vector<typename repo_t::tree_key_t>> storing;
+    auto const print = [&storing, &options]
+    {
+      if (storing.valid())
+      {
+        for (auto const &id : storing.get())
+        {
+          std::cout << options.prefix << id << '\n';
+        }
+      }
+    };
+    std::string error;
+    try
+    {
+      size_t line_number{};
+      for (std::string line;;)
+      {
+        std::vector<std::string> lines;
+        std::vector<size_t> numbers;
+        size_t nodes{};
+        while (lines.size() < options.batch && nodes < options.nodes && std::getline(in, line))
+        {
+          ++line_number;
+          if (line.find_first_not_of(" \t\r") != std::string::npos)
+          {
+            // at most three a bracket, counted as three
+            nodes += 3 * static_cast<size_t>(std::ranges::count(line, '['));
+            lines.push_back(std::move(line));
+            numbers.push_back(line_number);
+          }
+        }
+        if (lines.empty())
+        {
+          break;
+        }
+        std::vector<typename repo_t::bulk_tree> trees;
+        try
+        {
+          trees = pack<repo_t>(lines, numbers);
+        }
+        catch (std::exception const &e)
+        {
+          error = e.what();
+          break;
+        }
+        print();
+        storing = std::async(std::launch::async, [&repo, trees = std::move(trees)]
+                             { return repo.store_trees(trees); });
+      }
+      print();
+    }
+    catch (std::exception const &e)
+    {
+      error = e.what();
+    }
+    std::cout.flush();
+    if (!error.empty())
+    {
+      std::cerr << "common-ancestor-import: " << error << '\n';
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  template <typename repo_t>
+  int import(import_options const &options)
+  {
+    repo_t repo;
+    if (options.file.empty())
+    {
+      return import(repo, std::cin, options);
+    }
+    std::ifstream in{options.file};
+    if (!in)
+    {
+      std::cerr << "common-ancestor-import: can't read " << options.file << '\n';
+      return EXIT_FAILURE;
+    }
+    return import(repo, in, options);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::ios::sync_with_stdio(false);
+  import_options options;
+  for (int i{1}; i < argc; ++i)
+  {
+    std::string_view const arg{argv[i]};
+    if (arg.starts_with("--store="))
+      options.store = arg.substr(std::strlen("--store="));
+    else if (arg.starts_with("--batch="))
+      options.batch = std::max(std::atol(arg.data() + std::strlen("--batch=")), 1L);
+    else if (arg.starts_with("--nodes="))
+      options.nodes = std::max(std::atol(arg.data() + std::strlen("--nodes=")), 1L);
+    else if (arg == "-b")
+    {
+      auto const host{std::getenv("TREEHOST")};
+      if (host == nullptr)
+      {
+        std::cerr << "common-ancestor-import: -b needs TREEHOST, as the server does\n";
+        return EXIT_FAILURE;
+      }
+      options.prefix = std::string{host} + '-';
+    }
+    else
+      options.file = arg;
+  }
+  try
+  {
+    if (options.store == "rows")
+      return import<data_adapter>(options);
+    if (options.store == "blob")
+      return import<blob_adapter>(options);
+    if (options.store == "log")
+      return import<log_adapter>(options);
+  }
+  catch (std::exception const &e)
+  {
+    std::cerr << "common-ancestor-import: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  std::cerr << "unknown store " << options.store << ", rows, blob or log\n";
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Counts of values, HDR style: exact below 128, and above that in 64
+// buckets per power of two, so any value is known within 1.6% while the
+// whole uint64 range fits in a few thousand counters. Histograms of the
+// same kind add up, so each thread can keep its own.
+class latency_histogram
+{
+public:
+  latency_histogram() : counts_(buckets) {}
+
+  void record(uint64_t value)
+  {
+    ++counts_[index_of(value)];
+    ++total_;
+    max_ = std::max(max_, value);
+    min_ = std::min(min_, value);
+    sum_ += value;
+  }
+
+  void merge(latency_histogram const &other)
+  {
+    for (size_t i{}; i < buckets; ++i)
+    {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    max_ = std::max(max_, other.max_);
+    min_ = std::min(min_, other.min_);
+    sum_ += other.sum_;
+  }
+
+  uint64_t count() const { return total_; }
+  uint64_t max() const { return max_; }
+  uint64_t min() const { return total_ ? min_ : 0; }
+  double mean() const { return total_ ? static_cast<double>(sum_) / total_ : 0; }
+
+  // The value below which the given fraction of the values fall, as the
+  // highest value of its bucket; 0 when nothing was recorded.
+  uint64_t percentile(double fraction) const
+  {
+    if (total_ == 0)
+    {
+      return 0;
+    }
+    auto const wanted{std::max<uint64_t>(1, static_cast<uint64_t>(fraction * total_ + 0.5))};
+    uint64_t seen{};
+    for (size_t i{}; i < buckets; ++i)
+    {
+      seen += counts_[i];
+      if (seen >= wanted)
+      {
+        return std::min(highest_in(i), max_);
+      }
+    }
+    return max_;
+  }
+
+private:
+  static constexpr int sub_bucket_bits{6};
+  static constexpr size_t buckets{(64 - sub_bucket_bits) * (size_t{1} << sub_bucket_bits) + (size_t{1} << (sub_bucket_bits + 1))};
+
+  static size_t index_of(uint64_t value)
+  {
+    auto const msb{value ? 63 - __builtin_clzll(value) : 0};
+    auto const shift{std::max(0, msb - sub_bucket_bits)};
+    return (static_cast<size_t>(shift) << sub_bucket_bits) + static_cast<size_t>(value >> shift);
+  }
+
+  static uint64_t highest_in(size_t index)
+  {
+    auto const shift{index < (size_t{2} << sub_bucket_bits) ? 0 : static_cast<int>(index >> sub_bucket_bits) - 1};
+    auto const low{static_cast<uint64_t>(index - (static_cast<size_t>(shift) << sub_bucket_bits)) << shift};
+    return low + ((uint64_t{1} << shift) - 1);
+  }
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_{};
+  uint64_t max_{};
+  uint64_t min_{UINT64_MAX};
+  uint64_t sum_{};
+};
@@ -0,0 +1,680 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "blob-adapter.h"
+#include "tree-hash.h"
+
+// How a log_store lays out and syncs what it writes.
+struct log_options
+{
+  // a segment is sealed, with its footer, once it is this big
+  size_t segment_bytes{64 << 20};
+  // writes are synced together at most this long after being made, which
+  // a crash may lose; 0 syncs each before it returns
+  std::chrono::milliseconds sync_interval{10};
+};
+
+// A packed_tree_store appending trees to segment files in a directory,
+// never changing what it wrote, as trees never change once finished:
+//
+//   record   "TRLR", kind, id, length, checksum    4 + 4 + 8 + 4 + 4 bytes
+//            body                                  length bytes
+//   footer   trees, as id, offset, length, 0       count x (8 + 8 + 4 + 4)
+//            hashes, as hash, id                   count x (8 + 8)
+//            offset of the footer, tree count,     8 + 4 + 4 + 4 + 4 bytes
+//            hash count, checksum, "TRFT"
+//
+// all little-endian, the checksums the low half of the XXH64 of the body or
+// of the footer's entries. A record's kind is 1 for a tree, whose body is
+// a packed_tree, or 2 for a content hash, whose body is the hash. Only
+// full segments get a footer: the tree id -> offset index is rebuilt from
+// the footers at startup, and from the records of the segment being
+// written, up to the first torn or corrupt one, which a crash left behind
+// and which is cut off. One process at a time may open the directory.
+//
+// Tree ids are handed out from a range written down beforehand in the file
+// RESERVED, as the last id of the range, its checksum and "TRRS", and
+// synced, so an id given out is never given out again after a crash, even
+// if its tree was in the writes the crash lost. A restart skips what is
+// left of the range.
+class log_store
+{
+public:
+  explicit log_store(std::filesystem::path directory = "trees-log-" VERSION, log_options options = {})
+      : directory_{std::move(directory)}, options_{options}
+  {
+    swap_in_compacted(directory_);
+    std::filesystem::create_directories(directory_);
+    lock_ = ::open((directory_ / "LOCK").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_ < 0 || flock(lock_, LOCK_EX | LOCK_NB) != 0)
+    {
+      fail("locking", directory_);
+    }
+    // what a compaction that didn't finish left, as a running one would
+    // hold the lock
+    std::filesystem::remove_all(compacting_path(directory_));
+    std::filesystem::remove_all(old_path(directory_));
+    std::vector<uint32_t> numbers;
+    for (auto const &entry : std::filesystem::directory_iterator{directory_})
+    {
+      auto const name{entry.path().filename().string()};
+      if (name.ends_with(segment_suffix))
+      {
+        numbers.push_back(static_cast<uint32_t>(std::stoul(name)));
+      }
+    }
+    std::sort(numbers.begin(), numbers.end());
+    for (auto const number : numbers)
+    {
+      auto &s{open_segment(number)};
+      if (!read_footer(s))
+      {
+        recover(s);
+        if (number != numbers.back())
+        {
+          seal(s);
+        }
+      }
+    }
+    if (segments_.empty() || segments_.back().sealed)
+    {
+      open_segment(segments_.empty() ? 1 : segments_.back().number + 1);
+    }
+    read_reserved();
+    if (options_.sync_interval.count() > 0)
+    {
+      syncer_ = std::thread{[this]
+                            { sync_periodically(); }};
+    }
+  }
+
+  log_store(log_store const &) = delete;
+
+  ~log_store()
+  {
+    {
+      std::lock_guard lock{mutex_};
+      stopping_ = true;
+    }
+    stop_.notify_all();
+    if (syncer_.joinable())
+    {
+      syncer_.join();
+    }
+    if (fdatasync(segments_.back().fd) != 0)
+    {
+      std::fprintf(stderr, "syncing %s: %s\n", segment_path(segments_.back().number).c_str(), std::strerror(errno));
+    }
+    for (auto const &s : segments_)
+    {
+      close(s.fd);
+    }
+    close(reserved_fd_);
+    close(lock_);
+  }
+
+  int64_t reserve()
+  {
+    auto const id{next_id_++};
+    reserve_through(id);
+    return id;
+  }
+
+  void claim(int64_t id)
+  {
+    if (trees_.count(id))
+    {
+      throw std::runtime_error("Tree already exists.");
+    }
+    next_id_ = std::max(next_id_, id + 1);
+    reserve_through(id);
+  }
+
+  // Nothing is written before the tree, and the id isn't handed out again.
+  void release(int64_t) {}
+
+  void write(int64_t id, std::string_view body)
+  {
+    auto const offset{append(tree_record, id, body)};
+    trees_[id] = {static_cast<uint32_t>(segments_.size() - 1), offset, static_cast<uint32_t>(body.size())};
+    segments_.back().trees.push_back({static_cast<uint64_t>(id), offset, static_cast<uint32_t>(body.size()), 0});
+    done_writing();
+  }
+
+  // A write each, synced together unless sync_interval is 0.
+  std::vector<int64_t> write_all(std::vector<std::string> const &bodies)
+  {
+    std::vector<int64_t> ids;
+    ids.reserve(bodies.size());
+    for (auto const &body : bodies)
+    {
+      ids.push_back(reserve());
+      write(ids.back(), body);
+    }
+    return ids;
+  }
+
+  std::optional<std::string> read(int64_t id) const
+  {
+    auto const pos{trees_.find(id)};
+    if (pos == trees_.end())
+    {
+      return {};
+    }
+    auto const &[index, offset, length] = pos->second;
+    std::string body(length, '\0');
+    read_at(segments_[index], body.data(), length, offset);
+    return body;
+  }
+
+  std::optional<int64_t> find_hash(uint64_t hash) const
+  {
+    auto const pos{hashes_.find(hash)};
+    if (pos == hashes_.end())
+    {
+      return {};
+    }
+    return pos->second;
+  }
+
+  void remember_hash(uint64_t hash, int64_t id)
+  {
+    if (hashes_.count(hash))
+    {
+      return;
+    }
+    std::string body;
+    put(body, hash, 8);
+    append(hash_record, id, body);
+    hashes_[hash] = id;
+    segments_.back().hashes.push_back({hash, static_cast<uint64_t>(id)});
+    done_writing();
+  }
+
+  // The ids of the stored trees, by increasing id.
+  std::vector<int64_t> tree_ids() const
+  {
+    std::vector<int64_t> ids;
+    ids.reserve(trees_.size());
+    for (auto const &entry : trees_)
+    {
+      ids.push_back(entry.first);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+
+  // Rewrites the store in the directory, which nothing else may have open,
+  // into full segments of its trees by id, and swaps it in once written and
+  // synced. Both stores stay locked until the swap is over; a crash between
+  // its two renames is finished by the next open, so the directory always
+  // holds either store whole.
+  static void compact(std::filesystem::path const &directory, log_options options = {})
+  {
+    auto const compacted{compacting_path(directory)};
+    auto const old{old_path(directory)};
+    log_store from{directory, options};
+    log_store to{compacted, options};
+    for (auto const id : from.tree_ids())
+    {
+      to.write(id, *from.read(id));
+    }
+    for (auto const &[hash, id] : from.hashes_)
+    {
+      to.remember_hash(hash, id);
+    }
+    to.seal(to.segments_.back());
+    to.reserve_through(from.reserved_);
+    sync_directory(compacted);
+    auto const parent{std::filesystem::absolute(directory).parent_path()};
+    std::filesystem::rename(directory, old);
+    sync_directory(parent);
+    std::filesystem::rename(compacted, directory);
+    sync_directory(parent);
+    std::filesystem::remove_all(old);
+  }
+
+private:
+  static constexpr std::string_view segment_suffix{".seg"};
+  static constexpr std::string_view record_magic{"TRLR"};
+  static constexpr std::string_view footer_magic{"TRFT"};
+  static constexpr size_t record_header_size{24};
+  static constexpr size_t footer_trailer_size{24};
+  static constexpr uint32_t tree_record{1};
+  static constexpr uint32_t hash_record{2};
+  static constexpr std::string_view reserved_magic{"TRRS"};
+  // ids reserved at a time, each reservation costing a sync
+  static constexpr int64_t reserve_ahead{1024};
+
+  struct tree_entry
+  {
+    uint64_t id;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+  };
+
+  struct hash_entry
+  {
+    uint64_t hash;
+    uint64_t id;
+  };
+
+  struct segment
+  {
+    uint32_t number;
+    int fd;
+    uint64_t size;
+    bool sealed;
+    // what it holds, for its footer
+    std::vector<tree_entry> trees;
+    std::vector<hash_entry> hashes;
+  };
+
+  struct location
+  {
+    uint32_t segment;
+    uint64_t offset;
+    uint32_t length;
+  };
+
+  [[noreturn]] static void fail(char const *doing, std::filesystem::path const &path)
+  {
+    throw std::runtime_error(std::string{doing} + " " + path.string() + ": " + std::strerror(errno));
+  }
+
+  static void put(std::string &out, uint64_t v, int bytes)
+  {
+    for (int shift{}; shift < bytes * 8; shift += 8)
+      out += static_cast<char>((v >> shift) & 0xff);
+  }
+
+  static uint64_t get(std::string_view in, size_t at, int bytes)
+  {
+    uint64_t v{};
+    for (int i{bytes - 1}; i >= 0; --i)
+      v = (v << 8) | static_cast<uint8_t>(in[at + i]);
+    return v;
+  }
+
+  static uint32_t checksum(std::string_view data) { return static_cast<uint32_t>(xxh64(data)); }
+
+  std::filesystem::path segment_path(uint32_t number) const
+  {
+    auto name{std::to_string(number)};
+    name.insert(0, 8 - std::min<size_t>(8, name.size()), '0');
+    return directory_ / (name + std::string{segment_suffix});
+  }
+
+  segment &open_segment(uint32_t number)
+  {
+    auto const path{segment_path(number)};
+    auto const fd{::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)};
+    if (fd < 0)
+    {
+      fail("opening", path);
+    }
+    auto const size{lseek(fd, 0, SEEK_END)};
+    segments_.push_back({number, fd, static_cast<uint64_t>(size), false, {}, {}});
+    return segments_.back();
+  }
+
+  void read_at(segment const &s, char *data, size_t length, uint64_t offset) const
+  {
+    while (length > 0)
+    {
+      auto const got{pread(s.fd, data, length, static_cast<off_t>(offset))};
+      if (got <= 0)
+      {
+        if (got < 0 && errno == EINTR)
+          continue;
+        fail("reading", segment_path(s.number));
+      }
+      data += got;
+      length -= static_cast<size_t>(got);
+      offset += static_cast<uint64_t>(got);
+    }
+  }
+
+  void write_at(segment const &s, std::string_view data, uint64_t offset) { write_at(s.fd, segment_path(s.number), data, offset); }
+
+  static void write_at(int fd, std::filesystem::path const &path, std::string_view data, uint64_t offset)
+  {
+    while (!data.empty())
+    {
+      auto const put{pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset))};
+      if (put < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        fail("writing", path);
+      }
+      data.remove_prefix(static_cast<size_t>(put));
+      offset += static_cast<uint64_t>(put);
+    }
+  }
+
+  static void sync(int fd, std::filesystem::path const &path)
+  {
+    if (fdatasync(fd) != 0)
+    {
+      fail("syncing", path);
+    }
+  }
+
+  // So that the files created or renamed in it outlast a crash.
+  static void sync_directory(std::filesystem::path const &path)
+  {
+    auto const fd{::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if (fd < 0)
+    {
+      fail("opening", path);
+    }
+    auto const error{fsync(fd) != 0 ? errno : 0};
+    close(fd);
+    if (error != 0)
+    {
+      errno = error;
+      fail("syncing", path);
+    }
+  }
+
+  static std::filesystem::path compacting_path(std::filesystem::path const &directory)
+  {
+    return std::filesystem::path{directory}.concat(".compacting");
+  }
+
+  static std::filesystem::path old_path(std::filesystem::path const &directory)
+  {
+    return std::filesystem::path{directory}.concat(".old");
+  }
+
+  // With the directory gone, a compaction stopped between its renames: the
+  // compacted store, written whole before the first, takes its place, or
+  // failing it the old one goes back.
+  static void swap_in_compacted(std::filesystem::path const &directory)
+  {
+    auto const old{old_path(directory)};
+    if (std::filesystem::exists(directory) || !std::filesystem::exists(old))
+    {
+      return;
+    }
+    auto const compacted{compacting_path(directory)};
+    auto const &latest{std::filesystem::exists(compacted) ? compacted : old};
+    // held by the compaction, if it is still running
+    auto const lock{::open((latest / "LOCK").c_str(), O_RDWR | O_CLOEXEC)};
+    if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB) != 0)
+    {
+      fail("locking", latest);
+    }
+    std::filesystem::rename(latest, directory);
+    sync_directory(std::filesystem::absolute(directory).parent_path());
+    close(lock);
+  }
+
+  // Ids up to the last written down, the next one after it.
+  void read_reserved()
+  {
+    auto const path{directory_ / "RESERVED"};
+    reserved_fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (reserved_fd_ < 0)
+    {
+      fail("opening", path);
+    }
+    std::string record(16, '\0');
+    if (pread(reserved_fd_, record.data(), record.size(), 0) == static_cast<ssize_t>(record.size()) &&
+        std::string_view{record}.substr(12) == reserved_magic &&
+        checksum(std::string_view{record}.substr(0, 8)) == get(record, 8, 4))
+    {
+      reserved_ = static_cast<int64_t>(get(record, 0, 8));
+      next_id_ = std::max(next_id_, reserved_ + 1);
+    }
+    reserved_ = std::max(reserved_, next_id_ - 1);
+  }
+
+  // Writes down and syncs a new range unless the id is in the last one.
+  void reserve_through(int64_t id)
+  {
+    if (id <= reserved_)
+    {
+      return;
+    }
+    auto const last{id + reserve_ahead - 1};
+    std::string record;
+    put(record, static_cast<uint64_t>(last), 8);
+    put(record, checksum(record), 4);
+    record += reserved_magic;
+    auto const path{directory_ / "RESERVED"};
+    write_at(reserved_fd_, path, record, 0);
+    sync(reserved_fd_, path);
+    reserved_ = last;
+  }
+
+  // Where the record's body went.
+  uint64_t append(uint32_t kind, int64_t id, std::string_view body)
+  {
+    std::string record{record_magic};
+    record.reserve(record_header_size + body.size());
+    put(record, kind, 4);
+    put(record, static_cast<uint64_t>(id), 8);
+    put(record, body.size(), 4);
+    put(record, checksum(body), 4);
+    record += body;
+    std::lock_guard lock{mutex_};
+    auto &s{segments_.back()};
+    if (sync_error_ != 0)
+    {
+      // what was written since may be lost, so nothing more is
+      errno = sync_error_;
+      fail("syncing", segment_path(s.number));
+    }
+    write_at(s, record, s.size);
+    auto const offset{s.size + record_header_size};
+    s.size += record.size();
+    dirty_ = true;
+    return offset;
+  }
+
+  // Syncs, now or soon, and starts a new segment once this one is full.
+  void done_writing()
+  {
+    if (options_.sync_interval.count() == 0)
+    {
+      std::lock_guard lock{mutex_};
+      sync(segments_.back().fd, segment_path(segments_.back().number));
+      dirty_ = false;
+    }
+    if (segments_.back().size >= options_.segment_bytes)
+    {
+      seal(segments_.back());
+      std::lock_guard lock{mutex_};
+      open_segment(segments_.back().number + 1);
+    }
+  }
+
+  void sync_periodically()
+  {
+    std::unique_lock lock{mutex_};
+    while (!stopping_)
+    {
+      stop_.wait_for(lock, options_.sync_interval);
+      if (dirty_)
+      {
+        // segments stay open until the store is gone, so it can be synced
+        // while writes go on
+        auto const fd{segments_.back().fd};
+        dirty_ = false;
+        lock.unlock();
+        auto const error{fdatasync(fd) != 0 ? errno : 0};
+        lock.lock();
+        if (error != 0)
+        {
+          sync_error_ = error;
+        }
+      }
+    }
+  }
+
+  void seal(segment &s)
+  {
+    std::string entries;
+    for (auto const &t : s.trees)
+    {
+      put(entries, t.id, 8);
+      put(entries, t.offset, 8);
+      put(entries, t.length, 4);
+      put(entries, t.reserved, 4);
+    }
+    for (auto const &h : s.hashes)
+    {
+      put(entries, h.hash, 8);
+      put(entries, h.id, 8);
+    }
+    auto footer{entries};
+    put(footer, s.size, 8);
+    put(footer, s.trees.size(), 4);
+    put(footer, s.hashes.size(), 4);
+    put(footer, checksum(entries), 4);
+    footer += footer_magic;
+    std::lock_guard lock{mutex_};
+    write_at(s, footer, s.size);
+    s.size += footer.size();
+    sync(s.fd, segment_path(s.number));
+    s.sealed = true;
+    s.trees = {};
+    s.hashes = {};
+  }
+
+  bool read_footer(segment &s)
+  {
+    if (s.size < footer_trailer_size)
+    {
+      return false;
+    }
+    std::string trailer(footer_trailer_size, '\0');
+    read_at(s, trailer.data(), trailer.size(), s.size - footer_trailer_size);
+    if (std::string_view{trailer}.substr(20) != footer_magic)
+    {
+      return false;
+    }
+    auto const start{get(trailer, 0, 8)};
+    auto const tree_count{get(trailer, 8, 4)};
+    auto const hash_count{get(trailer, 12, 4)};
+    auto const length{tree_count * 24 + hash_count * 16};
+    if (start + length + footer_trailer_size != s.size)
+    {
+      return false;
+    }
+    std::string entries(length, '\0');
+    read_at(s, entries.data(), length, start);
+    if (checksum(entries) != get(trailer, 16, 4))
+    {
+      return false;
+    }
+    auto const number{static_cast<uint32_t>(segments_.size() - 1)};
+    for (size_t i{}; i < tree_count; ++i)
+    {
+      auto const id{static_cast<int64_t>(get(entries, i * 24, 8))};
+      trees_[id] = {number, get(entries, i * 24 + 8, 8), static_cast<uint32_t>(get(entries, i * 24 + 16, 4))};
+      next_id_ = std::max(next_id_, id + 1);
+    }
+    for (size_t i{}; i < hash_count; ++i)
+    {
+      auto const at{tree_count * 24 + i * 16};
+      hashes_.try_emplace(get(entries, at, 8), static_cast<int64_t>(get(entries, at + 8, 8)));
+    }
+    s.sealed = true;
+    return true;
+  }
+
+  // Reads the records of a segment without a footer, keeping those before
+  // the first that's torn or corrupt, and cutting the rest off.
+  void recover(segment &s)
+  {
+    auto const number{static_cast<uint32_t>(segments_.size() - 1)};
+    uint64_t at{};
+    std::string header(record_header_size, '\0'), body;
+    while (at + record_header_size <= s.size)
+    {
+      read_at(s, header.data(), record_header_size, at);
+      auto const kind{get(header, 4, 4)};
+      auto const id{static_cast<int64_t>(get(header, 8, 8))};
+      auto const length{get(header, 16, 4)};
+      if (std::string_view{header}.substr(0, 4) != record_magic || (kind != tree_record && kind != hash_record) ||
+          at + record_header_size + length > s.size)
+      {
+        break;
+      }
+      body.resize(length);
+      read_at(s, body.data(), length, at + record_header_size);
+      if (checksum(body) != get(header, 20, 4) || (kind == hash_record && length != 8))
+      {
+        break;
+      }
+      auto const offset{at + record_header_size};
+      if (kind == tree_record)
+      {
+        trees_[id] = {number, offset, static_cast<uint32_t>(length)};
+        s.trees.push_back({static_cast<uint64_t>(id), offset, static_cast<uint32_t>(length), 0});
+        next_id_ = std::max(next_id_, id + 1);
+      }
+      else
+      {
+        auto const hash{get(body, 0, 8)};
+        if (hashes_.try_emplace(hash, id).second)
+        {
+          s.hashes.push_back({hash, static_cast<uint64_t>(id)});
+        }
+      }
+      at = offset + length;
+    }
+    if (at != s.size)
+    {
+      if (ftruncate(s.fd, static_cast<off_t>(at)) != 0)
+      {
+        fail("truncating", segment_path(s.number));
+      }
+      s.size = at;
+    }
+  }
+
+  std::filesystem::path directory_;
+  log_options options_;
+  int lock_{-1};
+  // by number, found by index; only ever appended to
+  std::vector<segment> segments_;
+  std::unordered_map<int64_t, location> trees_;
+  std::unordered_map<uint64_t, int64_t> hashes_;
+  int64_t next_id_{1};
+  // the last id written down in RESERVED
+  int64_t reserved_{};
+  int reserved_fd_{-1};
+  // between writes and the syncing thread
+  std::mutex mutex_;
+  std::condition_variable stop_;
+  bool dirty_{};
+  // of the last sync that failed, after which writes fail too
+  int sync_error_{};
+  bool stopping_{};
+  std::thread syncer_;
+};
+
+// The repo_t of blob_adapter, over a log_store instead of SQLite.
+using log_adapter = packed_adapter<log_store>;
@@ -4,36 +4,364 @@ extern "C"
 }
 #include <functional>
 #include <unordered_map>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <chrono>
 #include <cstring>
 #include <cstdlib>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <csignal>
+#include <cerrno>
 #include <unistd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include "data-adapter.h"
+#include "blob-adapter.h"
+#include "log-adapter.h"
 #include "tree.h"
-#include "tree-controller.h"
+#include "async-tree-controller.h"
+#include "tiered-repo.h"
+#include "admission.h"
+#include "rpc.h"
+#include "capture.h"
 #include "abstract_protocol.h"
 
-using controller_map_t = std::unordered_map<std::string, std::function<void(abstract_protocol &)>>;
+// Work finished on executor threads is handed to the event loop, since
+// mongoose isn't thread safe. Connections are found again by id, as they
+// may have gone away meanwhile. The loop sleeps in mg_mgr_poll, and is woken
+// by a datagram to a UDP socket of its own on loopback when the first
+// action of a batch is queued.
+struct loop_queue
+{
+  struct action
+  {
+    unsigned long connection_id;
+    std::function<void(struct mg_connection *)> run;
+  };
+
+  loop_queue() = default;
+  loop_queue(loop_queue const &) = delete;
+
+  ~loop_queue()
+  {
+    if (wake_fd >= 0)
+    {
+      close(wake_fd);
+    }
+  }
+
+  // Opens the socket the loop is woken through.
+  bool listen(struct mg_mgr &mgr)
+  {
+    auto const c{mg_listen(&mgr, "udp://127.0.0.1:0", [](struct mg_connection *c, int ev, void *, void *)
+                           {
+                             if (ev == MG_EV_READ)
+                               mg_iobuf_del(&c->recv, 0, c->recv.len); },
+                           nullptr)};
+    socklen_t length{sizeof(wake_to)};
+    if (c == nullptr ||
+        getsockname(static_cast<int>(reinterpret_cast<intptr_t>(c->fd)), reinterpret_cast<sockaddr *>(&wake_to), &length) != 0)
+    {
+      return false;
+    }
+    wake_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    return wake_fd >= 0;
+  }
+
+  void push(action a)
+  {
+    bool first;
+    {
+      std::lock_guard lock{mutex};
+      first = actions.empty();
+      actions.push_back(std::move(a));
+    }
+    // the loop takes every action queued when it wakes, so one wake a batch
+    if (first)
+    {
+      char const byte{};
+      sendto(wake_fd, &byte, 1, 0, reinterpret_cast<sockaddr const *>(&wake_to), sizeof(wake_to));
+    }
+  }
 
+  void run(struct mg_mgr &mgr)
+  {
+    std::vector<action> ready;
+    {
+      std::lock_guard lock{mutex};
+      ready.swap(actions);
+    }
+    for (auto const &a : ready)
+    {
+      for (auto c{mgr.conns}; c != nullptr; c = c->next)
+      {
+        if (c->id == a.connection_id)
+        {
+          a.run(c);
+          break;
+        }
+      }
+    }
+  }
+
+  std::mutex mutex;
+  std::vector<action> actions;
+  int wake_fd{-1};
+  sockaddr_in wake_to{};
+};
+
+static std::string error_message(std::exception_ptr error)
+{
+  try
+  {
+    std::rethrow_exception(error);
+  }
+  catch (std::exception const &e)
+  {
+    return e.what();
+  }
+  catch (...)
+  {
+    return "Unknown error.";
+  }
+}
+
+// An export being written to a connection, a chunk at a time. It holds
+// its admission until it ends, and is traced up to its first chunk.
+template <typename controller_t>
+struct export_stream
+{
+  std::shared_ptr<typename controller_t::export_cursor> cursor;
+  std::optional<admission_gate::ticket> admitted;
+  std::shared_ptr<trace_span> span;
+  bool fetching{};
+  bool replying{};
+};
+
+// Which admission_gate a request goes through, and which executor runs it.
+enum class work_kind
+{
+  query,
+  ingest,
+  // always taken, as it costs next to nothing
+  control
+};
+
+template <typename controller_t>
+struct server_context
+{
+  using handler_t = std::function<task<std::string>(typename controller_t::request)>;
+
+  struct route_t
+  {
+    handler_t handler;
+    work_kind kind{work_kind::query};
+  };
+
+  using controller_map_t = std::unordered_map<std::string, route_t>;
+
+  controller_map_t const &routes;
+  controller_t &controller;
+  executor &compute;
+  executor &ingest;
+  admission_gate &query_gate;
+  admission_gate &ingest_gate;
+  loop_queue &queue;
+  trace_log &traces;
+  // the fraction of requests traced
+  double trace_sample;
+  // where requests are written down as they arrive, if anywhere
+  capture_writer *capture;
+  std::unordered_map<unsigned long, export_stream<controller_t>> exports{};
+  uint64_t last_trace_id{};
+  std::minstd_rand trace_random{};
+
+  std::shared_ptr<trace_span> start_trace(std::string_view route, std::string_view uri, uint64_t start_ns)
+  {
+    if (trace_sample <= 0 || (trace_sample < 1 && std::uniform_real_distribution<double>{}(trace_random) >= trace_sample))
+    {
+      return nullptr;
+    }
+    return std::make_shared<trace_span>(++last_trace_id, route, uri, start_ns);
+  }
+};
+
+// Another chunk is only fetched once the connection has sent out most of
+// the previous ones, so a slow reader holds back the export instead of
+// filling memory.
+static constexpr size_t export_high_water{256 * 1024};
+
+// Requests listed by /debug/traces, both of the most recent and of the slowest.
+static constexpr size_t debug_traces_shown{20};
+
+template <typename controller_t>
+static void fetch_export_chunk(struct mg_connection *c, server_context<controller_t> &ctx, export_stream<controller_t> &stream)
+{
+  stream.fetching = true;
+  spawn(ctx.compute, ctx.controller.export_chunk(stream.cursor),
+        [id = c->id, &ctx](std::optional<std::string> chunk, std::exception_ptr error)
+        {
+          ctx.queue.push({id, [&ctx, chunk = std::move(chunk), error](struct mg_connection *c)
+                          {
+                            auto pos{ctx.exports.find(c->id)};
+                            if (pos == ctx.exports.end())
+                            {
+                              return;
+                            }
+                            auto &stream{pos->second};
+                            auto const span{std::exchange(stream.span, nullptr)};
+                            if (error)
+                            {
+                              // once headers are out, all that's left is to cut the reply short
+                              if (stream.replying)
+                                c->is_closing = 1;
+                              else
+                                mg_http_reply(c, 500, nullptr, "%s", error_message(error).c_str());
+                              if (span)
+                                ctx.traces.record(span->finish(500));
+                              ctx.exports.erase(pos);
+                              return;
+                            }
+                            {
+                              trace_timer timer{span.get(), trace_phase::reply};
+                              if (!stream.replying)
+                              {
+                                mg_printf(c, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\n\r\n",
+                                          stream.cursor->encoder.format() == tree_format::binary ? "application/octet-stream" : "text/plain");
+                                stream.replying = true;
+                              }
+                              if (!chunk->empty())
+                              {
+                                mg_http_write_chunk(c, chunk->data(), chunk->size());
+                              }
+                            }
+                            if (span)
+                            {
+                              ctx.traces.record(span->finish(200));
+                            }
+                            stream.fetching = false;
+                            if (stream.cursor->finished)
+                            {
+                              mg_http_write_chunk(c, "", 0);
+                              ctx.exports.erase(pos);
+                            } }});
+        },
+        stream.span.get());
+}
+
+// Tells a client turned away when to come back.
+static void reply_overloaded(struct mg_connection *c, admission_gate::ticket const &refused)
+{
+  auto const retry_after{"Retry-After: " + std::to_string(refused.retry_after().count()) + "\r\n"};
+  mg_http_reply(c, 503, retry_after.c_str(), "Overloaded.\n");
+}
+
+template <typename controller_t>
 static void route(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
 {
-  if (ev == MG_EV_HTTP_MSG)
+  auto ctx{reinterpret_cast<server_context<controller_t> *>(fn_data)};
+  if (ev == MG_EV_POLL || ev == MG_EV_WRITE)
+  {
+    auto pos{ctx->exports.find(c->id)};
+    if (pos != ctx->exports.end() && !pos->second.fetching && c->send.len < export_high_water)
+    {
+      fetch_export_chunk(c, *ctx, pos->second);
+    }
+  }
+  else if (ev == MG_EV_CLOSE)
+  {
+    ctx->exports.erase(c->id);
+  }
+  else if (ev == MG_EV_HTTP_MSG)
   {
     try
     {
       auto hm{(struct mg_http_message *)ev_data};
-      auto cm{reinterpret_cast<controller_map_t const *>(fn_data)};
-      abstract_protocol proto {
-          {hm->uri.ptr, hm->uri.len},
-          {hm->body.ptr, hm->body.len},
-          [&c](std::string_view contents)
-          {
-            mg_http_reply(c, 200, nullptr, std::string(contents).c_str());
-          }};
-      auto pos = std::find_if(cm->begin(), cm->end(), [hm](auto const &entry) {
+      auto const dedup{mg_http_get_header(hm, "X-Tree-Dedup")};
+      auto const deduplicate{dedup == nullptr || std::string_view(dedup->ptr, dedup->len) != "off"};
+      std::optional<uint64_t> captured;
+      if (ctx->capture)
+      {
+        captured = ctx->capture->record({hm->method.ptr, hm->method.len}, {hm->uri.ptr, hm->uri.len}, {hm->body.ptr, hm->body.len},
+                                        deduplicate ? 0 : captured_request::dedup_off);
+      }
+      auto const start{trace_now_ns()};
+      auto const binary{mg_http_match_uri(hm, "/tree/*/export/bin")};
+      if (binary || mg_http_match_uri(hm, "/tree/*/export"))
+      {
+        // a query, if a long one, so it takes the place of one while it lasts
+        auto admitted{ctx->query_gate.admit(0)};
+        if (!admitted)
+        {
+          reply_overloaded(c, admitted);
+          return;
+        }
+        // as long as the client takes to read it, which says nothing of load
+        admitted.untimed();
+        typename controller_t::request r{std::string(hm->uri.ptr, hm->uri.len), {}};
+        auto cursor{ctx->controller.start_export(r, binary ? tree_format::binary : tree_format::text)};
+        auto &stream{ctx->exports[c->id]};
+        stream.cursor = std::move(cursor);
+        stream.admitted.emplace(std::move(admitted));
+        stream.span = ctx->start_trace(binary ? "/tree/*/export/bin" : "/tree/*/export", r.uri, start);
+        if (stream.span)
+        {
+          stream.span->add(trace_phase::route, trace_now_ns() - start);
+        }
+        fetch_export_chunk(c, *ctx, stream);
+        return;
+      }
+      auto pos = std::find_if(ctx->routes.begin(), ctx->routes.end(), [hm](auto const &entry) {
         return mg_http_match_uri(hm, entry.first.c_str());
       });
-      if (pos != cm->end()) {
-        pos->second(proto);
+      if (pos != ctx->routes.end()) {
+        auto const kind{pos->second.kind};
+        std::optional<admission_gate::ticket> admitted;
+        if (kind != work_kind::control)
+        {
+          admitted.emplace((kind == work_kind::ingest ? ctx->ingest_gate : ctx->query_gate).admit(hm->body.len));
+          if (!*admitted)
+          {
+            reply_overloaded(c, *admitted);
+            return;
+          }
+        }
+        std::string uri(hm->uri.ptr, hm->uri.len);
+        auto span{ctx->start_trace(pos->first, uri, start)};
+        if (span)
+        {
+          span->add(trace_phase::route, trace_now_ns() - start);
+        }
+        auto const traced{span.get()};
+        spawn(kind == work_kind::ingest ? ctx->ingest : ctx->compute,
+              pos->second.handler({std::move(uri), std::string(hm->body.ptr, hm->body.len), deduplicate}),
+              [id = c->id, &queue = ctx->queue, &traces = ctx->traces, span = std::move(span), admitted = std::move(admitted),
+               capture = kind == work_kind::ingest && captured ? ctx->capture : nullptr, captured](std::optional<std::string> body, std::exception_ptr error)
+              {
+                auto const status{error ? 500 : 200};
+                // the ids trees got, for a replay to map to those it gets
+                if (capture && !error)
+                {
+                  capture->respond(*captured, *body);
+                }
+                queue.push({id, [status, body = error ? error_message(error) : std::move(*body), &traces, span](struct mg_connection *c)
+                            {
+                              {
+                                trace_timer timer{span.get(), trace_phase::reply};
+                                mg_http_reply(c, status, nullptr, "%s", body.c_str());
+                              }
+                              if (span)
+                              {
+                                traces.record(span->finish(status));
+                              }
+                            }});
+              },
+              traced);
       }
       else {
         static mg_http_serve_opts opts {
@@ -49,33 +377,374 @@ static void route(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
   }
 }
 
-int main(int argc, char **argv)
+// Frames of the binary protocol are answered as they come, several at a
+// time per connection, on the executor and through the gate of HTTP queries.
+template <typename controller_t>
+static void serve_rpc(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
 {
-  data_adapter data;
-  auto using_balancer = argc > 1;
+  if (ev != MG_EV_READ)
+  {
+    return;
+  }
+  auto ctx{reinterpret_cast<server_context<controller_t> *>(fn_data)};
+  try
+  {
+    auto const used{rpc_decode<rpc_request>(
+        {reinterpret_cast<char const *>(c->recv.buf), c->recv.len},
+        [c, ctx](rpc_request r)
+        {
+          auto admitted{ctx->query_gate.admit(0)};
+          if (!admitted)
+          {
+            auto const reply{encode(rpc_reply{r.id, rpc_status::overloaded, static_cast<int>(admitted.retry_after().count()), {}})};
+            mg_send(c, reply.data(), reply.size());
+            return;
+          }
+          auto const id{r.id};
+          spawn(ctx->compute, rpc_call(ctx->controller, std::move(r)),
+                [connection = c->id, id, &queue = ctx->queue, admitted = std::move(admitted)](std::optional<int> value, std::exception_ptr error)
+                {
+                  auto reply{encode(error ? rpc_reply{id, rpc_status::error, 0, error_message(error)} : rpc_reply{id, rpc_status::ok, *value, {}})};
+                  queue.push({connection, [reply = std::move(reply)](struct mg_connection *c)
+                              { mg_send(c, reply.data(), reply.size()); }});
+                });
+        })};
+    mg_iobuf_del(&c->recv, 0, used);
+  }
+  catch (std::exception const &)
+  {
+    // past a bad frame, nothing can be told apart
+    c->is_closing = 1;
+  }
+}
+
+// How mongoose opens a listener, for HTTP or for raw TCP.
+using listen_t = struct mg_connection *(*)(struct mg_mgr *, const char *, mg_event_handler_t, void *);
+
+// mongoose binds its listeners without SO_REUSEPORT, which workers need to
+// share a port. So a worker listens on a port of its own, then puts a socket
+// bound to the shared one in its place; the kernel spreads connections
+// across the workers' sockets.
+static struct mg_connection *listen_shared(struct mg_mgr *mgr, uint16_t port, listen_t listen_on, mg_event_handler_t fn, void *fn_data)
+{
+  auto const c{listen_on(mgr, "tcp://127.0.0.1:0", fn, fn_data)};
+  if (c == nullptr)
+  {
+    return nullptr;
+  }
+  int const on{1};
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  auto const fd{socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+  auto const shared{fd >= 0 && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0 &&
+                    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == 0 &&
+                    bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0 &&
+                    listen(fd, SOMAXCONN) == 0 &&
+                    dup2(fd, static_cast<int>(reinterpret_cast<intptr_t>(c->fd))) >= 0};
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  if (!shared)
+  {
+    perror("listening on the shared port");
+    return nullptr;
+  }
+  return c;
+}
+
+// Chosen on the command line.
+struct server_options
+{
+  bool using_balancer{};
+  // processes sharing the port and the database, or 0 to serve alone
+  size_t workers{};
+  // of the binary protocol, or 0 for none
+  uint16_t rpc_port{8081};
+  double trace_sample{1};
+  tier_policy tiers{};
+  // "rows", a row per node, "blob", a row per tree, or "log", an append-only
+  // file of trees
+  std::string store{"rows"};
+  // rewrites the log store, with the server stopped, rather than serving
+  bool compact{};
+  admission_limits queries{4096, SIZE_MAX, std::chrono::milliseconds{250}};
+  admission_limits ingestion{64, 256 << 20, std::chrono::seconds{2}};
+  // the file requests are captured to, each worker's with its pid appended;
+  // empty for none
+  std::string capture;
+  capture_options capturing{};
+};
+
+template <typename repo_t>
+static int serve(repo_t &data, server_options const &options)
+{
+  using controller_t = async_tree_controller<tiered_repo<read_write_repo<async_adapter<repo_t>>>>;
   std::string prefix;
-  if (using_balancer) {
+  if (options.using_balancer) {
     prefix = std::getenv("TREEHOST");
     prefix += '-';
   }
-  tree_controller tc{data, {[prefix](std::string const &id){return prefix + id; }, [](auto id){ return id; }}};
-  controller_map_t map {
-    {"/tree/*/common-ancestor/*/*", [&tc](auto &proto){tc.common_ancestor(proto);}},
-    {"/tree", [&tc](auto &proto){ tc.post_tree(proto); }},
-    {"/version", [](auto &proto) { proto.reply(VERSION);}},
+  // storage calls run on io, one at a time, ingestion on its own threads,
+  // so a burst of it can't hold up queries, and everything else on compute.
+  // Queries read through a connection of their own on read_io, so they
+  // don't queue behind ingestion's writes either, but the log store
+  // belongs to a single instance, which they share.
+  executor io{1}, read_io{1}, compute{thread_pool::default_size()}, ingest{std::max<size_t>(thread_pool::default_size() / 4, 1)};
+  admission_gate query_gate{options.queries}, ingest_gate{options.ingestion};
+  async_adapter<repo_t> async_data{data, io, compute};
+  std::optional<repo_t> reader;
+  if constexpr (!std::is_same_v<repo_t, log_adapter>)
+  {
+    reader.emplace();
+  }
+  async_adapter<repo_t> async_reads{reader ? *reader : data, reader ? read_io : io, compute};
+  read_write_repo<async_adapter<repo_t>> split_data{async_data, async_reads};
+  tiered_repo<read_write_repo<async_adapter<repo_t>>> tiered_data{split_data, compute, options.tiers};
+  controller_t tc{tiered_data, {[prefix](std::string const &id){return prefix + id; }, [](auto id){ return id; }}};
+  trace_log traces;
+  sqlitedb::on_statement = count_storage_call;
+  std::optional<capture_writer> capture;
+  if (!options.capture.empty())
+  {
+    capture.emplace(options.workers > 0 ? options.capture + '.' + std::to_string(getpid()) : options.capture, options.capturing);
+  }
+  typename server_context<controller_t>::controller_map_t map {
+    {"/tree/*/common-ancestor/#", {[&tc](auto r){ return tc.common_ancestor(std::move(r)); }}},
+    {"/tree/*/common-ancestor", {[&tc](auto r){ return tc.common_ancestor(std::move(r)); }}},
+    {"/tree/*/distance/*/*", {[&tc](auto r){ return tc.distance(std::move(r)); }}},
+    {"/tree/*/ancestor/*/*", {[&tc](auto r){ return tc.ancestor(std::move(r)); }}},
+    {"/tree/*/is-ancestor/*/*", {[&tc](auto r){ return tc.is_ancestor(std::move(r)); }}},
+    {"/tree/*/import", {[&tc](auto r){ return tc.import_tree(std::move(r)); }, work_kind::ingest}},
+    {"/tree", {[&tc](auto r){ return tc.post_tree(std::move(r)); }, work_kind::ingest}},
+    {"/version", {[](auto) -> task<std::string> { co_return VERSION; }, work_kind::control}},
+    {"/debug/traces", {[&traces](auto) -> task<std::string> { co_return traces.json(debug_traces_shown); }, work_kind::control}},
+    {"/debug/tiers", {[&tiered_data](auto) -> task<std::string> { co_return tiered_data.stats().json(); }, work_kind::control}},
+    {"/debug/admission", {[&query_gate, &ingest_gate](auto) -> task<std::string>
+                          { co_return "{\"query\":" + query_gate.current().json() + ",\"ingest\":" + ingest_gate.current().json() + '}'; },
+                          work_kind::control}},
+    {"/debug/capture", {[&capture](auto) -> task<std::string> { co_return capture ? capture->current().json() : "null"; }, work_kind::control}},
   };
+  loop_queue queue;
+  server_context<controller_t> context{map, tc, compute, ingest, query_gate, ingest_gate, queue, traces, options.trace_sample,
+                                       capture ? &*capture : nullptr};
 
   struct mg_mgr mgr;
   struct mg_connection *c;
   mg_mgr_init(&mgr);
-  if ((c = mg_http_listen(&mgr, "http://0.0.0.0:8080", route, &map)) == nullptr)
+  auto const listen = [&](uint16_t port, listen_t listen_on, mg_event_handler_t fn)
+  {
+    return options.workers > 0 ? listen_shared(&mgr, port, listen_on, fn, &context)
+                               : listen_on(&mgr, ("tcp://0.0.0.0:" + std::to_string(port)).c_str(), fn, &context);
+  };
+  if ((c = listen(8080, mg_http_listen, route<controller_t>)) == nullptr ||
+      (options.rpc_port != 0 && listen(options.rpc_port, mg_listen, serve_rpc<controller_t>) == nullptr))
   {
     exit(EXIT_FAILURE);
   }
 
-  // Start infinite event loop
+  if (!queue.listen(mgr))
+  {
+    perror("opening the event loop's wakeup socket");
+    exit(EXIT_FAILURE);
+  }
+
+  // Start infinite event loop, woken when work is done
   for (;;)
+  {
     mg_mgr_poll(&mgr, 1000);
+    queue.run(mgr);
+  }
   mg_mgr_free(&mgr);
   return 0;
 }
+
+// Set by SIGTERM or SIGINT, for the supervisor to stop its workers.
+static volatile std::sig_atomic_t stopping{};
+
+// Runs work in that many forked processes, forking again those that exit,
+// until stopped, then stops them. A worker that dies right away is only
+// restarted after a delay, so a broken one doesn't spin, and a fork that
+// fails is tried again after it. Nothing is forked once a stop is asked.
+static int supervise(size_t workers, std::function<int()> const &work)
+{
+  constexpr std::chrono::seconds restart_delay{1};
+  struct sigaction stop{};
+  stop.sa_handler = [](int)
+  { stopping = 1; };
+  // no SA_RESTART, so that waitpid returns
+  sigaction(SIGTERM, &stop, nullptr);
+  sigaction(SIGINT, &stop, nullptr);
+
+  auto const supervisor{getpid()};
+  std::unordered_map<pid_t, std::chrono::steady_clock::time_point> running;
+  auto const start = [&]
+  {
+    auto const pid{fork()};
+    if (pid == 0)
+    {
+      signal(SIGTERM, SIG_DFL);
+      signal(SIGINT, SIG_DFL);
+      // workers don't outlive the supervisor
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      if (getppid() != supervisor)
+      {
+        _exit(EXIT_FAILURE);
+      }
+      _exit(work());
+    }
+    if (pid < 0)
+    {
+      perror("fork");
+      return false;
+    }
+    running[pid] = std::chrono::steady_clock::now();
+    return true;
+  };
+  // cut short by a stop
+  auto const pause = [&]
+  {
+    auto const until{std::chrono::steady_clock::now() + restart_delay};
+    while (!stopping && std::chrono::steady_clock::now() < until)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds{50});
+    }
+  };
+
+  auto missing{workers};
+  while (!stopping)
+  {
+    while (missing > 0 && !stopping && start())
+    {
+      --missing;
+    }
+    if (stopping || (running.empty() && missing == 0))
+    {
+      break;
+    }
+    int status;
+    // while forks fail, exits are only looked for between tries
+    auto const pid{waitpid(-1, &status, missing > 0 ? WNOHANG : 0)};
+    if (pid <= 0)
+    {
+      if (missing > 0)
+      {
+        pause();
+      }
+      continue;
+    }
+    auto const lasted{std::chrono::steady_clock::now() - running[pid]};
+    running.erase(pid);
+    ++missing;
+    std::cerr << "worker " << pid << (WIFSIGNALED(status) ? " killed by signal " : " exited with ")
+              << (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status)) << '\n';
+    if (lasted < restart_delay)
+    {
+      pause();
+    }
+  }
+  for (auto const &worker : running)
+  {
+    kill(worker.first, SIGTERM);
+  }
+  while (waitpid(-1, nullptr, 0) > 0 || errno == EINTR)
+  {
+  }
+  // ending with no workers, unasked, is a failure
+  return stopping ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Serves from a repo_t of its own, or has workers do so, each opening it
+// once it's been created or upgraded here.
+template <typename repo_t>
+static int start(server_options const &options)
+{
+  if (options.workers == 0)
+  {
+    repo_t data;
+    return serve(data, options);
+  }
+  {
+    repo_t data;
+  }
+  return supervise(options.workers, [&options]
+                   {
+                     repo_t data;
+                     return serve(data, options); });
+}
+
+int main(int argc, char **argv)
+{
+  server_options options;
+  // any argument but the options below turns the balancer prefix on, as -b does
+  for (int i{1}; i < argc; ++i)
+  {
+    std::string_view const arg{argv[i]};
+    auto const value = [&arg](std::string_view option)
+    { return arg.starts_with(option) ? std::atof(arg.data() + option.size()) : -1; };
+    if (arg.starts_with("--store="))
+      options.store = arg.substr(std::strlen("--store="));
+    else if (arg.starts_with("--capture="))
+      options.capture = arg.substr(std::strlen("--capture="));
+    else if (arg == "--capture-hashes")
+      options.capturing.bodies = false;
+    else if (value("--capture-mb=") >= 0)
+      options.capturing.max_bytes = static_cast<uint64_t>(value("--capture-mb=") * (1 << 20));
+    else if (arg == "--compact")
+      options.compact = true;
+    else if (value("--workers=") >= 0)
+      options.workers = static_cast<size_t>(value("--workers="));
+    else if (value("--rpc-port=") >= 0)
+      options.rpc_port = static_cast<uint16_t>(value("--rpc-port="));
+    else if (value("--trace-sample=") >= 0)
+      options.trace_sample = value("--trace-sample=");
+    else if (value("--promote-after=") >= 0)
+      options.tiers.promote_after = static_cast<size_t>(value("--promote-after="));
+    else if (value("--query-limit=") >= 0)
+      options.queries.max_in_flight = static_cast<size_t>(value("--query-limit="));
+    else if (value("--query-target-ms=") >= 0)
+      options.queries.latency_target = std::chrono::microseconds{static_cast<int64_t>(value("--query-target-ms=") * 1000)};
+    else if (value("--ingest-limit=") >= 0)
+      options.ingestion.max_in_flight = static_cast<size_t>(value("--ingest-limit="));
+    else if (value("--ingest-mb=") >= 0)
+      options.ingestion.max_bytes = static_cast<size_t>(value("--ingest-mb=") * (1 << 20));
+    else if (value("--ingest-target-ms=") >= 0)
+      options.ingestion.latency_target = std::chrono::microseconds{static_cast<int64_t>(value("--ingest-target-ms=") * 1000)};
+    else if (value("--demote-idle=") >= 0)
+      options.tiers.idle = std::chrono::duration_cast<tier_policy::duration>(std::chrono::duration<double>{value("--demote-idle=")});
+    else
+      options.using_balancer = true;
+  }
+  if (options.store == "log")
+  {
+    if (options.compact)
+    {
+      log_store::compact("trees-log-" VERSION);
+      return EXIT_SUCCESS;
+    }
+    // it belongs to one process at a time
+    if (options.workers > 0)
+    {
+      std::cerr << "the log store can't be shared by workers\n";
+      return EXIT_FAILURE;
+    }
+    return start<log_adapter>(options);
+  }
+  if (options.compact)
+  {
+    std::cerr << "only the log store is compacted\n";
+    return EXIT_FAILURE;
+  }
+  if (options.store == "blob")
+  {
+    return start<blob_adapter>(options);
+  }
+  if (options.store != "rows")
+  {
+    std::cerr << "unknown store " << options.store << ", rows, blob or log\n";
+    return EXIT_FAILURE;
+  }
+  return start<data_adapter>(options);
+}
@@ -1,6 +1,9 @@
 #pragma once
+#include <climits>
 #include <functional>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 struct mini_parser
 {
@@ -36,8 +39,7 @@ struct mini_parser
     {
       if (isdigit(c))
       {
-        s *= 10;
-        s += c - '0';
+        append_digit(s, c);
       }
       else
       {
@@ -46,6 +48,44 @@ struct mini_parser
     };
   };
 
+  // Reads every remaining integer, separated by ',' or '/', and with
+  // space_separates by ASCII whitespace too, as a body may be. Throws on
+  // anything else.
+  parser read_ints(std::vector<int> &v, bool space_separates = false)
+  {
+    return [&v, space_separates, fresh = true](char c) mutable
+    {
+      if (isdigit(c))
+      {
+        if (fresh)
+        {
+          v.push_back(0);
+          fresh = false;
+        }
+        append_digit(v.back(), c);
+      }
+      else if (c == ',' || c == '/' || (space_separates && (c == ' ' || c == '\t' || c == '\r' || c == '\n')))
+      {
+        fresh = true;
+      }
+      else
+      {
+        throw std::runtime_error("Invalid value list.");
+      }
+    };
+  };
+
+  // Throws rather than let the value wrap.
+  static void append_digit(int &s, char c)
+  {
+    auto const digit{c - '0'};
+    if (s > (INT_MAX - digit) / 10)
+    {
+      throw std::runtime_error("Value out of range.");
+    }
+    s = s * 10 + digit;
+  }
+
   void set(parser const &p) { current_ = p; }
 
   static void parse_throw (char)
@@ -0,0 +1,451 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation. Readers mark the epoch they start in, in a slot
+// of their own, so reading writes to no line another thread writes to.
+// What a writer replaces is freed once no reader started before it was
+// replaced, instead of readers taking a lock or counting references.
+class rcu_domain
+{
+  struct reader;
+
+public:
+  // threads that may read at once
+  static constexpr size_t max_readers{512};
+
+  static rcu_domain &instance()
+  {
+    static rcu_domain domain;
+    return domain;
+  }
+
+  rcu_domain(rcu_domain const &) = delete;
+
+  ~rcu_domain()
+  {
+    for (auto &r : retired_)
+    {
+      r.free();
+    }
+  }
+
+  // While one is held, nothing retired meanwhile is freed. Nests.
+  class read_guard
+  {
+  public:
+    read_guard() : reader_{current_reader()}
+    {
+      if (reader_.depth++ == 0)
+      {
+        reader_.own.epoch.store(instance().epoch_.load(), std::memory_order_relaxed);
+        // so a writer that doesn't see the slot set has published what
+        // this thread then reads
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+    }
+
+    read_guard(read_guard const &) = delete;
+
+    // The last reader holding up what was retired frees it, so it doesn't
+    // wait for another write.
+    ~read_guard()
+    {
+      if (--reader_.depth == 0)
+      {
+        auto const started{reader_.own.epoch.load(std::memory_order_relaxed)};
+        reader_.own.epoch.store(0, std::memory_order_release);
+        // so either this thread sees what a writer retired, or the writer
+        // sees the slot cleared
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto &domain{instance()};
+        if (started <= domain.newest_retired_.load(std::memory_order_relaxed))
+        {
+          std::unique_lock lock{domain.mutex_};
+          auto ready{domain.collect()};
+          lock.unlock();
+          for (auto &r : ready)
+          {
+            r.free();
+          }
+        }
+      }
+    }
+
+  private:
+    reader &reader_;
+  };
+
+  // Frees, once no reader can still be looking at it, what was just
+  // unpublished: at once, or when the last reader that started before is
+  // done. Writers call it one at a time.
+  void retire(std::function<void()> free)
+  {
+    std::vector<retired> ready;
+    {
+      std::lock_guard lock{mutex_};
+      auto const epoch{epoch_.fetch_add(1)};
+      retired_.push_back({epoch, std::move(free)});
+      newest_retired_.store(epoch, std::memory_order_relaxed);
+      ready = collect();
+    }
+    for (auto &r : ready)
+    {
+      r.free();
+    }
+  }
+
+  // Retired but not yet freed, for tests.
+  size_t pending() const
+  {
+    std::lock_guard lock{mutex_};
+    return retired_.size();
+  }
+
+private:
+  struct alignas(64) slot
+  {
+    // 0 while the thread isn't reading
+    std::atomic<uint64_t> epoch{};
+    std::atomic<bool> taken{};
+  };
+
+  // A thread's slot, given back when it ends.
+  struct reader
+  {
+    slot &own;
+    size_t depth{};
+
+    ~reader()
+    {
+      own.epoch.store(0, std::memory_order_relaxed);
+      own.taken.store(false, std::memory_order_release);
+    }
+  };
+
+  struct retired
+  {
+    uint64_t epoch;
+    std::function<void()> free;
+  };
+
+  rcu_domain() = default;
+
+  // Takes out what no reader can be looking at any more. Holding mutex_.
+  std::vector<retired> collect()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto oldest{epoch_.load()};
+    for (auto const &s : slots_)
+    {
+      auto const e{s.epoch.load(std::memory_order_acquire)};
+      if (e != 0)
+      {
+        oldest = std::min(oldest, e);
+      }
+    }
+    auto const waiting{std::partition(retired_.begin(), retired_.end(), [oldest](retired const &r)
+                                      { return r.epoch >= oldest; })};
+    std::vector<retired> ready;
+    std::move(waiting, retired_.end(), std::back_inserter(ready));
+    retired_.erase(waiting, retired_.end());
+    if (retired_.empty())
+    {
+      newest_retired_.store(0, std::memory_order_relaxed);
+    }
+    return ready;
+  }
+
+  static reader &current_reader()
+  {
+    thread_local reader r{instance().take_slot()};
+    return r;
+  }
+
+  slot &take_slot()
+  {
+    for (auto &s : slots_)
+    {
+      if (!s.taken.load(std::memory_order_relaxed) && !s.taken.exchange(true, std::memory_order_acquire))
+      {
+        return s;
+      }
+    }
+    throw std::runtime_error("Too many reading threads.");
+  }
+
+  std::atomic<uint64_t> epoch_{1};
+  std::array<slot, max_readers> slots_;
+  mutable std::mutex mutex_;
+  std::vector<retired> retired_;
+  // the epoch of the last retired, 0 once all are freed: readers that
+  // started after it hold nothing up
+  std::atomic<uint64_t> newest_retired_{};
+};
+
+// A hash map whose readers take no lock and write nothing shared: each
+// bucket is a list of immutable nodes, which writers replace rather than
+// change, publishing the new list, or a whole new table when growing, and
+// retiring what it replaced. Writers are serialised.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class rcu_map
+{
+public:
+  using value_ptr = std::shared_ptr<V const>;
+
+  rcu_map() : table_{new table(initial_buckets)} {}
+
+  rcu_map(rcu_map const &) = delete;
+
+  // no one may be reading by then
+  ~rcu_map() { destroy(table_.load(std::memory_order_relaxed)); }
+
+  // What f returns for the value of the key, if there is one. f runs in a
+  // read_guard, and must not keep the value beyond it.
+  template <typename F>
+  auto read(K const &key, F f) const -> std::optional<std::invoke_result_t<F, V const &>>
+  {
+    rcu_domain::read_guard guard;
+    auto const n{find(*table_.load(std::memory_order_acquire), key)};
+    if (n == nullptr)
+    {
+      return std::nullopt;
+    }
+    return f(*n->value);
+  }
+
+  // The value of the key, or nullptr, shared: for those keeping it.
+  value_ptr get(K const &key) const
+  {
+    rcu_domain::read_guard guard;
+    auto const n{find(*table_.load(std::memory_order_acquire), key)};
+    return n == nullptr ? nullptr : n->value;
+  }
+
+  bool contains(K const &key) const
+  {
+    rcu_domain::read_guard guard;
+    return find(*table_.load(std::memory_order_acquire), key) != nullptr;
+  }
+
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+  // Calls f(key, value) for each entry of the map as it was at some time.
+  template <typename F>
+  void for_each(F f) const
+  {
+    rcu_domain::read_guard guard;
+    auto const &t{*table_.load(std::memory_order_acquire)};
+    for (auto const &bucket : t.buckets)
+    {
+      for (auto n{bucket.load(std::memory_order_acquire)}; n != nullptr; n = n->next)
+      {
+        f(n->key, *n->value);
+      }
+    }
+  }
+
+  // Adds the value, or replaces the key's.
+  void insert(K const &key, value_ptr value)
+  {
+    std::lock_guard lock{writer_};
+    if (!remove(key))
+    {
+      size_.fetch_add(1, std::memory_order_relaxed);
+    }
+    auto t{table_.load(std::memory_order_relaxed)};
+    if (size() > t->buckets.size())
+    {
+      t = grow(t);
+    }
+    auto &head{t->buckets[bucket_of(*t, key)]};
+    head.store(new node{key, std::move(value), head.load(std::memory_order_relaxed)}, std::memory_order_release);
+  }
+
+  // Adds the value unless the key has one, and returns the key's value.
+  value_ptr emplace(K const &key, value_ptr value)
+  {
+    std::lock_guard lock{writer_};
+    auto t{table_.load(std::memory_order_relaxed)};
+    if (auto const n{find(*t, key)})
+    {
+      return n->value;
+    }
+    size_.fetch_add(1, std::memory_order_relaxed);
+    if (size() > t->buckets.size())
+    {
+      t = grow(t);
+    }
+    auto &head{t->buckets[bucket_of(*t, key)]};
+    head.store(new node{key, value, head.load(std::memory_order_relaxed)}, std::memory_order_release);
+    return value;
+  }
+
+  bool erase(K const &key)
+  {
+    std::lock_guard lock{writer_};
+    if (!remove(key))
+    {
+      return false;
+    }
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Removes the entries for which pred(key, value) holds, and says how many.
+  template <typename P>
+  size_t erase_if(P pred)
+  {
+    std::lock_guard lock{writer_};
+    std::vector<K> doomed;
+    for (auto const &bucket : table_.load(std::memory_order_relaxed)->buckets)
+    {
+      for (auto n{bucket.load(std::memory_order_relaxed)}; n != nullptr; n = n->next)
+      {
+        if (pred(n->key, *n->value))
+          doomed.push_back(n->key);
+      }
+    }
+    for (auto const &key : doomed)
+    {
+      remove(key);
+    }
+    size_.fetch_sub(doomed.size(), std::memory_order_relaxed);
+    return doomed.size();
+  }
+
+private:
+  static constexpr size_t initial_buckets{64};
+
+  struct node
+  {
+    K key;
+    value_ptr value;
+    node const *next;
+  };
+
+  struct table
+  {
+    explicit table(size_t size) : buckets(size) {}
+
+    std::vector<std::atomic<node const *>> buckets;
+  };
+
+  static size_t bucket_of(table const &t, K const &key) { return Hash{}(key) % t.buckets.size(); }
+
+  static node const *find(table const &t, K const &key)
+  {
+    for (auto n{t.buckets[bucket_of(t, key)].load(std::memory_order_acquire)}; n != nullptr; n = n->next)
+    {
+      if (n->key == key)
+        return n;
+    }
+    return nullptr;
+  }
+
+  static void destroy(table const *t)
+  {
+    for (auto const &bucket : t->buckets)
+    {
+      for (auto n{bucket.load(std::memory_order_relaxed)}; n != nullptr;)
+      {
+        delete std::exchange(n, n->next);
+      }
+    }
+    delete t;
+  }
+
+  // Unlinks the key's node, copying those before it in its bucket.
+  bool remove(K const &key)
+  {
+    auto const t{table_.load(std::memory_order_relaxed)};
+    auto &head{t->buckets[bucket_of(*t, key)]};
+    std::vector<node const *> replaced;
+    auto n{head.load(std::memory_order_relaxed)};
+    for (; n != nullptr && !(n->key == key); n = n->next)
+    {
+      replaced.push_back(n);
+    }
+    if (n == nullptr)
+    {
+      return false;
+    }
+    auto rest{n->next};
+    replaced.push_back(n);
+    for (auto i{replaced.size() - 1}; i-- > 0;)
+    {
+      rest = new node{replaced[i]->key, replaced[i]->value, rest};
+    }
+    head.store(rest, std::memory_order_release);
+    rcu_domain::instance().retire([replaced = std::move(replaced)]
+                                  {
+                                    for (auto r : replaced)
+                                      delete r; });
+    return true;
+  }
+
+  // A copy of the table with twice the buckets, published.
+  table *grow(table *t)
+  {
+    auto const bigger{new table(t->buckets.size() * 2)};
+    for (auto const &bucket : t->buckets)
+    {
+      for (auto n{bucket.load(std::memory_order_relaxed)}; n != nullptr; n = n->next)
+      {
+        auto &head{bigger->buckets[bucket_of(*bigger, n->key)]};
+        head.store(new node{n->key, n->value, head.load(std::memory_order_relaxed)}, std::memory_order_relaxed);
+      }
+    }
+    table_.store(bigger, std::memory_order_release);
+    rcu_domain::instance().retire([t]
+                                  { destroy(t); });
+    return bigger;
+  }
+
+  std::atomic<table *> table_;
+  std::atomic<size_t> size_{};
+  std::mutex writer_;
+};
+
+// A counter that threads add to on lines of their own, as far as there are
+// enough, so counting doesn't bounce one line between all of them.
+class striped_counter
+{
+public:
+  void add(uint64_t n = 1)
+  {
+    thread_local size_t const mine{next_stripe_.fetch_add(1, std::memory_order_relaxed) % stripes};
+    stripes_[mine].n.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t sum() const
+  {
+    uint64_t total{};
+    for (auto const &s : stripes_)
+    {
+      total += s.n.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+private:
+  static constexpr size_t stripes{64};
+
+  struct alignas(64) stripe
+  {
+    std::atomic<uint64_t> n{};
+  };
+
+  static inline std::atomic<size_t> next_stripe_{};
+  std::array<stripe, stripes> stripes_;
+};
@@ -0,0 +1,217 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "task.h"
+
+// A framed binary protocol for the path queries, for services calling an
+// instance directly, without the cost of HTTP. A frame starts with its
+// length, not counting those 4 bytes, then the id of the request, chosen
+// by the client and given back in the reply: requests are pipelined, and
+// replies are sent as they're ready, not in order. Integers are
+// little-endian.
+//
+//   request  u32 length, u32 id, u8 op, u16 tree id length, tree id,
+//            u16 count, count times i32 argument
+//   reply    u32 length, u32 id, u8 status, and then an i32: the result,
+//            or the seconds to wait if overloaded; or, for an error, the
+//            message
+enum class rpc_op : uint8_t
+{
+  // of the arguments, 2 or more
+  common_ancestor = 1,
+  // between the 2 arguments
+  distance,
+  // of the first argument, the second is how many levels up
+  ancestor,
+  // whether the first argument is an ancestor of the second; 0 or 1
+  is_ancestor
+};
+
+enum class rpc_status : uint8_t
+{
+  ok,
+  error,
+  overloaded
+};
+
+struct rpc_request
+{
+  uint32_t id;
+  rpc_op op;
+  std::string tree_id;
+  std::vector<int> args;
+};
+
+struct rpc_reply
+{
+  uint32_t id;
+  rpc_status status;
+  int value;
+  std::string message;
+};
+
+// A frame longer than this is taken for garbage, and closes the connection.
+inline constexpr size_t rpc_max_frame{64 * 1024};
+
+namespace rpc_detail
+{
+  inline void put(std::string &out, uint32_t v, int bytes = 4)
+  {
+    for (int shift{}; shift < bytes * 8; shift += 8)
+      out += static_cast<char>((v >> shift) & 0xff);
+  }
+
+  // Reads from a frame, throwing if it runs short.
+  struct reader
+  {
+    std::string_view data;
+
+    uint32_t get(int bytes = 4)
+    {
+      if (data.size() < static_cast<size_t>(bytes))
+      {
+        throw std::runtime_error("Truncated frame.");
+      }
+      uint32_t v{};
+      for (int i{bytes - 1}; i >= 0; --i)
+        v = (v << 8) | static_cast<uint8_t>(data[i]);
+      data.remove_prefix(bytes);
+      return v;
+    }
+
+    std::string_view take(size_t n)
+    {
+      if (data.size() < n)
+      {
+        throw std::runtime_error("Truncated frame.");
+      }
+      auto const result{data.substr(0, n)};
+      data.remove_prefix(n);
+      return result;
+    }
+  };
+
+  inline std::string frame(std::string body)
+  {
+    std::string out;
+    out.reserve(4 + body.size());
+    put(out, static_cast<uint32_t>(body.size()));
+    return out + body;
+  }
+
+  inline void decode(reader in, rpc_request &r)
+  {
+    r.id = in.get();
+    r.op = static_cast<rpc_op>(in.get(1));
+    r.tree_id = in.take(in.get(2));
+    r.args.resize(in.get(2));
+    for (auto &arg : r.args)
+      arg = static_cast<int32_t>(in.get());
+  }
+
+  inline void decode(reader in, rpc_reply &r)
+  {
+    r.id = in.get();
+    r.status = static_cast<rpc_status>(in.get(1));
+    if (r.status == rpc_status::error)
+      r.message = in.data;
+    else
+      r.value = static_cast<int32_t>(in.get());
+  }
+}
+
+inline std::string encode(rpc_request const &r)
+{
+  std::string body;
+  rpc_detail::put(body, r.id);
+  rpc_detail::put(body, static_cast<uint8_t>(r.op), 1);
+  rpc_detail::put(body, static_cast<uint32_t>(r.tree_id.size()), 2);
+  body += r.tree_id;
+  rpc_detail::put(body, static_cast<uint32_t>(r.args.size()), 2);
+  for (auto const arg : r.args)
+    rpc_detail::put(body, static_cast<uint32_t>(arg));
+  return rpc_detail::frame(std::move(body));
+}
+
+inline std::string encode(rpc_reply const &r)
+{
+  std::string body;
+  rpc_detail::put(body, r.id);
+  rpc_detail::put(body, static_cast<uint8_t>(r.status), 1);
+  if (r.status == rpc_status::error)
+    body += r.message;
+  else
+    rpc_detail::put(body, static_cast<uint32_t>(r.value));
+  return rpc_detail::frame(std::move(body));
+}
+
+// Calls on_frame with each whole frame at the start of data, decoded as a
+// T, and returns the bytes they took; the rest is the start of a frame
+// still to come. Throws on frames that can't be decoded, after which the
+// stream can't be trusted.
+template <typename T, typename F>
+size_t rpc_decode(std::string_view data, F on_frame)
+{
+  size_t used{};
+  while (data.size() - used >= 4)
+  {
+    rpc_detail::reader header{data.substr(used, 4)};
+    auto const length{header.get()};
+    if (length > rpc_max_frame)
+    {
+      throw std::runtime_error("Frame too long.");
+    }
+    if (data.size() - used - 4 < length)
+    {
+      break;
+    }
+    T frame{};
+    rpc_detail::reader body{data.substr(used + 4, length)};
+    rpc_detail::decode(body, frame);
+    used += 4 + length;
+    on_frame(std::move(frame));
+  }
+  return used;
+}
+
+// Answers a request with the same controller methods as the HTTP routes.
+template <typename controller_t>
+task<int> rpc_call(controller_t &controller, rpc_request r)
+{
+  auto const tree_id{controller.tree_key(r.tree_id)};
+  auto const pair{r.args.size() == 2};
+  switch (r.op)
+  {
+  case rpc_op::common_ancestor:
+    if (r.args.size() < 2)
+    {
+      throw std::runtime_error("At least two values expected.");
+    }
+    co_return co_await controller.common_ancestor(tree_id, std::move(r.args));
+  case rpc_op::distance:
+    if (pair)
+    {
+      co_return co_await controller.distance(tree_id, r.args[0], r.args[1]);
+    }
+    break;
+  case rpc_op::ancestor:
+    if (pair)
+    {
+      co_return co_await controller.ancestor(tree_id, r.args[0], r.args[1]);
+    }
+    break;
+  case rpc_op::is_ancestor:
+    if (pair)
+    {
+      auto const result{co_await controller.is_ancestor(tree_id, r.args[0], r.args[1])};
+      co_return result ? 1 : 0;
+    }
+    break;
+  default:
+    throw std::runtime_error("Unknown operation.");
+  }
+  throw std::runtime_error("Two values expected.");
+}
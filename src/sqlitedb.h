@@ -1,5 +1,8 @@
 #pragma once
 #include <sqlite3.h>
+#include <optional>
+#include <string>
+#include <string_view>
 
 struct sqlitedb
 {
@@ -37,18 +40,110 @@ struct sqlitedb
     }
   };
 
+  struct int64_parameter : public parameter
+  {
+    sqlite3_int64 value;
+    int64_parameter(sqlite3_int64 v) : value{v} {}
+    void bind(sqlite3_stmt *stmt, int index) const override
+    {
+      auto rc = sqlite3_bind_int64(stmt, index, value);
+      if (rc != SQLITE_OK)
+      {
+        throw std::runtime_error("error " + std::to_string(rc) + " index " + std::to_string(index));
+      }
+    }
+  };
+
+  struct blob_parameter : public parameter
+  {
+    std::string_view value;
+    blob_parameter(std::string_view v) : value{v} {}
+    void bind(sqlite3_stmt *stmt, int index) const override
+    {
+      auto rc = sqlite3_bind_blob64(stmt, index, value.data(), value.size(), SQLITE_STATIC);
+      if (rc != SQLITE_OK)
+      {
+        throw std::runtime_error("error " + std::to_string(rc) + " index " + std::to_string(index));
+      }
+    }
+  };
+
+  struct null_parameter : public parameter
+  {
+    void bind(sqlite3_stmt *stmt, int index) const override
+    {
+      auto rc = sqlite3_bind_null(stmt, index);
+      if (rc != SQLITE_OK)
+      {
+        throw std::runtime_error("error " + std::to_string(rc) + " index " + std::to_string(index));
+      }
+    }
+  };
+
+  // Rolled back unless committed. Takes the write lock at once, as a
+  // transaction that reads first can't wait for another process's writes.
+  struct transaction
+  {
+    explicit transaction(sqlitedb const &db) : db_{db}
+    {
+      db_.exec("BEGIN IMMEDIATE");
+    }
+
+    transaction(transaction const &) = delete;
+
+    ~transaction()
+    {
+      if (!done_)
+      {
+        try
+        {
+          db_.exec("ROLLBACK");
+        }
+        catch (std::exception const &)
+        {
+        }
+      }
+    }
+
+    void commit()
+    {
+      db_.exec("COMMIT");
+      done_ = true;
+    }
+
+  private:
+    sqlitedb const &db_;
+    bool done_{};
+  };
+
   ~sqlitedb() {
     if (db)
       sqlite3_close(db);
   }
 
+  // How long a statement waits for another process to finish writing.
+  static constexpr int busy_timeout_ms{5000};
+
+  // Called on the calling thread before each statement, as tracing does to
+  // count them; nothing by default.
+  inline static void (*on_statement)(){};
+
+  // Opens the file in WAL mode, so that several processes can share it,
+  // readers never waiting for the writer.
   auto open(std::string const &file) {
-    return sqlite3_open(file.c_str(), &db);    
+    auto rc{sqlite3_open(file.c_str(), &db)};
+    if (rc == SQLITE_OK)
+    {
+      sqlite3_busy_timeout(db, busy_timeout_ms);
+      rc = sqlite3_exec(db, "PRAGMA journal_mode=WAL", nullptr, nullptr, nullptr);
+    }
+    return rc;
   }
 
   template <typename T>
   void exec(std::string_view command, T callback, std::vector<parameter *> parameters = {}) const
   {
+    statement_run();
     // prepare
     sqlite3_stmt *stmt;
     auto rc = sqlite3_prepare_v2(db, command.data(), command.length(), &stmt, nullptr);
@@ -74,7 +169,8 @@ struct sqlitedb
         {
           for (int c{0}; c < col_count; ++c)
           {
-            values[c] = reinterpret_cast<const char *>(sqlite3_column_text(hs, c));
+            auto const text{reinterpret_cast<const char *>(sqlite3_column_text(hs, c))};
+            values[c] = text ? std::string_view{text} : std::string_view{};
           }
           callback(values, col_names);
         }
@@ -88,6 +184,7 @@ struct sqlitedb
 
   void exec(std::string_view command, std::vector<parameter *> parameters = {}) const
   {
+    statement_run();
     // prepare
     sqlite3_stmt *stmt;
     auto rc = sqlite3_prepare_v2(db, command.data(), command.length(), &stmt, nullptr);
@@ -110,6 +207,64 @@ struct sqlitedb
     }
   }
 
+  // The whole BLOB in the given row, read without stepping a statement,
+  // or nothing if there's no such row.
+  std::optional<std::string> read_blob(char const *table, char const *column, sqlite3_int64 rowid) const
+  {
+    statement_run();
+    sqlite3_blob *blob;
+    auto rc = sqlite3_blob_open(db, "main", table, column, rowid, 0, &blob);
+    if (rc == SQLITE_ERROR)
+    {
+      sqlite3_blob_close(blob);
+      return {};
+    }
+    check_rc(rc, "opening a blob");
+    std::string result(static_cast<size_t>(sqlite3_blob_bytes(blob)), '\0');
+    rc = sqlite3_blob_read(blob, result.data(), static_cast<int>(result.size()), 0);
+    sqlite3_blob_close(blob);
+    check_rc(rc, "reading a blob");
+    return result;
+  }
+
+  // A statement prepared once and run many times, for bulk loads, where
+  // preparing it for every row would take longer than running it.
+  class statement
+  {
+  public:
+    statement(sqlitedb const &db, std::string_view command) : db_{db}, command_{command}
+    {
+      db_.check_rc(sqlite3_prepare_v2(db_.db, command.data(), command.length(), &stmt_, nullptr), command_);
+    }
+
+    statement(statement const &) = delete;
+
+    ~statement() { sqlite3_finalize(stmt_); }
+
+    void run(std::vector<parameter *> const &parameters = {})
+    {
+      statement_run();
+      sqlite3_reset(stmt_);
+      for (int idx{}; idx < parameters.size(); ++idx)
+      {
+        parameters[idx]->bind(stmt_, idx + 1);
+      }
+      auto rc{sqlite3_step(stmt_)};
+      if (rc != SQLITE_DONE)
+      {
+        db_.check_rc(rc, command_);
+      }
+    }
+
+  private:
+    sqlitedb const &db_;
+    std::string_view command_;
+    sqlite3_stmt *stmt_{};
+  };
+
+  // The rowid of the last row inserted on this connection.
+  sqlite3_int64 last_insert_rowid() const { return sqlite3_last_insert_rowid(db); }
+
   void drop_table(std::string_view name, bool if_exists) const
   {
     std::string cmd("DROP TABLE ");
@@ -125,13 +280,22 @@ struct sqlitedb
                      std::string_view key,
                      std::string_view new_value) const
   {
-    string_parameter table_parameter{std::string(table)};
-    string_parameter key_column_parameter{std::string(key_column)};
-    string_parameter value_column_parameter{std::string(value_column)};
     string_parameter key_parameter{std::string(key)};
     string_parameter new_value_parameter{std::string(new_value)};
-    exec("INSET INTO ? (?,?) VALUES (?,?) ON CONFLICT(?2) DO UPDATE SET ?3=excluded.?3",
-         {&table_parameter, &key_column_parameter, &value_column_parameter, &key_parameter, &new_value_parameter});
+    // identifiers can't be bound as parameters
+    std::string cmd("INSERT INTO ");
+    cmd += table;
+    cmd += " (";
+    cmd += key_column;
+    cmd += ',';
+    cmd += value_column;
+    cmd += ") VALUES (?,?) ON CONFLICT(";
+    cmd += key_column;
+    cmd += ") DO UPDATE SET ";
+    cmd += value_column;
+    cmd += "=excluded.";
+    cmd += value_column;
+    exec(cmd, {&key_parameter, &new_value_parameter});
   }
 
   template <typename T>
@@ -157,6 +321,14 @@ struct sqlitedb
 
 
 private:
+  static void statement_run()
+  {
+    if (on_statement)
+    {
+      on_statement();
+    }
+  }
+
   void check_rc(int rc, std::string_view context, char *pError = nullptr) const
   {
     if (rc != SQLITE_OK)
@@ -0,0 +1,501 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+#include <stdexcept>
+#include "tree-index.h"
+
+// Unsigned integers of a fixed bit width, packed back to back.
+class packed_array
+{
+public:
+  packed_array() = default;
+  packed_array(size_t size, unsigned width)
+      : width_{width}, words_((size * width + 63) / 64 + 1)
+  {
+  }
+
+  static unsigned width_for(uint64_t max_value)
+  {
+    unsigned width{1};
+    while (width < 64 && (max_value >> width) != 0)
+    {
+      ++width;
+    }
+    return width;
+  }
+
+  uint64_t get(size_t i) const
+  {
+    auto const bit{i * width_};
+    auto const word{bit / 64}, offset{bit % 64};
+    uint64_t result{words_[word] >> offset};
+    if (offset + width_ > 64)
+    {
+      result |= words_[word + 1] << (64 - offset);
+    }
+    return width_ == 64 ? result : result & ((uint64_t{1} << width_) - 1);
+  }
+
+  void set(size_t i, uint64_t value)
+  {
+    auto const bit{i * width_};
+    auto const word{bit / 64}, offset{bit % 64};
+    auto const mask{width_ == 64 ? ~uint64_t{} : (uint64_t{1} << width_) - 1};
+    words_[word] = (words_[word] & ~(mask << offset)) | (value << offset);
+    if (offset + width_ > 64)
+    {
+      auto const spill{64 - offset};
+      words_[word + 1] = (words_[word + 1] & ~(mask >> spill)) | (value >> spill);
+    }
+  }
+
+  size_t size_in_bytes() const { return words_.size() * sizeof(uint64_t); }
+
+private:
+  unsigned width_{1};
+  std::vector<uint64_t> words_;
+};
+
+// A bit sequence with constant time rank and logarithmic select over ones.
+class bit_vector
+{
+public:
+  void push_back(bool bit)
+  {
+    if (size_ % 64 == 0)
+    {
+      words_.push_back(0);
+    }
+    if (bit)
+    {
+      words_.back() |= uint64_t{1} << (size_ % 64);
+    }
+    ++size_;
+  }
+
+  bool operator[](size_t i) const { return (words_[i / 64] >> (i % 64)) & 1; }
+
+  size_t size() const { return size_; }
+
+  // Counts the ones of each 512 bit superblock; call once all bits are in.
+  void build_rank()
+  {
+    auto const superblocks{(words_.size() + words_per_superblock - 1) / words_per_superblock};
+    ranks_.assign(superblocks + 1, 0);
+    for (size_t w{}; w < words_.size(); ++w)
+    {
+      ranks_[w / words_per_superblock + 1] += __builtin_popcountll(words_[w]);
+    }
+    for (size_t s{}; s < superblocks; ++s)
+    {
+      ranks_[s + 1] += ranks_[s];
+    }
+  }
+
+  // Ones in [0, i).
+  size_t rank1(size_t i) const
+  {
+    auto const word{i / 64};
+    size_t result{ranks_[word / words_per_superblock]};
+    for (auto w{word - word % words_per_superblock}; w < word; ++w)
+    {
+      result += __builtin_popcountll(words_[w]);
+    }
+    if (i % 64)
+    {
+      result += __builtin_popcountll(words_[word] & ((uint64_t{1} << (i % 64)) - 1));
+    }
+    return result;
+  }
+
+  // Position of the k-th one, counting from zero.
+  size_t select1(size_t k) const
+  {
+    auto const superblock{static_cast<size_t>(std::upper_bound(ranks_.begin(), ranks_.end(), k) - ranks_.begin()) - 1};
+    k -= ranks_[superblock];
+    for (auto w{superblock * words_per_superblock};; ++w)
+    {
+      auto word{words_[w]};
+      size_t const ones = __builtin_popcountll(word);
+      if (k < ones)
+      {
+        for (; k > 0; --k)
+        {
+          word &= word - 1;
+        }
+        return w * 64 + __builtin_ctzll(word);
+      }
+      k -= ones;
+    }
+  }
+
+  size_t size_in_bytes() const { return (words_.size() + ranks_.size()) * sizeof(uint64_t); }
+
+private:
+  static constexpr size_t words_per_superblock{8};
+
+  std::vector<uint64_t> words_;
+  std::vector<uint64_t> ranks_;
+  size_t size_{};
+};
+
+// A finished tree as balanced parentheses: a node is the position of its
+// opening parenthesis, written in preorder, and its subtree runs until the
+// matching close. A range min-max tree over the excess (opens minus closes)
+// answers parent, depth and common ancestor directly on the bits; values are
+// packed in preorder next to them. Roots hang from a virtual node at position
+// 0, so a forest is still balanced.
+class succinct_tree
+{
+public:
+  explicit succinct_tree(flat_tree const &t)
+  {
+    auto const n{t.size()};
+    build_parens(t.parents);
+    parens_.build_rank();
+    build_min_max();
+
+    int64_t max_value{};
+    if (n)
+    {
+      auto const [lo, hi] = std::minmax_element(t.values.begin(), t.values.end());
+      base_ = *lo;
+      max_value = *hi;
+    }
+    values_ = packed_array{n, packed_array::width_for(static_cast<uint64_t>(max_value - base_))};
+    std::vector<uint32_t> by_value(n);
+    for (size_t i{}; i < n; ++i)
+    {
+      values_.set(preorder_of_[i], static_cast<uint64_t>(int64_t{t.values[i]} - base_));
+      by_value[i] = preorder_of_[i];
+    }
+    preorder_of_ = {};
+    std::sort(by_value.begin(), by_value.end(), [this](auto a, auto b)
+              { return value_at(a) < value_at(b); });
+    by_value_ = packed_array{n, packed_array::width_for(n)};
+    for (size_t i{}; i < n; ++i)
+    {
+      by_value_.set(i, by_value[i]);
+    }
+    size_ = n;
+  }
+
+  size_t size() const { return size_; }
+
+  size_t size_in_bytes() const
+  {
+    return parens_.size_in_bytes() + min_max_.size() * sizeof(int32_t) + values_.size_in_bytes() + by_value_.size_in_bytes();
+  }
+
+  bool contains(int value) const { return find(value) != not_found; }
+
+  int depth(int value) const { return excess(position(value)) - 2; }
+
+  // The k-th ancestor of value; k == 0 is the node itself.
+  int ancestor(int value, int k) const
+  {
+    auto const node{position(value)};
+    if (k < 0 || k > excess(node) - 2)
+    {
+      throw std::runtime_error("No such ancestor.");
+    }
+    return k == 0 ? value : value_of(bwd_search(node, excess(node) - k - 1) + 1);
+  }
+
+  // True when a lies on the path from b to its root (b included).
+  bool is_ancestor(int a, int b) const { return encloses(position(a), position(b)); }
+
+  int common_ancestor(int a, int b) const { return value_of(lca(position(a), position(b))); }
+
+  int common_ancestor(std::vector<int> const &values) const
+  {
+    if (values.empty())
+    {
+      throw std::runtime_error("No values.");
+    }
+    auto first{position(values.front())}, last{first};
+    for (auto value : values)
+    {
+      auto const node{position(value)};
+      first = std::min(first, node);
+      last = std::max(last, node);
+    }
+    return value_of(lca(first, last));
+  }
+
+  // Number of edges on the path between a and b.
+  int distance(int a, int b) const
+  {
+    auto const pa{position(a)}, pb{position(b)};
+    return excess(pa) + excess(pb) - 2 * excess(lca(pa, pb));
+  }
+
+private:
+  static constexpr size_t block_bits{256};
+  static constexpr size_t not_found{~size_t{}};
+
+  int value_at(size_t preorder) const { return static_cast<int>(base_ + static_cast<int64_t>(values_.get(preorder))); }
+
+  // nodes are opening positions; preorder 0 is the virtual root
+  int value_of(size_t node) const { return value_at(parens_.rank1(node) - 1); }
+
+  size_t find(int value) const
+  {
+    size_t lo{}, hi{size_};
+    while (lo < hi)
+    {
+      auto const mid{(lo + hi) / 2};
+      if (value_at(by_value_.get(mid)) < value)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo == size_ || value_at(by_value_.get(lo)) != value)
+    {
+      return not_found;
+    }
+    return parens_.select1(by_value_.get(lo) + 1);
+  }
+
+  size_t position(int value) const
+  {
+    auto const node{find(value)};
+    if (node == not_found)
+    {
+      throw std::runtime_error("Not found.");
+    }
+    return node;
+  }
+
+  int64_t excess(size_t i) const { return 2 * static_cast<int64_t>(parens_.rank1(i + 1)) - static_cast<int64_t>(i + 1); }
+
+  int step(size_t i) const { return parens_[i] ? 1 : -1; }
+
+  size_t close(size_t node) const { return fwd_search(node, excess(node) - 1); }
+
+  bool encloses(size_t a, size_t b) const { return a <= b && b < close(a); }
+
+  size_t parent(size_t node) const { return bwd_search(node, excess(node) - 2) + 1; }
+
+  size_t lca(size_t a, size_t b) const
+  {
+    if (a > b)
+    {
+      std::swap(a, b);
+    }
+    if (encloses(a, b))
+    {
+      return a;
+    }
+    auto const result{parent(rmq(a, b) + 1)};
+    if (result == 0)
+    {
+      throw std::runtime_error("No common ancestor.");
+    }
+    return result;
+  }
+
+  // Smallest j > i with excess(j) <= target.
+  size_t fwd_search(size_t i, int64_t target) const
+  {
+    auto e{excess(i)};
+    auto const block_end{std::min(parens_.size(), (i / block_bits + 1) * block_bits)};
+    for (auto j{i + 1}; j < block_end; ++j)
+    {
+      e += step(j);
+      if (e <= target)
+        return j;
+    }
+    auto const block{leftmost(1, 0, leaves_, i / block_bits + 1, target)};
+    if (block == not_found)
+    {
+      return not_found;
+    }
+    auto j{block * block_bits};
+    for (e = excess(j); e > target; e += step(++j))
+      ;
+    return j;
+  }
+
+  // Largest j < i with excess(j) <= target; excess(-1) is 0.
+  int64_t bwd_search(size_t i, int64_t target) const
+  {
+    auto e{excess(i)};
+    auto const block_start{i / block_bits * block_bits};
+    for (auto j{i}; j > block_start;)
+    {
+      e -= step(j--);
+      if (e <= target)
+        return j;
+    }
+    if (i / block_bits > 0)
+    {
+      auto const block{rightmost(1, 0, leaves_, i / block_bits, target)};
+      if (block != not_found)
+      {
+        auto j{std::min(parens_.size(), (block + 1) * block_bits) - 1};
+        for (e = excess(j); e > target; e -= step(j--))
+          ;
+        return j;
+      }
+    }
+    return -1;
+  }
+
+  // A position of the minimum excess in [i, j].
+  size_t rmq(size_t i, size_t j) const
+  {
+    size_t best{i};
+    auto best_excess{excess(i)};
+    auto e{best_excess};
+    auto const consider = [&](size_t at, int64_t value)
+    {
+      if (value < best_excess)
+      {
+        best = at;
+        best_excess = value;
+      }
+    };
+    auto const head_end{std::min(j + 1, (i / block_bits + 1) * block_bits)};
+    for (auto k{i + 1}; k < head_end; ++k)
+    {
+      e += step(k);
+      consider(k, e);
+    }
+    if (head_end > j)
+    {
+      return best;
+    }
+    auto const first_block{i / block_bits + 1}, last_block{j / block_bits};
+    if (first_block < last_block)
+    {
+      auto const middle{range_min(1, 0, leaves_, first_block, last_block)};
+      if (middle < best_excess)
+      {
+        auto k{leftmost(1, 0, leaves_, first_block, middle) * block_bits};
+        for (e = excess(k); e != middle; e += step(++k))
+          ;
+        consider(k, e);
+      }
+    }
+    auto k{last_block * block_bits};
+    for (e = excess(k), consider(k, e); k < j;)
+    {
+      e += step(++k);
+      consider(k, e);
+    }
+    return best;
+  }
+
+  // segment tree over block minimums, node 1 covering leaves [0, leaves_)
+  size_t leftmost(size_t node, size_t lo, size_t hi, size_t from, int64_t target) const
+  {
+    if (hi <= from || min_max_[node] > target)
+      return not_found;
+    if (hi - lo == 1)
+      return lo;
+    auto const mid{(lo + hi) / 2};
+    auto const result{leftmost(2 * node, lo, mid, from, target)};
+    return result != not_found ? result : leftmost(2 * node + 1, mid, hi, from, target);
+  }
+
+  size_t rightmost(size_t node, size_t lo, size_t hi, size_t to, int64_t target) const
+  {
+    if (lo >= to || min_max_[node] > target)
+      return not_found;
+    if (hi - lo == 1)
+      return lo;
+    auto const mid{(lo + hi) / 2};
+    auto const result{rightmost(2 * node + 1, mid, hi, to, target)};
+    return result != not_found ? result : rightmost(2 * node, lo, mid, to, target);
+  }
+
+  int64_t range_min(size_t node, size_t lo, size_t hi, size_t from, size_t to) const
+  {
+    if (hi <= from || lo >= to)
+      return INT_MAX;
+    if (from <= lo && hi <= to)
+      return min_max_[node];
+    auto const mid{(lo + hi) / 2};
+    return std::min(range_min(2 * node, lo, mid, from, to), range_min(2 * node + 1, mid, hi, from, to));
+  }
+
+  void build_parens(std::vector<int32_t> const &parents)
+  {
+    auto const n{parents.size()};
+    std::vector<int32_t> first_child(n + 2), children(n);
+    // the virtual root is n, children grouped by parent in a single array
+    auto const parent_of = [&parents, n](size_t i)
+    { return parents[i] == flat_tree::none ? n : static_cast<size_t>(parents[i]); };
+    for (size_t i{}; i < n; ++i)
+    {
+      ++first_child[parent_of(i) + 1];
+    }
+    for (size_t i{}; i <= n; ++i)
+    {
+      first_child[i + 1] += first_child[i];
+    }
+    auto next{first_child};
+    for (size_t i{}; i < n; ++i)
+    {
+      children[next[parent_of(i)]++] = static_cast<int32_t>(i);
+    }
+    preorder_of_.assign(n, 0);
+    // each entry is a node and the index of its next child to visit
+    std::vector<std::pair<size_t, int32_t>> stack{{n, first_child[n]}};
+    parens_.push_back(true);
+    uint32_t order{};
+    while (!stack.empty())
+    {
+      auto &[node, child] = stack.back();
+      if (child == first_child[node + 1])
+      {
+        parens_.push_back(false);
+        stack.pop_back();
+        continue;
+      }
+      auto const next_node{static_cast<size_t>(children[child++])};
+      preorder_of_[next_node] = order++;
+      parens_.push_back(true);
+      stack.emplace_back(next_node, first_child[next_node]);
+    }
+    // nodes on a cycle are never reached from a root
+    if (order != n)
+    {
+      throw std::runtime_error("Cycle detected.");
+    }
+  }
+
+  void build_min_max()
+  {
+    auto const blocks{(parens_.size() + block_bits - 1) / block_bits};
+    leaves_ = 1;
+    while (leaves_ < blocks)
+    {
+      leaves_ *= 2;
+    }
+    min_max_.assign(2 * leaves_, INT_MAX);
+    int32_t e{};
+    for (size_t i{}; i < parens_.size(); ++i)
+    {
+      e += step(i);
+      auto &leaf{min_max_[leaves_ + i / block_bits]};
+      leaf = std::min(leaf, e);
+    }
+    for (auto node{leaves_}; node-- > 1;)
+    {
+      min_max_[node] = std::min(min_max_[2 * node], min_max_[2 * node + 1]);
+    }
+  }
+
+  bit_vector parens_;
+  size_t leaves_{1};
+  std::vector<int32_t> min_max_;
+  int64_t base_{};
+  packed_array values_;
+  packed_array by_value_;
+  std::vector<uint32_t> preorder_of_;
+  size_t size_{};
+};
@@ -0,0 +1,324 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <future>
+#include <algorithm>
+#include "trace.h"
+
+// A lazily started coroutine producing a T. It runs when co_awaited, and
+// resumes its awaiter when done, without going through any queue.
+template <typename T = void>
+class task;
+
+namespace task_detail
+{
+  struct promise_base
+  {
+    std::coroutine_handle<> continuation{std::noop_coroutine()};
+    std::exception_ptr error;
+    // the request being traced, handed down to awaited tasks
+    trace_span *trace{};
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter
+    {
+      bool await_ready() noexcept { return false; }
+      template <typename promise_t>
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_t> h) noexcept
+      {
+        return h.promise().continuation;
+      }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  template <typename T>
+  struct promise : promise_base
+  {
+    std::optional<T> value;
+
+    task<T> get_return_object();
+    void return_value(T v) { value.emplace(std::move(v)); }
+
+    T result()
+    {
+      if (error)
+        std::rethrow_exception(error);
+      return std::move(*value);
+    }
+  };
+
+  template <>
+  struct promise<void> : promise_base
+  {
+    task<void> get_return_object();
+    void return_void() {}
+
+    void result()
+    {
+      if (error)
+        std::rethrow_exception(error);
+    }
+  };
+}
+
+template <typename T>
+class task
+{
+public:
+  using promise_type = task_detail::promise<T>;
+  using value_type = T;
+
+  explicit task(std::coroutine_handle<promise_type> h) : handle_{h} {}
+  task(task &&other) noexcept : handle_{std::exchange(other.handle_, {})} {}
+  task(task const &) = delete;
+  task &operator=(task other) noexcept
+  {
+    std::swap(handle_, other.handle_);
+    return *this;
+  }
+
+  ~task()
+  {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  template <typename awaiting_promise_t>
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<awaiting_promise_t> awaiting) noexcept
+  {
+    if constexpr (std::is_base_of_v<task_detail::promise_base, awaiting_promise_t>)
+    {
+      handle_.promise().trace = awaiting.promise().trace;
+    }
+    handle_.promise().continuation = awaiting;
+    return handle_;
+  }
+
+  // Traces the task, and all it awaits, into span.
+  void trace(trace_span *span) { handle_.promise().trace = span; }
+
+  T await_resume() { return handle_.promise().result(); }
+
+private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+task<T> task_detail::promise<T>::get_return_object()
+{
+  return task<T>{std::coroutine_handle<promise<T>>::from_promise(*this)};
+}
+
+inline task<void> task_detail::promise<void>::get_return_object()
+{
+  return task<void>{std::coroutine_handle<promise<void>>::from_promise(*this)};
+}
+
+// co_await current_trace{} gives the span of the running task, if traced.
+struct current_trace
+{
+  trace_span *span{};
+
+  bool await_ready() const noexcept { return false; }
+  template <typename promise_t>
+  bool await_suspend(std::coroutine_handle<promise_t> h) noexcept
+  {
+    span = h.promise().trace;
+    return false;
+  }
+  trace_span *await_resume() const noexcept { return span; }
+};
+
+// Threads resuming coroutines that co_await schedule(), oldest first.
+class executor
+{
+public:
+  explicit executor(size_t threads = 1)
+  {
+    for (size_t i{}; i < std::max<size_t>(threads, 1); ++i)
+    {
+      threads_.emplace_back([this]
+                            { work(); });
+    }
+  }
+
+  executor(executor const &) = delete;
+  executor(executor &&) = delete;
+
+  ~executor()
+  {
+    {
+      std::lock_guard lock{mutex_};
+      stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto &t : threads_)
+    {
+      t.join();
+    }
+  }
+
+  size_t size() const { return threads_.size(); }
+
+  // The executor running the calling thread, if any.
+  static executor *current() { return current_; }
+
+  // Coroutines waiting to be resumed.
+  size_t backlog() const
+  {
+    std::lock_guard lock{mutex_};
+    return queue_.size();
+  }
+
+  struct schedule_awaiter
+  {
+    executor &owner;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) { owner.post(h); }
+    void await_resume() const noexcept {}
+  };
+
+  // co_await on it continues the coroutine on one of this executor's threads.
+  schedule_awaiter schedule() { return {*this}; }
+
+  void post(std::coroutine_handle<> h)
+  {
+    // notified under the lock: once h is queued it may run to the end of a
+    // caller that then destroys this executor
+    std::lock_guard lock{mutex_};
+    queue_.push_back(h);
+    ready_.notify_one();
+  }
+
+private:
+  void work()
+  {
+    current_ = this;
+    for (;;)
+    {
+      std::coroutine_handle<> h;
+      {
+        std::unique_lock lock{mutex_};
+        ready_.wait(lock, [this]
+                    { return stopping_ || !queue_.empty(); });
+        if (queue_.empty())
+        {
+          return;
+        }
+        h = queue_.front();
+        queue_.pop_front();
+      }
+      h.resume();
+    }
+  }
+
+  static inline thread_local executor *current_{};
+
+  mutable std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::coroutine_handle<>> queue_;
+  bool stopping_{};
+  std::vector<std::thread> threads_;
+};
+
+namespace task_detail
+{
+  // Owns itself: starts at once and frees its frame when it finishes.
+  struct detached
+  {
+    struct promise_type
+    {
+      detached get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+}
+
+// Runs t on ex without waiting for it; done(result, error) is called on
+// completion, with error set if t threw. The wait for a thread of ex counts
+// as queueing in the trace, if any.
+template <typename T, typename F>
+void spawn(executor &ex, task<T> t, F done, trace_span *trace = nullptr)
+{
+  t.trace(trace);
+  [](executor &ex, task<T> t, F done, trace_span *trace) -> task_detail::detached
+  {
+    auto const queued{trace ? trace_now_ns() : 0};
+    co_await ex.schedule();
+    if (trace)
+    {
+      trace->add(trace_phase::queue, trace_now_ns() - queued);
+    }
+    std::exception_ptr error;
+    if constexpr (std::is_void_v<T>)
+    {
+      try
+      {
+        co_await t;
+      }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+      done(error);
+    }
+    else
+    {
+      std::optional<T> result;
+      try
+      {
+        result.emplace(co_await t);
+      }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+      done(std::move(result), error);
+    }
+  }(ex, std::move(t), std::move(done), trace);
+}
+
+// Blocks the calling thread until t, run on ex, is done.
+template <typename T>
+T sync_wait(executor &ex, task<T> t)
+{
+  std::promise<T> result;
+  auto f{result.get_future()};
+  if constexpr (std::is_void_v<T>)
+  {
+    spawn(ex, std::move(t), [&result](std::exception_ptr error)
+          {
+            if (error)
+              result.set_exception(error);
+            else
+              result.set_value(); });
+  }
+  else
+  {
+    spawn(ex, std::move(t), [&result](std::optional<T> value, std::exception_ptr error)
+          {
+            if (error)
+              result.set_exception(error);
+            else
+              result.set_value(std::move(*value)); });
+  }
+  return f.get();
+}
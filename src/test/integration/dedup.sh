@@ -0,0 +1,14 @@
+#!/bin/bash
+echo finds a tree posted again
+TREE=`curl http://localhost:8080/tree -s -f -d '[5<10>15][5>7][13<15][11<13>14]'`
+AGAIN=`curl http://localhost:8080/tree -s -f -d '[5<10>15][5>7][13<15][11<13>14]'`
+REORDERED=`curl http://localhost:8080/tree -s -f -d '[11<13>14][13<15][5>7][5<10>15]'`
+FRESH=`curl http://localhost:8080/tree -s -f -H 'X-Tree-Dedup: off' -d '[5<10>15][5>7][13<15][11<13>14]'`
+
+if [ "$AGAIN" = "$TREE" ] && [ "$REORDERED" = "$TREE" ] && [ "$FRESH" != "$TREE" ]
+then
+  echo OK
+else
+  echo NOT OK
+  exit -1
+fi
@@ -0,0 +1,17 @@
+#!/bin/bash
+echo moves a tree by export and import
+TREE=`curl http://localhost:8080/tree -s -f -H 'X-Tree-Dedup: off' -d '[5<10>15][5>7][13<15][11<13>14]'`
+COPY=$((TREE + 100000))
+BINARY_COPY=$((TREE + 100001))
+curl http://localhost:8080/tree/$TREE/export -s -f | curl http://localhost:8080/tree/$COPY/import -s -f --data-binary @- > /dev/null
+curl http://localhost:8080/tree/$TREE/export/bin -s -f | curl http://localhost:8080/tree/$BINARY_COPY/import -s -f --data-binary @- > /dev/null
+DISTANCE=`curl http://localhost:8080/tree/$COPY/distance/7/14 -s`
+ANCESTOR=`curl http://localhost:8080/tree/$BINARY_COPY/common-ancestor/11/14 -s`
+
+if [ "$DISTANCE" = "5" ] && [ "$ANCESTOR" = "13" ]
+then
+  echo OK
+else
+  echo NOT OK
+  exit -1
+fi
@@ -0,0 +1,16 @@
+#!/bin/bash
+echo imports trees next to a running server
+IDS=`printf '[5<10>15][5>7][13<15][11<13>14]\n\n[1<2>3]\n' | build/common-ancestor-import`
+FIRST=`echo "$IDS" | head -1`
+SECOND=`echo "$IDS" | tail -1`
+ANCESTOR=`curl -s -f http://localhost:8080/tree/$FIRST/common-ancestor/11/7`
+OTHER=`curl -s -f http://localhost:8080/tree/$SECOND/common-ancestor/1/3`
+BAD=`printf '[1<2>3]\n[1<2\n' | build/common-ancestor-import 2>&1 >/dev/null`
+
+if [ "$ANCESTOR" = "10" ] && [ "$OTHER" = "2" ] && [ "$BAD" != "${BAD%line 2:*}" ]
+then
+  echo OK
+else
+  echo NOT OK
+  exit -1
+fi
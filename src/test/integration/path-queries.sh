@@ -0,0 +1,14 @@
+#!/bin/bash
+echo answers path queries
+TREE=`curl http://localhost:8080/tree -s -f -d '[5<10>15][5>7][13<15][11<13>14]'`
+DISTANCE=`curl http://localhost:8080/tree/$TREE/distance/7/14 -s`
+ANCESTOR=`curl http://localhost:8080/tree/$TREE/ancestor/14/2 -s`
+IS_ANCESTOR=`curl http://localhost:8080/tree/$TREE/is-ancestor/15/11 -s`
+
+if [ "$DISTANCE" = "5" ] && [ "$ANCESTOR" = "15" ] && [ "$IS_ANCESTOR" = "true" ]
+then
+  echo OK
+else
+  echo NOT OK
+  exit -1
+fi
@@ -2,8 +2,10 @@
 echo calculates ancestor correctly
 TREE=`curl http://localhost:8080/tree -s -f -d '[5<10>15][5>7][13<15][11<13>14]'`
 ANCESTOR=`curl http://localhost:8080/tree/$TREE/common-ancestor/11/14 -s`
+MANY=`curl http://localhost:8080/tree/$TREE/common-ancestor/11/14/7 -s`
+POSTED=`curl http://localhost:8080/tree/$TREE/common-ancestor -s -d '11,14,13'`
 
-if [ "$ANCESTOR" = "13" ]
+if [ "$ANCESTOR" = "13" ] && [ "$MANY" = "10" ] && [ "$POSTED" = "13" ]
 then
   echo OK
 else
@@ -0,0 +1,13 @@
+#!/bin/bash
+echo answers for trees posted to any worker
+for i in $(seq 1 20)
+do
+  TREE=`curl http://localhost:8080/tree -s -f -H 'X-Tree-Dedup: off' -d "[$i<100>200][150<200>$((300 + i))]"`
+  ANCESTOR=`curl http://localhost:8080/tree/$TREE/common-ancestor/$i/$((300 + i)) -s`
+  if [ "$ANCESTOR" != "100" ]
+  then
+    echo NOT OK
+    exit -1
+  fi
+done
+echo OK
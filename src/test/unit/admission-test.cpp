@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include <optional>
+#include <vector>
+#include "../../admission.h"
+
+namespace
+{
+  struct fake_clock
+  {
+    std::chrono::steady_clock::time_point now{};
+
+    admission_gate::clock_t get()
+    {
+      return [this]
+      { return now; };
+    }
+  };
+}
+
+TEST(admission_gate, sheds_beyond_the_in_flight_limit)
+{
+  admission_gate gate{{2}};
+  auto first{gate.admit(0)};
+  auto second{gate.admit(0)};
+  auto third{gate.admit(0)};
+  EXPECT_TRUE(first);
+  EXPECT_TRUE(second);
+  ASSERT_FALSE(third);
+  EXPECT_EQ(third.retry_after(), std::chrono::seconds{1});
+  {
+    auto const released{std::move(first)};
+  }
+  EXPECT_TRUE(gate.admit(0));
+  auto const stats{gate.current()};
+  EXPECT_EQ(stats.admitted, 3);
+  EXPECT_EQ(stats.shed, 1);
+  EXPECT_EQ(stats.in_flight, 1);
+}
+
+TEST(admission_gate, counts_bytes_in_flight)
+{
+  admission_gate gate{{SIZE_MAX, 100}};
+  // alone, a body over the limit is still taken
+  auto const big{gate.admit(500)};
+  EXPECT_TRUE(big);
+  EXPECT_FALSE(gate.admit(1));
+  EXPECT_EQ(gate.current().bytes, 500);
+}
+
+TEST(admission_gate, sheds_while_over_the_latency_target)
+{
+  fake_clock clock;
+  admission_gate gate{{SIZE_MAX, SIZE_MAX, std::chrono::milliseconds{100}}, clock.get()};
+  for (int i{}; i < 20; ++i)
+  {
+    auto const slow{gate.admit(0)};
+    clock.now += std::chrono::milliseconds{2500};
+  }
+  EXPECT_GT(gate.current().latency, std::chrono::milliseconds{100});
+
+  std::optional<admission_gate::ticket> running{gate.admit(0)};
+  // taken, as nothing else was under way
+  EXPECT_TRUE(*running);
+  auto const refused{gate.admit(0)};
+  ASSERT_FALSE(refused);
+  EXPECT_GE(refused.retry_after(), std::chrono::seconds{2});
+
+  // fast work brings the average back on target
+  running.reset();
+  for (int i{}; i < 40; ++i)
+  {
+    auto const fast{gate.admit(0)};
+    clock.now += std::chrono::milliseconds{1};
+  }
+  auto const busy{gate.admit(0)};
+  EXPECT_TRUE(gate.admit(0));
+  EXPECT_EQ(gate.current().json().find("\"in_flight\":1,"), 1);
+}
+
+TEST(admission_gate, untimed_work_counts_but_leaves_latency_alone)
+{
+  fake_clock clock;
+  admission_gate gate{{2, SIZE_MAX, std::chrono::milliseconds{100}}, clock.get()};
+  {
+    auto stream{gate.admit(0)};
+    stream.untimed();
+    EXPECT_EQ(gate.current().in_flight, 1);
+    clock.now += std::chrono::minutes{1};
+  }
+  EXPECT_EQ(gate.current().in_flight, 0);
+  EXPECT_EQ(gate.current().latency, std::chrono::microseconds{0});
+}
@@ -0,0 +1,284 @@
+#include <gtest/gtest.h>
+#include "../../async-tree-controller.h"
+#include "mem-adapter.h"
+
+namespace
+{
+  using async_mem_adapter = async_adapter<mem_adapter>;
+  using controller_t = async_tree_controller<async_mem_adapter>;
+
+  template <typename controller = controller_t>
+  typename controller::translator_t translator()
+  {
+    return {[](size_t id)
+            { return "123-" + std::to_string(id); },
+            [](std::string const &src)
+            { return static_cast<size_t>(std::atol(src.c_str())); }};
+  }
+
+  // fails the second page it is given
+  struct failing_adapter : mem_adapter
+  {
+    int pages{};
+
+    template <typename T>
+    void add_nodes(tree_key_t tree_id, std::vector<T> const &nodes)
+    {
+      if (++pages == 2)
+        throw std::runtime_error("Disk full.");
+      mem_adapter::add_nodes(tree_id, nodes);
+    }
+  };
+  using failing_controller = async_tree_controller<async_adapter<failing_adapter>>;
+}
+
+TEST(async_tree_controller, post_and_query)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, translator()};
+
+  auto const tree_id{sync_wait(compute, controller.post_tree(std::string{"[5<10>15][5>7][13<15][11<13>14]"}))};
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(tree_id, {11, 14})), 13);
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(tree_id, {7, 11, 14})), 10);
+  EXPECT_EQ(sync_wait(compute, controller.distance(tree_id, 7, 14)), 5);
+  EXPECT_EQ(sync_wait(compute, controller.ancestor(tree_id, 14, 2)), 15);
+  EXPECT_TRUE(sync_wait(compute, controller.is_ancestor(tree_id, 15, 11)));
+  EXPECT_THROW(sync_wait(compute, controller.common_ancestor(tree_id, {11, 99})), std::runtime_error);
+}
+
+TEST(async_tree_controller, requests)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, translator()};
+
+  auto const id{sync_wait(compute, controller.post_tree(controller_t::request{"/tree", "[5<10>15][13<15][11<13>14]"}))};
+  ASSERT_EQ(id.substr(0, 4), "123-");
+  auto const tree{id.substr(4)};
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(controller_t::request{"/tree/" + tree + "/common-ancestor/11/14", ""})), "13");
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(controller_t::request{"/tree/" + tree + "/common-ancestor", "5,11,14"})), "10");
+  EXPECT_EQ(sync_wait(compute, controller.is_ancestor(controller_t::request{"/tree/" + tree + "/is-ancestor/11/15", ""})), "false");
+  EXPECT_THROW(sync_wait(compute, controller.post_tree(controller_t::request{"/tree", "[1<2<3]"})), std::runtime_error);
+}
+
+TEST(async_tree_controller, answers_for_trees_built_in_storage)
+{
+  mem_adapter adapter;
+  auto const tree_id{adapter.new_tree()};
+  auto const left_id{adapter.ensure_node(tree_id, 10)};
+  auto const center_id{adapter.ensure_node(tree_id, 20)};
+  auto const right_id{adapter.ensure_node(tree_id, 30)};
+  adapter.bind_left(center_id, left_id);
+  adapter.bind_right(center_id, right_id);
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, translator()};
+
+  auto const uri{"/tree/" + std::to_string(tree_id) + "/common-ancestor/10/30"};
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(controller_t::request{uri, ""})), "20");
+}
+
+TEST(async_tree_controller, path_query_requests)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, translator()};
+
+  auto const id{sync_wait(compute, controller.post_tree(controller_t::request{"/tree", "[5<10>15][5>7][13<15][11<13>14]"}))};
+  auto const query = [&](std::string const &operation, auto handler)
+  {
+    return sync_wait(compute, handler(controller_t::request{"/tree/" + id.substr(4) + "/" + operation, ""}));
+  };
+  EXPECT_EQ(query("distance/7/14", [&](auto r)
+                  { return controller.distance(std::move(r)); }),
+            "5");
+  EXPECT_EQ(query("ancestor/14/2", [&](auto r)
+                  { return controller.ancestor(std::move(r)); }),
+            "15");
+  EXPECT_EQ(query("is-ancestor/15/11", [&](auto r)
+                  { return controller.is_ancestor(std::move(r)); }),
+            "true");
+  EXPECT_EQ(query("common-ancestor/11/14/13", [&](auto r)
+                  { return controller.common_ancestor(std::move(r)); }),
+            "13");
+}
+
+TEST(async_tree_controller, succinct_trees)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, translator(), 0};
+
+  auto const tree_id{sync_wait(compute, controller.post_tree(std::string{"[5<10>15][5>7][13<15][11<13>14]"}))};
+  EXPECT_EQ(sync_wait(compute, controller.distance(tree_id, 7, 14)), 5);
+  EXPECT_EQ(sync_wait(compute, controller.ancestor(tree_id, 14, 2)), 15);
+  EXPECT_TRUE(sync_wait(compute, controller.is_ancestor(tree_id, 15, 11)));
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(tree_id, {11, 14, 7})), 10);
+}
+
+TEST(async_tree_controller, refuses_what_isnt_a_tree)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, translator()};
+
+  EXPECT_THROW(sync_wait(compute, controller.post_tree(std::string{"[1<2>3][2<1]"})), std::runtime_error);
+  EXPECT_THROW(sync_wait(compute, controller.post_tree(std::string{"[1<2][1<3]"})), std::runtime_error);
+  EXPECT_THROW(sync_wait(compute, controller.post_tree(controller_t::request{"/tree", "[1<2][3<4]"})), std::runtime_error);
+  EXPECT_THROW(sync_wait(compute, controller.import_tree(controller_t::request{"/tree/7/import", "[1<2>3][2<1]"})), std::runtime_error);
+  // nothing was stored
+  EXPECT_EQ(sync_wait(compute, controller.post_tree(std::string{"[1<2>3]"})), 0);
+
+  // as a tree stored before they were checked could be
+  auto const looped{adapter.new_tree()};
+  auto const one{adapter.ensure_node(looped, 1)}, two{adapter.ensure_node(looped, 2)}, three{adapter.ensure_node(looped, 3)};
+  adapter.bind_left(one, two);
+  adapter.bind_left(two, one);
+  adapter.bind_right(two, three);
+  EXPECT_THROW(sync_wait(compute, controller.common_ancestor(looped, {1, 2})), std::runtime_error);
+  EXPECT_THROW(sync_wait(compute, controller.common_ancestor(looped, {3, 1})), std::runtime_error);
+}
+
+TEST(async_tree_controller, requests_overlap)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{4};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, translator()};
+  auto const tree_id{sync_wait(compute, controller.post_tree(std::string{"[1<2>3][4<1>5][6<3>7]"}))};
+
+  std::atomic<int> remaining{500}, correct{};
+  std::promise<void> all_done;
+  for (int i{}; i < 500; ++i)
+  {
+    spawn(compute, controller.common_ancestor(tree_id, {4, 7}), [&](std::optional<int> v, std::exception_ptr)
+          {
+            if (v == 2)
+              ++correct;
+            if (--remaining == 0)
+              all_done.set_value(); });
+  }
+  all_done.get_future().wait();
+  EXPECT_EQ(correct, 500);
+}
+
+TEST(async_tree_controller, export_and_import)
+{
+  mem_adapter source_adapter, target_adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter source_data{source_adapter, io, compute}, target_data{target_adapter, io, compute};
+  controller_t source{source_data, translator()}, target{target_data, translator()};
+
+  // a chain long enough for three pages
+  std::string text;
+  for (int i{1}; i < 9000; ++i)
+  {
+    text += "[" + std::to_string(i + 1) + "<" + std::to_string(i) + "]";
+  }
+  auto const tree_id{sync_wait(compute, source.post_tree(text))};
+  auto const uri{"/tree/" + std::to_string(tree_id)};
+
+  for (auto format : {tree_format::text, tree_format::binary})
+  {
+    auto const cursor{source.start_export(controller_t::request{uri + "/export", {}}, format)};
+    std::string exported;
+    int chunks{};
+    while (!cursor->finished)
+    {
+      exported += sync_wait(compute, source.export_chunk(cursor));
+      ++chunks;
+    }
+    EXPECT_EQ(chunks, 3);
+
+    auto const imported_id{std::to_string(tree_id + (format == tree_format::text ? 5 : 6))};
+    EXPECT_EQ(sync_wait(compute, target.import_tree(controller_t::request{"/tree/" + imported_id + "/import", exported})), "123-" + imported_id);
+    EXPECT_EQ(sync_wait(compute, target.distance(std::stoul(imported_id), 1, 9000)), 8999);
+    EXPECT_EQ(sync_wait(compute, target.common_ancestor(std::stoul(imported_id), {9000, 5000, 5})), 5);
+    EXPECT_THROW(sync_wait(compute, target.import_tree(controller_t::request{"/tree/" + imported_id + "/import", exported})), std::runtime_error);
+  }
+  EXPECT_THROW(sync_wait(compute, target.import_tree(controller_t::request{"/tree/1/import", "[1<2<3]"})), std::runtime_error);
+  EXPECT_THROW(sync_wait(compute, source.export_chunk(source.start_export(controller_t::request{"/tree/99/export", {}}, tree_format::text))), std::runtime_error);
+}
+
+TEST(async_tree_controller, drops_an_import_that_fails)
+{
+  failing_adapter adapter;
+  executor io{1}, compute{2};
+  async_adapter<failing_adapter> async_data{adapter, io, compute};
+  failing_controller controller{async_data, translator<failing_controller>()};
+
+  std::string text;
+  for (int i{1}; i < 9000; ++i)
+  {
+    text += "[" + std::to_string(i + 1) + "<" + std::to_string(i) + "]";
+  }
+  failing_controller::request const import{"/tree/7/import", text};
+  EXPECT_THROW(sync_wait(compute, controller.import_tree(import)), std::runtime_error);
+  // the id is free again
+  EXPECT_EQ(sync_wait(compute, controller.import_tree(import)), "123-7");
+  EXPECT_EQ(sync_wait(compute, controller.distance(7, 1, 9000)), 8999);
+}
+
+TEST(async_tree_controller, drops_a_post_that_fails)
+{
+  failing_adapter adapter;
+  executor io{1}, compute{2};
+  async_adapter<failing_adapter> async_data{adapter, io, compute};
+  failing_controller controller{async_data, translator<failing_controller>()};
+
+  std::string text;
+  for (int i{1}; i < 9000; ++i)
+  {
+    text += "[" + std::to_string(i + 1) + "<" + std::to_string(i) + "]";
+  }
+  EXPECT_THROW(sync_wait(compute, controller.post_tree(text)), std::runtime_error);
+  EXPECT_EQ(adapter.str(), "");
+  EXPECT_EQ(sync_wait(compute, controller.post_tree(text)), 0);
+}
+
+TEST(async_tree_controller, finds_trees_posted_again)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, translator()};
+
+  auto const post = [&](std::string body, bool deduplicate = true)
+  { return sync_wait(compute, controller.post_tree(controller_t::request{"/tree", std::move(body), deduplicate})); };
+  auto const id{post("[5<10>15][13<15][11<13>14]")};
+  EXPECT_EQ(post("[5<10>15][13<15][11<13>14]"), id);
+  EXPECT_EQ(post("[11<13>14][13<15][5<10>15]"), id);
+  EXPECT_NE(post("[5<10>15][13<15][11<13>14]", false), id);
+  EXPECT_NE(post("[5<10>15][13<15][11<13>16]"), id);
+  EXPECT_THROW(post("[1<2<3]"), std::runtime_error);
+
+  // a hash that another tree has is not taken at its word
+  std::vector<tree_parser::triplet> other;
+  tree_parser::parse("[1<2>3]", [&other](auto node)
+                     { other.push_back(node); });
+  adapter.remember_tree_hash(canonical_tree_hash(other), std::stoul(id.substr(4)));
+  auto const other_id{post("[1<2>3]")};
+  EXPECT_NE(other_id, id);
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(std::stoul(other_id.substr(4)), {1, 3})), 2);
+}
+
+TEST(async_tree_controller, storage_calls_come_back_to_the_callers_executor)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2}, ingest{1};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, translator()};
+
+  auto const posted = [&]() -> task<executor *>
+  {
+    co_await controller.post_tree(std::string{"[1<2>3]"});
+    co_return executor::current();
+  };
+  EXPECT_EQ(sync_wait(ingest, posted()), &ingest);
+}
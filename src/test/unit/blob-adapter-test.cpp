@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include "../../blob-adapter.h"
+#include "../../tree.h"
+#include "../../async-tree-controller.h"
+
+namespace
+{
+  // a fresh database per test
+  std::string database(std::string const &name)
+  {
+    auto const file{"trees-blob-" + name + ".db"};
+    for (auto const suffix : {"", "-wal", "-shm"})
+    {
+      std::remove((file + suffix).c_str());
+    }
+    return file;
+  }
+}
+
+TEST(packed_tree, round_trips)
+{
+  packed_tree t;
+  t.values = {20, 10, 30, -5};
+  t.parents = {flat_tree::none, 0, 0, 1};
+  t.sides = {packed_tree::root, packed_tree::left, packed_tree::right, packed_tree::left};
+  auto const body{t.encode()};
+  EXPECT_EQ(body.substr(0, 4), "TRPK");
+  // header, values, parents, sides, order
+  EXPECT_EQ(body.size(), 16 + 16 + 16 + 4 + 16);
+  auto const back{packed_tree::decode(body)};
+  EXPECT_EQ(back.values, t.values);
+  EXPECT_EQ(back.parents, t.parents);
+  EXPECT_EQ(back.sides, t.sides);
+  EXPECT_EQ(back.by_value, (std::vector<int32_t>{3, 1, 0, 2}));
+  EXPECT_EQ(back.find(30), 2);
+  EXPECT_EQ(back.find(25), flat_tree::none);
+}
+
+TEST(packed_tree, rejects_what_it_did_not_write)
+{
+  packed_tree t;
+  t.values = {1, 2};
+  t.parents = {flat_tree::none, 0};
+  t.sides = {packed_tree::root, packed_tree::right};
+  auto const body{t.encode()};
+  EXPECT_THROW(packed_tree::decode(body.substr(0, body.size() - 1)), std::runtime_error);
+  EXPECT_THROW(packed_tree::decode("TRB"), std::runtime_error);
+  auto newer{body};
+  newer[4] = 2;
+  EXPECT_THROW(packed_tree::decode(newer), std::runtime_error);
+  auto bad_parent{body};
+  bad_parent[16 + 8 + 4] = 7;
+  EXPECT_THROW(packed_tree::decode(bad_parent), std::runtime_error);
+}
+
+TEST(packed_tree, rejects_sides_that_do_not_fit_the_parents)
+{
+  auto const decoded = [](std::vector<int32_t> parents, std::vector<uint8_t> sides)
+  {
+    packed_tree t;
+    t.values = {1, 2, 3};
+    t.parents = std::move(parents);
+    t.sides = std::move(sides);
+    return packed_tree::decode(t.encode());
+  };
+  using enum packed_tree::side;
+  EXPECT_NO_THROW(decoded({flat_tree::none, 0, 0}, {root, left, right}));
+  // a root on a side would have loaded_tree write before its arrays
+  EXPECT_THROW(decoded({flat_tree::none, 0, 0}, {left, left, right}), std::runtime_error);
+  // a child without a side
+  EXPECT_THROW(decoded({flat_tree::none, 0, 0}, {root, root, right}), std::runtime_error);
+  // two children on one side
+  EXPECT_THROW(decoded({flat_tree::none, 0, 0}, {root, left, left}), std::runtime_error);
+}
+
+TEST(blob_adapter, refuses_a_second_parent)
+{
+  blob_adapter data{database("parents")};
+  auto const tree_id{data.new_tree()};
+  auto const one{data.ensure_node(tree_id, 1)}, two{data.ensure_node(tree_id, 2)}, three{data.ensure_node(tree_id, 3)};
+  data.bind_left(two, one);
+  data.bind_left(two, one);
+  EXPECT_THROW(data.bind_right(two, one), std::runtime_error);
+  EXPECT_THROW(data.bind_left(three, one), std::runtime_error);
+}
+
+TEST(blob_adapter, stores_trees_whole)
+{
+  auto const file{database("whole")};
+  std::string tree_id;
+  {
+    blob_adapter data{file};
+    tree_id = tree<std::string>::parse(data, "[5<10>15][5>7][13<15][11<13>14]").id();
+    EXPECT_EQ(tree<std::string>{tree_id}.find_common_ancestor(data, 11, 14), 13);
+    EXPECT_THROW(data.ensure_node(tree_id, 99), std::runtime_error);
+    EXPECT_THROW(data.get_id_by_value(tree_id, 99), std::runtime_error);
+  }
+  // and reads them back after a restart
+  blob_adapter data{file};
+  EXPECT_EQ(tree<std::string>{tree_id}.find_common_ancestor(data, 7, 14), 10);
+  auto const flat{data.flatten(tree_id)};
+  ASSERT_EQ(flat.size(), 7);
+  EXPECT_EQ(tree_index{flat}.distance(7, 14), 5);
+  std::vector<std::tuple<int, std::optional<int>, std::optional<int>>> rows;
+  data.visit_nodes(tree_id, [&rows](int value, auto left, auto right)
+                   { rows.emplace_back(value, left, right); });
+  std::sort(rows.begin(), rows.end());
+  EXPECT_EQ(rows.front(), std::make_tuple(5, std::optional<int>{}, std::optional<int>{7}));
+  EXPECT_EQ(rows[2], std::make_tuple(10, std::optional<int>{5}, std::optional<int>{15}));
+  EXPECT_NE(data.new_tree(), tree_id);
+}
+
+TEST(blob_adapter, shares_the_file_between_processes)
+{
+  auto const file{database("shared")};
+  // as two worker processes would, each with its own connection
+  blob_adapter one{file}, other{file};
+  auto const first{one.new_tree()};
+  auto const second{other.new_tree()};
+  EXPECT_NE(first, second);
+  EXPECT_THROW(other.create_tree(first), std::runtime_error);
+
+  one.add_nodes(first, {{5, 10, 15}});
+  // not there until committed
+  EXPECT_THROW(other.get_id_by_value(first, 10), std::runtime_error);
+  one.commit_tree(first);
+  auto const root{other.get_id_by_value(first, 10)};
+  EXPECT_EQ(other.get_value_by_id(other.get_parent_by_id(other.get_id_by_value(first, 15))), 10);
+  EXPECT_EQ(other.get_value_by_id(root), 10);
+}
+
+TEST(blob_adapter, pages_through_nodes_by_value)
+{
+  blob_adapter data{database("pages")};
+  data.create_tree("1000");
+  EXPECT_THROW(data.create_tree("1000"), std::runtime_error);
+  data.add_nodes("1000", {{30, 40, 50}, {{}, 50, 60}, {10, 20, {}}});
+  data.commit_tree("1000");
+  EXPECT_THROW(data.create_tree("1000"), std::runtime_error);
+  EXPECT_THROW(data.add_nodes("1000", {{{}, 70, {}}}), std::runtime_error);
+  std::vector<int> values;
+  std::optional<int> after;
+  for (;;)
+  {
+    size_t count{};
+    data.visit_nodes_after("1000", after, 2, [&](int value, auto, auto)
+                           { values.push_back(value); after = value; ++count; });
+    if (count < 2)
+      break;
+  }
+  EXPECT_EQ(values, (std::vector<int>{10, 20, 30, 40, 50, 60}));
+  EXPECT_EQ(data.flatten("2000").size(), 0);
+  EXPECT_EQ(std::stoi(data.new_tree()), 1001);
+}
+
+TEST(blob_adapter, serves_the_async_controller)
+{
+  blob_adapter data{database("async")};
+  executor io{1}, compute{2};
+  async_adapter<blob_adapter> async_data{data, io, compute};
+  async_tree_controller<async_adapter<blob_adapter>> controller{async_data, {[](std::string const &id)
+                                                                              { return id; },
+                                                                              [](std::string const &id)
+                                                                              { return id; }}};
+  auto const tree_id{sync_wait(compute, controller.post_tree(std::string{"[5<10>15][13<15][11<13>14]"}))};
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(tree_id, {11, 14})), 13);
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(tree_id, {5, 11, 14})), 10);
+  EXPECT_EQ(sync_wait(compute, controller.distance(tree_id, 5, 14)), 4);
+
+  using controller_t = async_tree_controller<async_adapter<blob_adapter>>;
+  auto const cursor{controller.start_export(controller_t::request{"/tree/" + tree_id + "/export", ""}, tree_format::binary)};
+  std::string exported;
+  while (!cursor->finished)
+  {
+    exported += sync_wait(compute, controller.export_chunk(cursor));
+  }
+  EXPECT_EQ(sync_wait(compute, controller.import_tree(controller_t::request{"/tree/77/import", exported})), "77");
+  EXPECT_EQ(sync_wait(compute, controller.ancestor("77", 14, 3)), 10);
+}
+
+TEST(blob_adapter, reads_through_a_connection_of_its_own)
+{
+  auto const file{database("split")};
+  blob_adapter writer{file}, reader{file};
+  executor io{1}, read_io{1}, compute{2};
+  async_adapter<blob_adapter> writes{writer, io, compute}, reads{reader, read_io, compute};
+  read_write_repo<async_adapter<blob_adapter>> data{writes, reads};
+  using controller_t = async_tree_controller<read_write_repo<async_adapter<blob_adapter>>>;
+  controller_t controller{data, {[](std::string const &id)
+                                 { return id; },
+                                 [](std::string const &id)
+                                 { return id; }}};
+  auto const tree_id{sync_wait(compute, controller.post_tree(controller_t::request{"/tree", "[5<10>15][13<15][11<13>14]"}))};
+  // found again by the reader
+  EXPECT_EQ(sync_wait(compute, controller.post_tree(controller_t::request{"/tree", "[11<13>14][13<15][5<10>15]"})), tree_id);
+
+  // queries get through while the writer is busy
+  std::promise<void> release;
+  spawn(io, [](std::future<void> busy) -> task<void>
+        { busy.wait(); co_return; }(release.get_future()),
+        [](std::exception_ptr) {});
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(tree_id, {11, 14})), 13);
+  EXPECT_EQ(sync_wait(compute, controller.distance(tree_id, 5, 14)), 4);
+  release.set_value();
+}
@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../../capture.h"
+
+namespace
+{
+  std::string const path{"capture-test.trcp"};
+
+  std::string contents()
+  {
+    std::ifstream in{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{in}, {}};
+  }
+
+  std::vector<captured_request> read_all(std::string_view data)
+  {
+    std::vector<captured_request> requests;
+    read_capture(data, [&requests](captured_request r)
+                 { requests.push_back(std::move(r)); });
+    return requests;
+  }
+}
+
+TEST(capture, reads_back_what_was_recorded)
+{
+  {
+    capture_writer capture{path};
+    capture.record("POST", "/tree", "[1<2>3]", captured_request::dedup_off);
+    capture.record("GET", "/tree/1/common-ancestor/1/3", {});
+    EXPECT_EQ(capture.current().records, 2);
+  }
+  auto const requests{read_all(contents())};
+  std::remove(path.c_str());
+  ASSERT_EQ(requests.size(), 2);
+  EXPECT_EQ(requests[0].method, "POST");
+  EXPECT_EQ(requests[0].uri, "/tree");
+  EXPECT_EQ(requests[0].flags, captured_request::dedup_off);
+  EXPECT_EQ(requests[0].body_kind, capture_body::whole);
+  EXPECT_EQ(requests[0].body, "[1<2>3]");
+  EXPECT_EQ(requests[1].method, "GET");
+  EXPECT_EQ(requests[1].uri, "/tree/1/common-ancestor/1/3");
+  EXPECT_EQ(requests[1].body_kind, capture_body::none);
+  EXPECT_LE(requests[0].arrival, requests[1].arrival);
+}
+
+TEST(capture, keeps_only_the_hash_of_bodies_when_asked)
+{
+  {
+    capture_writer capture{path, {.bodies = false}};
+    capture.record("POST", "/tree", "[1<2>3]");
+  }
+  auto const requests{read_all(contents())};
+  std::remove(path.c_str());
+  ASSERT_EQ(requests.size(), 1);
+  EXPECT_EQ(requests[0].body_kind, capture_body::hash);
+  EXPECT_EQ(requests[0].body_length, 7);
+  EXPECT_EQ(requests[0].body_hash, xxh64("[1<2>3]"));
+  EXPECT_TRUE(requests[0].body.empty());
+}
+
+TEST(capture, drops_requests_beyond_its_size)
+{
+  {
+    capture_writer capture{path, {.max_bytes = 64}};
+    capture.record("POST", "/tree", "[1<2>3]");
+    capture.record("POST", "/tree", std::string(100, ' '));
+    EXPECT_EQ(capture.current().records, 1);
+    EXPECT_EQ(capture.current().dropped, 1);
+    EXPECT_NE(capture.current().json().find("\"dropped\":1"), std::string::npos);
+  }
+  EXPECT_EQ(read_all(contents()).size(), 1);
+  std::remove(path.c_str());
+}
+
+TEST(capture, leaves_out_a_partial_record)
+{
+  {
+    capture_writer capture{path};
+    capture.record("POST", "/tree", "[1<2>3]");
+    capture.record("POST", "/tree", "[4<5>6]");
+  }
+  auto const data{contents()};
+  std::remove(path.c_str());
+  EXPECT_EQ(read_all(std::string_view{data}.substr(0, data.size() - 3)).size(), 1);
+}
+
+TEST(capture, reads_back_the_answers_to_requests)
+{
+  {
+    capture_writer capture{path};
+    EXPECT_EQ(capture.record("POST", "/tree", "[1<2>3]"), 0);
+    EXPECT_EQ(capture.record("POST", "/tree", "[4<5>6]"), 1);
+    capture.respond(1, "17");
+    capture.respond(0, "16");
+    EXPECT_EQ(capture.current().records, 2);
+  }
+  std::vector<captured_response> responses;
+  read_capture(contents(), [](captured_request) {}, [&responses](captured_response r)
+               { responses.push_back(std::move(r)); });
+  std::remove(path.c_str());
+  ASSERT_EQ(responses.size(), 2);
+  EXPECT_EQ(responses[0].request, 1);
+  EXPECT_EQ(responses[0].body, "17");
+  EXPECT_EQ(responses[1].request, 0);
+  EXPECT_EQ(responses[1].body, "16");
+}
+
+TEST(capture, reads_captures_of_the_first_version)
+{
+  std::string data{"TRCP\x01\0\0\0", 8};
+  // arrival, flags, GET, /tree/1/common-ancestor/1/3, no body
+  data += std::string(9, '\0') + "\x03GET" + std::string{"\x1b\0", 2} + "/tree/1/common-ancestor/1/3" + '\0';
+  auto const requests{read_all(data)};
+  ASSERT_EQ(requests.size(), 1);
+  EXPECT_EQ(requests[0].method, "GET");
+  EXPECT_EQ(requests[0].uri, "/tree/1/common-ancestor/1/3");
+}
+
+TEST(capture, refuses_what_isnt_a_capture)
+{
+  EXPECT_THROW(read_all("[1<2>3]"), std::runtime_error);
+  EXPECT_THROW(read_all("TR"), std::runtime_error);
+  EXPECT_THROW(read_all(std::string{"TRCP\x03\0\0\0", 8}), std::runtime_error);
+  EXPECT_EQ(read_all(std::string{"TRCP\x02\0\0\0", 8}).size(), 0);
+}
+
+TEST(capture, replays_with_the_ids_trees_get_again)
+{
+  // posts answered with 7 and 9, a query of each, one of a tree from before
+  replay_ids ids{{"7", std::nullopt, "9", std::nullopt, std::nullopt}};
+  EXPECT_EQ(ids.map("/tree", 0), "/tree");
+  EXPECT_EQ(ids.map("/tree/4/common-ancestor/7/9", 4), "/tree/4/common-ancestor/7/9");
+  ids.answered(0, "1");
+  EXPECT_EQ(ids.map("/tree/7/common-ancestor/7/9", 1), "/tree/1/common-ancestor/7/9");
+  // a query overtaking the post it needs waits for it
+  std::thread post{[&ids]
+                   {
+                     std::this_thread::sleep_for(std::chrono::milliseconds{10});
+                     ids.answered(2, "2");
+                   }};
+  EXPECT_EQ(ids.map("/tree/9?x=1", 3), "/tree/2?x=1");
+  post.join();
+}
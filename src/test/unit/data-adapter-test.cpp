@@ -1,15 +1,163 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
 #include "../../data-adapter.h"
+#include "../../blob-adapter.h"
+#include "../../log-adapter.h"
+#include "../../async-repo.h"
 
-TEST(data_adapter, will_construct_simple_trees) {
-  data_adapter data;
-  auto tree {data.new_tree()};
-  auto first_node{data.ensure_node(tree, 20)};
-  auto left_node{data.ensure_node(tree, 10)};
-  auto right_node{data.ensure_node(tree, 30)};
-  data.bind_left(first_node, left_node);
-  data.bind_right(first_node, right_node);
-  EXPECT_EQ(data.get_parent_by_id(left_node), first_node);
-  EXPECT_EQ(data.get_parent_by_id(right_node), first_node);
-  EXPECT_EQ(data.get_parent_by_id(first_node), std::string());
+namespace
+{
+  // a fresh database, rather than what the last run stored
+  std::string database(std::string const &file)
+  {
+    for (auto const suffix : {"", "-wal", "-shm"})
+    {
+      std::remove((file + suffix).c_str());
+    }
+    return file;
+  }
+}
+
+// What every repo_t does alike, whichever way it stores trees.
+template <typename repo_t>
+class repo : public ::testing::Test
+{
+protected:
+  // Each call opens the same storage again, as after a restart.
+  std::unique_ptr<repo_t> open()
+  {
+    if constexpr (std::is_same_v<repo_t, data_adapter>)
+      return std::make_unique<repo_t>("trees-typed.db");
+    else if constexpr (std::is_same_v<repo_t, blob_adapter>)
+      return std::make_unique<repo_t>("trees-blob-typed.db");
+    else
+      return std::make_unique<repo_t>("trees-log-typed");
+  }
+
+  void SetUp() override
+  {
+    database("trees-typed.db");
+    database("trees-blob-typed.db");
+    std::filesystem::remove_all("trees-log-typed");
+  }
+};
+
+using repo_types = ::testing::Types<data_adapter, blob_adapter, log_adapter>;
+TYPED_TEST_SUITE(repo, repo_types);
+
+TYPED_TEST(repo, will_construct_simple_trees) {
+  auto data{this->open()};
+  auto tree {data->new_tree()};
+  auto first_node{data->ensure_node(tree, 20)};
+  auto left_node{data->ensure_node(tree, 10)};
+  auto right_node{data->ensure_node(tree, 30)};
+  data->bind_left(first_node, left_node);
+  data->bind_right(first_node, right_node);
+  EXPECT_EQ(data->get_parent_by_id(left_node), first_node);
+  EXPECT_EQ(data->get_parent_by_id(right_node), first_node);
+  EXPECT_EQ(data->get_parent_by_id(first_node), typename TypeParam::node_key_t());
+}
+
+TYPED_TEST(repo, visits_every_node) {
+  auto data{this->open()};
+  auto tree {data->new_tree()};
+  auto root{data->ensure_node(tree, 20)};
+  data->bind_left(root, data->ensure_node(tree, 10));
+  if constexpr (committing_repo<TypeParam>)
+    data->commit_tree(tree);
+  flat_tree flat;
+  data->visit_nodes(tree, [&flat](int value, auto left, auto right){ flat.add(value, left, right); });
+  ASSERT_EQ(flat.size(), 2);
+  tree_index index{flat};
+  EXPECT_EQ(index.common_ancestor(10, 20), 20);
+}
+
+TYPED_TEST(repo, stores_trees_for_good) {
+  std::string tree_id;
+  {
+    auto data{this->open()};
+    tree_id = tree<std::string>::parse(*data, "[5<10>15][5>7][13<15][11<13>14]").id();
+    EXPECT_EQ(tree<std::string>{tree_id}.find_common_ancestor(*data, 11, 14), 13);
+  }
+  auto data{this->open()};
+  EXPECT_EQ(tree<std::string>{tree_id}.find_common_ancestor(*data, 7, 14), 10);
+  flat_tree flat;
+  data->visit_nodes(tree_id, [&flat](int value, auto left, auto right){ flat.add(value, left, right); });
+  EXPECT_EQ(tree_index{flat}.distance(7, 14), 5);
+  EXPECT_NE(data->new_tree(), tree_id);
+}
+
+TYPED_TEST(repo, pages_through_nodes_by_value) {
+  auto data{this->open()};
+  auto const tree_id{std::to_string(std::stoi(data->new_tree()) + 1000)};
+  data->create_tree(tree_id);
+  EXPECT_THROW(data->create_tree(tree_id), std::runtime_error);
+  data->add_nodes(tree_id, {{30, 40, 50}, {{}, 50, 60}, {10, 20, {}}});
+  if constexpr (committing_repo<TypeParam>)
+    data->commit_tree(tree_id);
+  for (size_t const limit : {2, 4})
+  {
+    std::vector<int> values;
+    std::optional<int> after;
+    for (;;) {
+      size_t count{};
+      data->visit_nodes_after(tree_id, after, limit, [&](int value, auto, auto){ values.push_back(value); after = value; ++count; });
+      if (count < limit)
+        break;
+    }
+    EXPECT_EQ(values, (std::vector<int>{10, 20, 30, 40, 50, 60}));
+  }
+}
+
+TYPED_TEST(repo, remembers_trees_by_hash) {
+  auto const hash{0x0123456789abcdefULL + std::hash<std::string>{}(typeid(TypeParam).name())};
+  std::string tree_id;
+  {
+    auto data{this->open()};
+    tree_id = tree<std::string>::parse(*data, "[1<2>3]").id();
+    EXPECT_FALSE(data->find_tree_by_hash(hash).has_value());
+    data->remember_tree_hash(hash, tree_id);
+    data->remember_tree_hash(hash, tree<std::string>::parse(*data, "[1<2>3]").id());
+  }
+  EXPECT_EQ(this->open()->find_tree_by_hash(hash), tree_id);
+}
+
+TYPED_TEST(repo, stores_trees_in_bulk) {
+  std::vector<std::string> ids;
+  {
+    auto data{this->open()};
+    auto const before{data->new_tree()};
+    std::vector<typename TypeParam::bulk_tree> trees;
+    trees.push_back(TypeParam::pack({{5, 10, 15}, {13, 15, {}}, {11, 13, 14}}));
+    trees.push_back(TypeParam::pack({{1, 2, 3}}));
+    ids = data->store_trees(trees);
+    ASSERT_EQ(ids.size(), 2);
+    EXPECT_NE(ids[0], before);
+    EXPECT_NE(ids[0], ids[1]);
+    // and the ids go on from there
+    EXPECT_NE(tree<std::string>::parse(*data, "[1<2>3]").id(), ids[1]);
+  }
+  auto data{this->open()};
+  EXPECT_EQ(tree<std::string>{ids[0]}.find_common_ancestor(*data, 11, 5), 10);
+  EXPECT_EQ(tree<std::string>{ids[0]}.find_common_ancestor(*data, 11, 14), 13);
+  EXPECT_EQ(tree<std::string>{ids[1]}.find_common_ancestor(*data, 1, 3), 2);
+}
+
+TYPED_TEST(repo, drops_a_tree_left_half_stored) {
+  auto data{this->open()};
+  auto const tree_id{std::to_string(std::stoi(data->new_tree()) + 2000)};
+  data->create_tree(tree_id);
+  data->add_nodes(tree_id, {{1, 2, 3}});
+  data->drop_tree(tree_id);
+  // the id can be taken again
+  data->create_tree(tree_id);
+  data->add_nodes(tree_id, {{4, 5, 6}});
+  if constexpr (committing_repo<TypeParam>)
+    data->commit_tree(tree_id);
+  std::vector<int> values;
+  data->visit_nodes(tree_id, [&values](int value, auto, auto){ values.push_back(value); });
+  std::sort(values.begin(), values.end());
+  EXPECT_EQ(values, (std::vector<int>{4, 5, 6}));
 }
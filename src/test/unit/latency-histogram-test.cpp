@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <algorithm>
+#include "../../latency-histogram.h"
+
+TEST(latency_histogram, small_values_are_exact)
+{
+  latency_histogram h;
+  for (uint64_t v{1}; v <= 100; ++v)
+  {
+    h.record(v);
+  }
+  EXPECT_EQ(h.count(), 100);
+  EXPECT_EQ(h.percentile(0.5), 50);
+  EXPECT_EQ(h.percentile(0.99), 99);
+  EXPECT_EQ(h.percentile(1), 100);
+  EXPECT_EQ(h.min(), 1);
+  EXPECT_DOUBLE_EQ(h.mean(), 50.5);
+}
+
+TEST(latency_histogram, large_values_within_precision)
+{
+  std::mt19937_64 rng{5};
+  std::lognormal_distribution<double> latency{8, 2};
+  std::vector<uint64_t> values;
+  latency_histogram h;
+  for (int i{}; i < 100000; ++i)
+  {
+    values.push_back(static_cast<uint64_t>(latency(rng)));
+    h.record(values.back());
+  }
+  std::sort(values.begin(), values.end());
+  for (auto fraction : {0.5, 0.9, 0.99, 0.999})
+  {
+    auto const exact{values[static_cast<size_t>(fraction * values.size() + 0.5) - 1]};
+    auto const estimate{h.percentile(fraction)};
+    EXPECT_GE(estimate, exact);
+    EXPECT_LE(estimate, exact + exact / 60 + 1) << fraction;
+  }
+  EXPECT_EQ(h.percentile(1), values.back());
+}
+
+TEST(latency_histogram, merges)
+{
+  latency_histogram a, b;
+  a.record(10);
+  b.record(1000000);
+  b.record(UINT64_MAX);
+  a.merge(b);
+  EXPECT_EQ(a.count(), 3);
+  EXPECT_EQ(a.min(), 10);
+  EXPECT_EQ(a.max(), UINT64_MAX);
+  EXPECT_GE(a.percentile(0.5), 1000000);
+  EXPECT_LE(a.percentile(0.5), 1000000 + 1000000 / 64);
+}
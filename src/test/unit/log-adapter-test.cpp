@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include "../../log-adapter.h"
+#include "../../tree.h"
+
+namespace
+{
+  // a fresh directory per test
+  std::filesystem::path directory(std::string const &name)
+  {
+    std::filesystem::path const path{"trees-log-" + name};
+    std::filesystem::remove_all(path);
+    return path;
+  }
+
+  std::vector<std::filesystem::path> segments(std::filesystem::path const &dir)
+  {
+    std::vector<std::filesystem::path> result;
+    for (auto const &entry : std::filesystem::directory_iterator{dir})
+    {
+      if (entry.path().extension() == ".seg")
+        result.push_back(entry.path());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  std::string store_tree(log_adapter &data, int root)
+  {
+    auto const text{"[" + std::to_string(root - 1) + "<" + std::to_string(root) + ">" + std::to_string(root + 1) + "]"};
+    return tree<std::string>::parse(data, text).id();
+  }
+
+  int common_ancestor(log_adapter &data, std::string const &tree_id, int root)
+  {
+    return tree<std::string>{tree_id}.find_common_ancestor(data, root - 1, root + 1);
+  }
+}
+
+TEST(log_adapter, finds_trees_after_a_restart)
+{
+  auto const dir{directory("restart")};
+  std::vector<std::string> ids;
+  {
+    log_adapter data{dir};
+    for (int i{}; i < 10; ++i)
+    {
+      ids.push_back(store_tree(data, 100 * i + 50));
+    }
+    data.remember_tree_hash(42, ids[3]);
+    EXPECT_THROW(data.create_tree(ids[5]), std::runtime_error);
+  }
+  log_adapter data{dir};
+  for (int i{}; i < 10; ++i)
+  {
+    EXPECT_EQ(common_ancestor(data, ids[i], 100 * i + 50), 100 * i + 50);
+  }
+  EXPECT_EQ(data.find_tree_by_hash(42), ids[3]);
+  EXPECT_GT(std::stoi(data.new_tree()), std::stoi(ids.back()));
+  EXPECT_EQ(data.flatten("999").size(), 0);
+}
+
+TEST(log_adapter, never_hands_out_an_id_twice)
+{
+  auto const dir{directory("reserved")};
+  int64_t given{};
+  {
+    log_store store{dir};
+    given = store.reserve();
+    // and the tree is lost, as in a crash before it was written
+  }
+  {
+    log_store store{dir};
+    EXPECT_GT(store.reserve(), given);
+    store.claim(5000);
+  }
+  log_store store{dir};
+  EXPECT_GT(store.reserve(), 5000);
+}
+
+TEST(log_adapter, seals_full_segments)
+{
+  auto const dir{directory("segments")};
+  std::vector<std::string> ids;
+  {
+    log_adapter data{dir, log_options{256, std::chrono::milliseconds{0}}};
+    for (int i{}; i < 20; ++i)
+    {
+      ids.push_back(store_tree(data, 10 * i + 5));
+    }
+  }
+  EXPECT_GT(segments(dir).size(), 5);
+  log_adapter data{dir};
+  for (int i{}; i < 20; ++i)
+  {
+    EXPECT_EQ(common_ancestor(data, ids[i], 10 * i + 5), 10 * i + 5);
+  }
+}
+
+TEST(log_adapter, cuts_off_what_a_crash_tore)
+{
+  auto const dir{directory("torn")};
+  std::string kept, torn;
+  {
+    log_adapter data{dir};
+    kept = store_tree(data, 10);
+    torn = store_tree(data, 20);
+  }
+  auto const last{segments(dir).back()};
+  auto const size{std::filesystem::file_size(last)};
+  std::filesystem::resize_file(last, size - 3);
+  {
+    log_adapter data{dir};
+    EXPECT_EQ(common_ancestor(data, kept, 10), 10);
+    EXPECT_THROW(common_ancestor(data, torn, 20), std::runtime_error);
+    // written after what was cut off
+    torn = store_tree(data, 30);
+  }
+  {
+    std::ofstream garbage{last, std::ios::app | std::ios::binary};
+    garbage << "TRLR and then nothing that makes sense";
+  }
+  log_adapter data{dir};
+  EXPECT_EQ(common_ancestor(data, kept, 10), 10);
+  EXPECT_EQ(common_ancestor(data, torn, 30), 30);
+}
+
+TEST(log_adapter, compacts_into_full_segments)
+{
+  auto const dir{directory("compact")};
+  std::vector<std::string> ids;
+  {
+    log_adapter data{dir, log_options{128, std::chrono::milliseconds{1}}};
+    for (int i{}; i < 20; ++i)
+    {
+      ids.push_back(store_tree(data, 10 * i + 5));
+    }
+    data.remember_tree_hash(7, ids[1]);
+    // nothing else may have it open meanwhile
+    EXPECT_THROW(log_store::compact(dir), std::runtime_error);
+  }
+  auto const before{segments(dir).size()};
+  log_store::compact(dir);
+  EXPECT_LT(segments(dir).size(), before);
+  EXPECT_FALSE(std::filesystem::exists(std::filesystem::path{dir}.concat(".old")));
+  log_adapter data{dir};
+  for (int i{}; i < 20; ++i)
+  {
+    EXPECT_EQ(common_ancestor(data, ids[i], 10 * i + 5), 10 * i + 5);
+  }
+  EXPECT_EQ(data.find_tree_by_hash(7), ids[1]);
+}
+
+TEST(log_adapter, finishes_a_compaction_a_crash_cut_short)
+{
+  auto const dir{directory("crash")};
+  auto const old{std::filesystem::path{dir}.concat(".old")};
+  auto const compacted{std::filesystem::path{dir}.concat(".compacting")};
+  std::filesystem::remove_all(old);
+  std::filesystem::remove_all(compacted);
+  std::vector<std::string> ids;
+  {
+    log_adapter data{dir, log_options{128, std::chrono::milliseconds{1}}};
+    for (int i{}; i < 10; ++i)
+    {
+      ids.push_back(store_tree(data, 10 * i + 5));
+    }
+  }
+  auto const before{segments(dir).size()};
+  auto const copy{directory("crash-copy")};
+  std::filesystem::copy(dir, copy, std::filesystem::copy_options::recursive);
+  log_store::compact(dir);
+  ASSERT_LT(segments(dir).size(), before);
+
+  // as if the crash came between the two renames
+  std::filesystem::rename(dir, compacted);
+  std::filesystem::rename(copy, old);
+  {
+    log_adapter data{dir};
+    EXPECT_LT(segments(dir).size(), before);
+    EXPECT_FALSE(std::filesystem::exists(old));
+    EXPECT_FALSE(std::filesystem::exists(compacted));
+    for (int i{}; i < 10; ++i)
+    {
+      EXPECT_EQ(common_ancestor(data, ids[i], 10 * i + 5), 10 * i + 5);
+    }
+  }
+
+  // and before the first: what was written of the compacted store is dropped
+  std::filesystem::create_directories(compacted);
+  {
+    log_adapter data{dir};
+    EXPECT_FALSE(std::filesystem::exists(compacted));
+    EXPECT_EQ(common_ancestor(data, ids[0], 5), 5);
+  }
+}
@@ -4,6 +4,9 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <map>
 #include "memtree.h"
 
 class mem_adapter{
@@ -60,6 +63,75 @@ public:
     node->right = right;
   }
 
+  template <typename T>
+  void visit_nodes(tree_key_t tree_id, T cb) const
+  {
+    for (auto const &n: forest_[tree_id]) {
+      std::optional<int> left, right;
+      if (n->left) {
+        left = n->left->value;
+      }
+      if (n->right) {
+        right = n->right->value;
+      }
+      cb(n->value, left, right);
+    }
+  }
+
+  void create_tree(tree_key_t tree_id)
+  {
+    if (tree_id < forest_.size())
+    {
+      throw std::runtime_error("Tree already exists.");
+    }
+    forest_.resize(tree_id + 1);
+  }
+
+  template <typename T>
+  void add_nodes(tree_key_t tree_id, std::vector<T> const &nodes)
+  {
+    for (auto const &node : nodes)
+    {
+      auto const this_node{ensure_node(tree_id, node.value)};
+      if (node.left.has_value())
+        bind_left(this_node, ensure_node(tree_id, node.left.value()));
+      if (node.right.has_value())
+        bind_right(this_node, ensure_node(tree_id, node.right.value()));
+    }
+  }
+
+  void drop_tree(tree_key_t tree_id)
+  {
+    if (tree_id + 1 == forest_.size())
+      forest_.pop_back();
+    else if (tree_id < forest_.size())
+      forest_[tree_id].clear();
+  }
+
+  template <typename T>
+  void visit_nodes_after(tree_key_t tree_id, std::optional<int> after, size_t limit, T cb) const
+  {
+    std::vector<memtree *> page;
+    if (tree_id >= forest_.size())
+      return;
+    for (auto const &n : forest_[tree_id])
+    {
+      if (!after.has_value() || n->value > after.value())
+        page.push_back(n.get());
+    }
+    std::sort(page.begin(), page.end(), [](auto a, auto b){ return a->value < b->value; });
+    page.resize(std::min(page.size(), limit));
+    for (auto n : page)
+    {
+      std::optional<int> left, right;
+      if (n->left)
+        left = n->left->value;
+      if (n->right)
+        right = n->right->value;
+      cb(n->value, left, right);
+    }
+  }
+
   std::string str() const 
   {
     std::stringstream ss;
@@ -82,6 +154,18 @@ public:
     return ss.str();
   }
 
+  std::optional<tree_key_t> find_tree_by_hash(uint64_t hash) const
+  {
+    auto pos{hashes_.find(hash)};
+    return pos == hashes_.end() ? std::nullopt : std::optional{pos->second};
+  }
+
+  void remember_tree_hash(uint64_t hash, tree_key_t tree_id)
+  {
+    hashes_.try_emplace(hash, tree_id);
+  }
+
 private:
   std::vector<std::vector<std::unique_ptr<memtree>>> forest_;
+  std::map<uint64_t, tree_key_t> hashes_;
 };
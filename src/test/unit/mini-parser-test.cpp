@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "../../mini-parser.h"
+#include "../../tree-query.h"
 
 TEST(mini_parser, uri) {
   std::string_view src {"/tree/2/common-ancestor/11/14"};
@@ -15,3 +16,76 @@ TEST(mini_parser, uri) {
   EXPECT_EQ(value1, 11);
   EXPECT_EQ(value2, 14);
 }
+
+TEST(mini_parser, int_list) {
+  std::string_view src {"/tree/2/common-ancestor/11/14/7"};
+  std::string tree_id;
+  std::vector<int> values;
+  mini_parser p;
+  p.set(p.ignore(2, p.read(tree_id, p.ignore(1, p.read_ints(values)))));
+  for (auto c : src)
+  {
+    p(c);
+  }
+  EXPECT_EQ(tree_id, "2");
+  EXPECT_EQ(values, (std::vector<int>{11, 14, 7}));
+}
+
+TEST(mini_parser, int_list_rejects_other_separators) {
+  for (std::string_view src : {"/tree/2/common-ancestor/11 14", "/tree/2/common-ancestor/11/14x", "/tree/2/common-ancestor/11;14"})
+  {
+    std::string tree_id;
+    std::vector<int> values;
+    mini_parser p;
+    p.set(p.ignore(2, p.read(tree_id, p.ignore(1, p.read_ints(values)))));
+    EXPECT_THROW(
+        {
+          for (auto c : src)
+          {
+            p(c);
+          }
+        },
+        std::runtime_error);
+  }
+}
+
+TEST(mini_parser, refuses_values_that_would_wrap) {
+  for (std::string_view src : {"/tree/2/common-ancestor/99999999999/1", "/tree/2/common-ancestor/2147483648"})
+  {
+    std::string tree_id;
+    std::vector<int> values;
+    mini_parser p;
+    p.set(p.ignore(2, p.read(tree_id, p.ignore(1, p.read_ints(values)))));
+    try
+    {
+      for (auto c : src)
+      {
+        p(c);
+      }
+      FAIL() << src;
+    }
+    catch (std::runtime_error const &e)
+    {
+      EXPECT_STREQ(e.what(), "Value out of range.");
+    }
+  }
+  int value{};
+  mini_parser p;
+  p.set(p.read_int(value, p.parse_throw));
+  for (auto c : std::string_view{"2147483647"})
+  {
+    p(c);
+  }
+  EXPECT_EQ(value, 2147483647);
+  EXPECT_THROW(p('0'), std::runtime_error);
+}
+
+TEST(mini_parser, body_values_may_be_spaced) {
+  std::string tree_id;
+  std::vector<int> values;
+  parse_value_list("/tree/2/common-ancestor", "11, 14\n7\r\n", tree_id, values);
+  EXPECT_EQ(tree_id, "2");
+  EXPECT_EQ(values, (std::vector<int>{11, 14, 7}));
+  values.clear();
+  EXPECT_THROW(parse_value_list("/tree/2/common-ancestor/11 14", "", tree_id, values), std::runtime_error);
+}
@@ -0,0 +1,159 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "../../rcu.h"
+
+namespace
+{
+  // counts the live ones
+  struct tracked
+  {
+    static inline std::atomic<int> live{};
+
+    explicit tracked(int value) : value{value} { ++live; }
+    ~tracked() { --live; }
+
+    int value;
+  };
+}
+
+TEST(rcu_map, finds_what_was_inserted)
+{
+  rcu_map<int, int> map;
+  for (int i{}; i < 1000; ++i)
+  {
+    map.insert(i, std::make_shared<int const>(i * 2));
+  }
+  EXPECT_EQ(map.size(), 1000);
+  EXPECT_EQ(map.read(7, [](int v)
+                     { return v + 1; }),
+            15);
+  EXPECT_EQ(map.read(1000, [](int v)
+                     { return v; }),
+            std::nullopt);
+  EXPECT_EQ(*map.get(999), 1998);
+
+  map.insert(7, std::make_shared<int const>(0));
+  EXPECT_EQ(*map.get(7), 0);
+  EXPECT_EQ(*map.emplace(7, std::make_shared<int const>(1)), 0);
+  EXPECT_EQ(map.size(), 1000);
+
+  EXPECT_TRUE(map.erase(7));
+  EXPECT_FALSE(map.erase(7));
+  EXPECT_FALSE(map.contains(7));
+  EXPECT_EQ(map.erase_if([](int key, int)
+                         { return key % 2 == 0; }),
+            500);
+  EXPECT_EQ(map.size(), 499);
+  int sum{};
+  map.for_each([&sum](int, int v)
+               { sum += v; });
+  EXPECT_EQ(sum, 2 * 500 * 500 - 14);
+}
+
+TEST(rcu_map, frees_what_readers_are_done_with)
+{
+  {
+    rcu_map<int, tracked> map;
+    map.insert(1, std::make_shared<tracked const>(1));
+    {
+      rcu_domain::read_guard guard;
+      auto const pinned{map.read(1, [](tracked const &t)
+                                 { return &t; })};
+      map.erase(1);
+      // this thread may still be looking at it
+      EXPECT_EQ(tracked::live, 1);
+      EXPECT_EQ((*pinned)->value, 1);
+    }
+    // freed as the reader is done, with no other change
+    EXPECT_EQ(tracked::live, 0);
+    EXPECT_EQ(rcu_domain::instance().pending(), 0);
+  }
+}
+
+TEST(rcu_map, frees_a_value_dropped_under_a_reader_once_it_leaves)
+{
+  rcu_map<int, tracked> map;
+  map.insert(1, std::make_shared<tracked const>(1));
+  std::atomic<bool> reading{};
+  std::atomic<bool> dropped{};
+  std::thread reader{[&]
+                     {
+                       rcu_domain::read_guard guard;
+                       reading = true;
+                       while (!dropped)
+                         std::this_thread::yield();
+                     }};
+  while (!reading)
+    std::this_thread::yield();
+  // as a sweep demotes an idle tree while queries of others run
+  EXPECT_EQ(map.erase_if([](int, tracked const &)
+                         { return true; }),
+            1);
+  EXPECT_EQ(tracked::live, 1);
+  dropped = true;
+  reader.join();
+  EXPECT_EQ(tracked::live, 0);
+}
+
+TEST(rcu_map, readers_see_whole_values_while_it_changes)
+{
+  rcu_map<int, std::vector<int>> map;
+  std::atomic<bool> done{};
+  std::atomic<size_t> torn{}, found{};
+  std::vector<std::thread> readers;
+  for (int r{}; r < 4; ++r)
+  {
+    readers.emplace_back([&]
+                         {
+                           while (!done)
+                           {
+                             for (int key{}; key < 64; ++key)
+                             {
+                               auto const ok{map.read(key, [key](std::vector<int> const &v)
+                                                      { return v.size() == 100 && v.front() == key && v.back() == key; })};
+                               if (ok.has_value())
+                               {
+                                 ++found;
+                                 torn += !*ok;
+                               }
+                             }
+                           } });
+  }
+  for (int round{}; round < 200; ++round)
+  {
+    for (int key{}; key < 64; ++key)
+    {
+      map.insert(key, std::make_shared<std::vector<int> const>(100, key));
+    }
+    map.erase_if([round](int key, std::vector<int> const &)
+                 { return key % 3 == round % 3; });
+  }
+  done = true;
+  for (auto &r : readers)
+  {
+    r.join();
+  }
+  EXPECT_GT(found, 0);
+  EXPECT_EQ(torn, 0);
+}
+
+TEST(striped_counter, sums_what_threads_add)
+{
+  striped_counter counter;
+  std::vector<std::thread> threads;
+  for (int t{}; t < 8; ++t)
+  {
+    threads.emplace_back([&counter]
+                         {
+                           for (int i{}; i < 10000; ++i)
+                             counter.add(); });
+  }
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+  EXPECT_EQ(counter.sum(), 80000);
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include "../../rpc.h"
+#include "../../async-tree-controller.h"
+#include "mem-adapter.h"
+
+namespace
+{
+  using async_mem_adapter = async_adapter<mem_adapter>;
+  using controller_t = async_tree_controller<async_mem_adapter>;
+
+  std::vector<rpc_request> requests(std::string_view data, size_t expected_used)
+  {
+    std::vector<rpc_request> result;
+    EXPECT_EQ(rpc_decode<rpc_request>(data, [&result](rpc_request r)
+                                      { result.push_back(std::move(r)); }),
+              expected_used);
+    return result;
+  }
+}
+
+TEST(rpc, frames_round_trip)
+{
+  auto const first{encode(rpc_request{7, rpc_op::common_ancestor, "t1-42", {11, -14, 7}})};
+  // length, id, op, tree id, count, arguments
+  EXPECT_EQ(first.size(), 4 + 4 + 1 + 2 + 5 + 2 + 12);
+  auto const second{encode(rpc_request{8, rpc_op::is_ancestor, "3", {1, 2}})};
+  auto const both{requests(first + second, first.size() + second.size())};
+  ASSERT_EQ(both.size(), 2);
+  EXPECT_EQ(both[0].id, 7);
+  EXPECT_EQ(both[0].op, rpc_op::common_ancestor);
+  EXPECT_EQ(both[0].tree_id, "t1-42");
+  EXPECT_EQ(both[0].args, (std::vector<int>{11, -14, 7}));
+  EXPECT_EQ(both[1].tree_id, "3");
+
+  std::vector<rpc_reply> replies;
+  auto const answers{encode(rpc_reply{7, rpc_status::ok, -3, {}}) + encode(rpc_reply{8, rpc_status::error, 0, "Not found."})};
+  rpc_decode<rpc_reply>(answers, [&replies](rpc_reply r)
+                        { replies.push_back(std::move(r)); });
+  ASSERT_EQ(replies.size(), 2);
+  EXPECT_EQ(replies[0].value, -3);
+  EXPECT_EQ(replies[1].status, rpc_status::error);
+  EXPECT_EQ(replies[1].message, "Not found.");
+}
+
+TEST(rpc, waits_for_whole_frames)
+{
+  auto const frame{encode(rpc_request{1, rpc_op::distance, "5", {1, 2}})};
+  for (size_t cut{}; cut < frame.size(); ++cut)
+  {
+    EXPECT_TRUE(requests(frame.substr(0, cut), 0).empty());
+  }
+  EXPECT_EQ(requests(frame + frame.substr(0, 6), frame.size()).size(), 1);
+}
+
+TEST(rpc, rejects_garbage)
+{
+  std::string too_long{"\xff\xff\xff\x7f", 4};
+  EXPECT_THROW(rpc_decode<rpc_request>(too_long, [](rpc_request) {}), std::runtime_error);
+  // claims 3 arguments, holds 1
+  auto frame{encode(rpc_request{1, rpc_op::distance, "5", {1, 2, 3}})};
+  frame[0] -= 8;
+  EXPECT_THROW(rpc_decode<rpc_request>(frame.substr(0, frame.size() - 8), [](rpc_request) {}), std::runtime_error);
+}
+
+TEST(rpc, calls_the_controller)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  controller_t controller{async_data, {[](size_t id)
+                                       { return std::to_string(id); },
+                                       [](std::string const &id)
+                                       { return static_cast<size_t>(std::atol(id.c_str())); }}};
+  auto const tree{sync_wait(compute, controller.post_tree(controller_t::request{"/tree", "[5<10>15][5>7][13<15][11<13>14]"}))};
+  auto const call = [&](rpc_op op, std::vector<int> args)
+  { return sync_wait(compute, rpc_call(controller, rpc_request{1, op, tree, std::move(args)})); };
+
+  EXPECT_EQ(call(rpc_op::common_ancestor, {11, 14}), 13);
+  EXPECT_EQ(call(rpc_op::common_ancestor, {7, 11, 14}), 10);
+  EXPECT_EQ(call(rpc_op::distance, {7, 14}), 5);
+  EXPECT_EQ(call(rpc_op::ancestor, {14, 2}), 15);
+  EXPECT_EQ(call(rpc_op::is_ancestor, {15, 11}), 1);
+  EXPECT_EQ(call(rpc_op::is_ancestor, {11, 15}), 0);
+  EXPECT_THROW(call(rpc_op::distance, {7}), std::runtime_error);
+  EXPECT_THROW(call(rpc_op::common_ancestor, {7}), std::runtime_error);
+  EXPECT_THROW(call(static_cast<rpc_op>(99), {7, 14}), std::runtime_error);
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <stdexcept>
+#include "../../succinct-tree.h"
+
+namespace
+{
+  // [5<10>15][5>7][13<15][11<13>14]
+  flat_tree sample()
+  {
+    flat_tree t;
+    t.add(10, 5, 15);
+    t.add(5, {}, 7);
+    t.add(15, 13, {});
+    t.add(13, 11, 14);
+    return t;
+  }
+
+  // a random binary forest, deep enough to span many blocks
+  flat_tree random_forest(size_t size, unsigned seed)
+  {
+    std::mt19937 rng{seed};
+    flat_tree t;
+    std::vector<int> free_slots;
+    for (size_t i{}; i < size; ++i)
+    {
+      auto const value{static_cast<int>(i * 7 + 3)};
+      t.ensure(value);
+      if (i % 1000 != 0)
+      {
+        std::uniform_int_distribution<size_t> pick{0, free_slots.size() - 1};
+        auto const slot{pick(rng)};
+        t.parents.back() = free_slots[slot];
+        free_slots[slot] = free_slots.back();
+        free_slots.pop_back();
+      }
+      free_slots.push_back(static_cast<int>(i));
+      free_slots.push_back(static_cast<int>(i));
+    }
+    return t;
+  }
+}
+
+TEST(succinct_tree, sample_queries)
+{
+  succinct_tree tree{sample()};
+  EXPECT_EQ(tree.size(), 7);
+  EXPECT_EQ(tree.depth(10), 0);
+  EXPECT_EQ(tree.depth(14), 3);
+  EXPECT_EQ(tree.ancestor(14, 1), 13);
+  EXPECT_EQ(tree.ancestor(14, 3), 10);
+  EXPECT_THROW(tree.ancestor(14, 4), std::runtime_error);
+  EXPECT_EQ(tree.common_ancestor(11, 14), 13);
+  EXPECT_EQ(tree.common_ancestor(7, 14), 10);
+  EXPECT_EQ(tree.common_ancestor(std::vector<int>{11, 14, 7}), 10);
+  EXPECT_EQ(tree.distance(7, 14), 5);
+  EXPECT_TRUE(tree.is_ancestor(15, 11));
+  EXPECT_FALSE(tree.is_ancestor(11, 15));
+  EXPECT_FALSE(tree.contains(99));
+  EXPECT_THROW(tree.depth(99), std::runtime_error);
+}
+
+TEST(succinct_tree, agrees_with_tree_index)
+{
+  auto const flat{random_forest(20000, 7)};
+  succinct_tree compact{flat};
+  tree_index index{flat};
+  std::mt19937 rng{11};
+  std::uniform_int_distribution<size_t> pick{0, flat.size() - 1};
+  for (int i{}; i < 2000; ++i)
+  {
+    auto const a{flat.values[pick(rng)]}, b{flat.values[pick(rng)]};
+    ASSERT_EQ(compact.depth(a), index.depth(a));
+    ASSERT_EQ(compact.is_ancestor(a, b), index.is_ancestor(a, b));
+    ASSERT_EQ(compact.ancestor(a, index.depth(a) / 2), index.ancestor(a, index.depth(a) / 2));
+    try
+    {
+      auto const expected{index.common_ancestor(a, b)};
+      ASSERT_EQ(compact.common_ancestor(a, b), expected);
+      ASSERT_EQ(compact.distance(a, b), index.distance(a, b));
+    }
+    catch (std::runtime_error const &)
+    {
+      ASSERT_THROW(compact.common_ancestor(a, b), std::runtime_error);
+    }
+  }
+  EXPECT_LT(compact.size_in_bytes(), flat.size() * 8);
+}
+
+TEST(succinct_tree, rejects_cycles)
+{
+  flat_tree cycle;
+  cycle.add(1, 2, {});
+  cycle.add(2, 1, {});
+  EXPECT_THROW(succinct_tree{cycle}, std::runtime_error);
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+#include "../../task.h"
+
+namespace
+{
+  task<int> twice(int v)
+  {
+    co_return v * 2;
+  }
+
+  task<int> sum_of_twice(int a, int b)
+  {
+    co_return co_await twice(a) + co_await twice(b);
+  }
+
+  task<void> fail()
+  {
+    throw std::runtime_error("bad");
+    co_return;
+  }
+
+  task<std::thread::id> where(executor &ex)
+  {
+    co_await ex.schedule();
+    co_return std::this_thread::get_id();
+  }
+
+  task<executor *> on_executor(executor &ex)
+  {
+    co_await ex.schedule();
+    co_return executor::current();
+  }
+}
+
+TEST(task, nested_tasks_return_values)
+{
+  executor ex{1};
+  EXPECT_EQ(sync_wait(ex, sum_of_twice(3, 4)), 14);
+}
+
+TEST(task, exceptions_reach_the_awaiter)
+{
+  executor ex{1};
+  EXPECT_THROW(sync_wait(ex, fail()), std::runtime_error);
+}
+
+TEST(task, schedule_moves_to_the_executor)
+{
+  executor one{1}, other{1};
+  auto const first{sync_wait(one, where(one))};
+  auto const second{sync_wait(one, where(other))};
+  EXPECT_NE(first, second);
+  EXPECT_NE(first, std::this_thread::get_id());
+}
+
+TEST(task, executors_know_their_threads)
+{
+  executor ex{1};
+  EXPECT_EQ(executor::current(), nullptr);
+  EXPECT_EQ(sync_wait(ex, on_executor(ex)), &ex);
+}
+
+TEST(task, many_spawned_tasks_complete)
+{
+  executor ex{2};
+  std::atomic<int> total{};
+  std::promise<void> all_done;
+  std::atomic<int> remaining{1000};
+  for (int i{}; i < 1000; ++i)
+  {
+    spawn(ex, twice(i), [&](std::optional<int> v, std::exception_ptr)
+          {
+            total += *v;
+            if (--remaining == 0)
+              all_done.set_value(); });
+  }
+  all_done.get_future().wait();
+  EXPECT_EQ(total, 999000);
+}
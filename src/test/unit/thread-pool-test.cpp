@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include "../../thread-pool.h"
+
+TEST(thread_pool, runs_every_job) {
+  thread_pool pool{3};
+  std::atomic<int> total{};
+  std::vector<std::future<int>> results;
+  for (int i{1}; i <= 100; ++i) {
+    results.push_back(pool.submit([i, &total]{ total += i; return i * 2; }));
+  }
+  int doubled{};
+  for (auto &r : results) {
+    doubled += r.get();
+  }
+  EXPECT_EQ(total, 5050);
+  EXPECT_EQ(doubled, 10100);
+}
+
+TEST(thread_pool, passes_exceptions_through_futures) {
+  thread_pool pool{1};
+  auto result {pool.submit([]() -> int { throw std::runtime_error("bad"); })};
+  EXPECT_THROW(result.get(), std::runtime_error);
+}
+
+TEST(thread_pool, parallel_for_covers_the_range_once) {
+  thread_pool pool{4};
+  std::vector<int> hits(100000);
+  pool.parallel_for(hits.size(), 1000, [&hits](size_t begin, size_t end) {
+    for (auto i{begin}; i < end; ++i) {
+      ++hits[i];
+    }
+  });
+  EXPECT_EQ(std::count(hits.begin(), hits.end(), 1), hits.size());
+}
+
+TEST(thread_pool, nested_parallel_work_does_not_starve) {
+  thread_pool pool{2};
+  std::atomic<int> total{};
+  pool.parallel_for(8, 1, [&](size_t begin, size_t end) {
+    for (auto i{begin}; i < end; ++i) {
+      pool.parallel_for(1000, 10, [&total](size_t b, size_t e) { total += static_cast<int>(e - b); });
+    }
+  });
+  EXPECT_EQ(total, 8000);
+}
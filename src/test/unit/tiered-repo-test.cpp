@@ -0,0 +1,202 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include "../../tiered-repo.h"
+#include "../../async-tree-controller.h"
+#include "mem-adapter.h"
+
+namespace
+{
+  using async_mem_adapter = async_adapter<mem_adapter>;
+  using tiered_t = tiered_repo<async_mem_adapter>;
+  using controller_t = async_tree_controller<tiered_t>;
+
+  controller_t::translator_t translator()
+  {
+    return {[](size_t id)
+            { return std::to_string(id); },
+            [](std::string const &src)
+            { return static_cast<size_t>(std::atol(src.c_str())); }};
+  }
+
+  // steps only when told to; read by the sweeper too
+  struct fake_clock
+  {
+    std::atomic<std::chrono::steady_clock::time_point> now{std::chrono::steady_clock::time_point{std::chrono::hours{1}}};
+
+    void advance(std::chrono::steady_clock::duration by) { now = now.load() + by; }
+
+    tiered_t::clock_t source()
+    {
+      return [this]
+      { return now.load(); };
+    }
+  };
+
+  template <typename F>
+  bool eventually(F f)
+  {
+    for (int i{}; i < 5000 && !f(); ++i)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    return f();
+  }
+}
+
+TEST(tiered_repo, promotes_busy_trees_in_the_background)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  fake_clock clock;
+  tiered_t tiered{async_data, compute, {.promote_after = 3}, default_succinct_threshold, clock.source()};
+  controller_t controller{tiered, translator()};
+  auto const tree_id{sync_wait(compute, controller.post_tree(std::string{"[5<10>15][13<15][11<13>14]"}))};
+
+  EXPECT_EQ(tiered.hot(tree_id), nullptr);
+  EXPECT_EQ(tiered.hot(tree_id), nullptr);
+  // the third query is still answered from storage
+  EXPECT_EQ(tiered.hot(tree_id), nullptr);
+  ASSERT_TRUE(eventually([&tiered]
+                         { return tiered.stats().hot_trees == 1; }));
+  auto const index{tiered.hot(tree_id)};
+  ASSERT_NE(index, nullptr);
+  EXPECT_EQ(std::get<tree_index>(*index).common_ancestor(11, 5), 10);
+
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(tree_id, {11, 14})), 13);
+  EXPECT_EQ(sync_wait(compute, controller.distance(tree_id, 5, 14)), 4);
+  auto const stats{tiered.stats()};
+  EXPECT_EQ(stats.cold_hits, 3);
+  EXPECT_EQ(stats.hot_hits, 3);
+  EXPECT_EQ(stats.promotions, 1);
+  EXPECT_EQ(stats.json(), "{\"hot\":{\"trees\":1,\"hits\":3},\"cold\":{\"hits\":3},\"promotions\":1,\"demotions\":0}");
+}
+
+TEST(tiered_repo, queries_spread_over_windows_stay_cold)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  fake_clock clock;
+  tiered_t tiered{async_data, compute, {.promote_after = 2, .window = std::chrono::seconds{10}}, default_succinct_threshold, clock.source()};
+  controller_t controller{tiered, translator()};
+  auto const tree_id{sync_wait(compute, controller.post_tree(std::string{"[1<2>3]"}))};
+
+  for (int i{}; i < 5; ++i)
+  {
+    EXPECT_EQ(sync_wait(compute, controller.common_ancestor(tree_id, {1, 3})), 2);
+    clock.advance(std::chrono::seconds{11});
+  }
+  EXPECT_EQ(tiered.stats().promotions, 0);
+  EXPECT_EQ(tiered.stats().cold_hits, 5);
+}
+
+TEST(tiered_repo, demotes_idle_and_changed_trees)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  fake_clock clock;
+  tiered_t tiered{async_data, compute, {.promote_after = 1, .idle = std::chrono::minutes{1}, .max_hot = 2}, default_succinct_threshold, clock.source()};
+  controller_t controller{tiered, translator()};
+
+  std::vector<size_t> trees;
+  for (int i{}; i < 3; ++i)
+  {
+    trees.push_back(sync_wait(compute, controller.post_tree(std::string{"[1<2>3]"})));
+    clock.advance(std::chrono::seconds{1});
+    EXPECT_EQ(sync_wait(compute, controller.ancestor(trees.back(), 1, 1)), 2);
+    ASSERT_TRUE(eventually([&tiered, i]
+                           { return tiered.stats().promotions == static_cast<uint64_t>(i + 1); }));
+  }
+  // over max_hot, the least recently used went
+  EXPECT_EQ(tiered.stats().hot_trees, 2);
+  EXPECT_EQ(tiered.stats().demotions, 1);
+
+  sync_wait(compute, tiered.add_nodes(trees[2], {{std::nullopt, 4, std::nullopt}}));
+  EXPECT_EQ(tiered.stats().hot_trees, 2);
+  sync_wait(compute, tiered.commit_tree(trees[2]));
+  EXPECT_EQ(tiered.stats().hot_trees, 1);
+
+  clock.advance(std::chrono::minutes{2});
+  EXPECT_EQ(tiered.hot(trees[1]), nullptr);
+  EXPECT_EQ(tiered.stats().demotions, 2);
+  // the query that found it gone promotes it again
+  ASSERT_TRUE(eventually([&tiered]
+                         { return tiered.stats().promotions == 4; }));
+  EXPECT_EQ(tiered.stats().hot_trees, 1);
+  // and the tree still answers from storage
+  EXPECT_TRUE(sync_wait(compute, controller.is_ancestor(trees[1], 2, 3)));
+}
+
+TEST(tiered_repo, keeps_the_index_a_cold_query_built)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  fake_clock clock;
+  tiered_t tiered{async_data, compute, {.promote_after = 2}, default_succinct_threshold, clock.source()};
+  controller_t controller{tiered, translator()};
+  auto const tree_id{sync_wait(compute, controller.post_tree(std::string{"[5<10>15][13<15][11<13>14]"}))};
+
+  // once is not enough
+  EXPECT_EQ(sync_wait(compute, controller.distance(tree_id, 5, 14)), 4);
+  EXPECT_EQ(tiered.stats().hot_trees, 0);
+  EXPECT_EQ(sync_wait(compute, controller.distance(tree_id, 5, 14)), 4);
+  EXPECT_EQ(tiered.stats().hot_trees, 1);
+  EXPECT_EQ(sync_wait(compute, controller.ancestor(tree_id, 14, 2)), 15);
+  EXPECT_EQ(sync_wait(compute, controller.common_ancestor(tree_id, {5, 11, 14})), 10);
+  ASSERT_TRUE(eventually([&tiered]
+                         { return tiered.stats().promotions == 1; }));
+  auto const stats{tiered.stats()};
+  EXPECT_EQ(stats.cold_hits, 2);
+  EXPECT_EQ(stats.hot_hits, 2);
+}
+
+TEST(tiered_repo, one_off_path_queries_leave_hot_trees_be)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  fake_clock clock;
+  tiered_t tiered{async_data, compute, {.promote_after = 2, .max_hot = 2}, default_succinct_threshold, clock.source()};
+  controller_t controller{tiered, translator()};
+  std::vector<size_t> hot;
+  for (int i{}; i < 2; ++i)
+  {
+    hot.push_back(sync_wait(compute, controller.post_tree(std::string{"[1<2>3]"})));
+    for (int query{}; query < 2; ++query)
+    {
+      EXPECT_EQ(sync_wait(compute, controller.distance(hot.back(), 1, 3)), 2);
+    }
+  }
+  ASSERT_EQ(tiered.stats().hot_trees, 2);
+
+  for (int i{}; i < 10; ++i)
+  {
+    auto const scanned{sync_wait(compute, controller.post_tree(std::string{"[1<2>3]"}))};
+    EXPECT_EQ(sync_wait(compute, controller.distance(scanned, 1, 3)), 2);
+  }
+  EXPECT_EQ(tiered.stats().demotions, 0);
+  EXPECT_NE(tiered.hot(hot[0]), nullptr);
+  EXPECT_NE(tiered.hot(hot[1]), nullptr);
+}
+
+TEST(tiered_repo, demotes_idle_trees_without_queries)
+{
+  mem_adapter adapter;
+  executor io{1}, compute{2};
+  async_mem_adapter async_data{adapter, io, compute};
+  fake_clock clock;
+  tiered_t tiered{async_data, compute, {.promote_after = 1, .idle = std::chrono::minutes{1}}, default_succinct_threshold, clock.source()};
+  controller_t controller{tiered, translator()};
+  auto const tree_id{sync_wait(compute, controller.post_tree(std::string{"[1<2>3]"}))};
+  EXPECT_EQ(sync_wait(compute, controller.distance(tree_id, 1, 3)), 2);
+  ASSERT_EQ(tiered.stats().hot_trees, 1);
+
+  clock.advance(std::chrono::minutes{2});
+  EXPECT_TRUE(eventually([&tiered]
+                         { return tiered.stats().hot_trees == 0; }));
+  EXPECT_EQ(tiered.stats().demotions, 1);
+}
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include "../../token-scanner.h"
+#include "../../tree-parser.h"
+
+namespace
+{
+  void expect_same_as_scalar(std::string const &text)
+  {
+    auto const expected{token_scanner::scan_all(text, token_scanner::isa::scalar)};
+    for (auto isa : {token_scanner::isa::sse42, token_scanner::isa::avx2})
+    {
+      if (!token_scanner::supported(isa))
+        continue;
+      auto const actual{token_scanner::scan_all(text, isa)};
+      ASSERT_EQ(actual.size(), expected.size()) << text;
+      for (size_t i{}; i < expected.size(); ++i)
+      {
+        ASSERT_EQ(actual[i].t, expected[i].t) << "token " << i;
+        ASSERT_EQ(actual[i].end, expected[i].end) << "token " << i;
+        if (expected[i].t == token_type::value)
+        {
+          ASSERT_EQ(actual[i].token_value, expected[i].token_value) << "token " << i;
+        }
+      }
+    }
+  }
+}
+
+TEST(token_scanner, scalar_tokens)
+{
+  auto const tokens{token_scanner::scan_all("[5<10>15]x", token_scanner::isa::scalar)};
+  ASSERT_EQ(tokens.size(), 8);
+  EXPECT_EQ(tokens[0].t, token_type::open_node);
+  EXPECT_EQ(tokens[3].t, token_type::value);
+  EXPECT_EQ(tokens[3].token_value, 10);
+  EXPECT_EQ(tokens[3].end, 5);
+  EXPECT_EQ(tokens[7].t, token_type::invalid);
+}
+
+TEST(token_scanner, vector_paths_match_scalar)
+{
+  expect_same_as_scalar("");
+  expect_same_as_scalar("[5<10>15][<10>][5>7][13<15][11<13>14]");
+  expect_same_as_scalar("abc[]<<>>");
+  expect_same_as_scalar("[123456789<1234567890123>5][99999999999>0]");
+  expect_same_as_scalar(std::string(63, '1') + "[" + std::string(130, '7') + "]12345678901234");
+  std::mt19937 rng{3};
+  std::string const alphabet{"[]<>0123456789 x"};
+  std::uniform_int_distribution<size_t> pick{0, alphabet.size() - 1};
+  for (auto size : {1, 17, 64, 65, 1000, 200000})
+  {
+    std::string text;
+    for (int i{}; i < size; ++i)
+    {
+      // favour digits so runs cross block boundaries
+      text += pick(rng) < 4 ? alphabet[pick(rng) % 4] : alphabet[4 + pick(rng) % 12];
+    }
+    expect_same_as_scalar(text);
+  }
+}
+
+TEST(token_scanner, parse_errors_point_at_the_same_place)
+{
+  try
+  {
+    tree_parser::parse("[1<2<3]", [](auto) {});
+    FAIL();
+  }
+  catch (std::runtime_error const &e)
+  {
+    EXPECT_STREQ(e.what(), "Unable to parse [1<2<3] at 3]. Last state was 4 last token type 3");
+  }
+}
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <cstdio>
+#include <future>
+#include "../../trace.h"
+#include "../../async-tree-controller.h"
+#include "../../data-adapter.h"
+
+namespace
+{
+  trace_record make_record(uint64_t id, uint64_t total_ns)
+  {
+    trace_record r{};
+    r.id = id;
+    r.total_ns = total_ns;
+    r.storage_calls = id * 3;
+    trace_record::copy_text(r.route, "/tree/*");
+    trace_record::copy_text(r.uri, "/tree/" + std::to_string(id));
+    return r;
+  }
+
+  using async_data_adapter = async_adapter<data_adapter>;
+  using controller_t = async_tree_controller<async_data_adapter>;
+
+  trace_record run_traced(executor &compute, task<std::string> t, trace_span &span)
+  {
+    std::promise<void> done;
+    spawn(compute, std::move(t), [&done](auto, std::exception_ptr)
+          { done.set_value(); },
+          &span);
+    done.get_future().wait();
+    return span.finish(200);
+  }
+}
+
+TEST(trace_log, keeps_the_last_requests_oldest_first)
+{
+  trace_log log{4};
+  for (uint64_t id{1}; id <= 10; ++id)
+  {
+    log.record(make_record(id, id));
+  }
+  auto const held{log.snapshot()};
+  ASSERT_EQ(held.size(), 4);
+  for (size_t i{}; i < held.size(); ++i)
+  {
+    EXPECT_EQ(held[i].id, 7 + i);
+    EXPECT_EQ(trace_record::text(held[i].uri), "/tree/" + std::to_string(7 + i));
+  }
+}
+
+TEST(trace_log, lists_recent_and_slowest)
+{
+  trace_log log;
+  log.record(make_record(1, 5000));
+  log.record(make_record(2, 90000));
+  log.record(make_record(3, 1000));
+  auto const json{log.json(2)};
+  auto const slowest{json.find("\"slowest\":")};
+  ASSERT_NE(slowest, std::string::npos);
+  // recent: 3 then 2; slowest: 2 then 1
+  EXPECT_LT(json.find("\"id\":3"), json.find("\"id\":2"));
+  EXPECT_EQ(json.find("\"id\":1"), json.rfind("\"id\":1"));
+  EXPECT_GT(json.find("\"id\":1"), slowest);
+  EXPECT_NE(json.find("\"total_us\":90,"), std::string::npos);
+  EXPECT_NE(json.find("\"storage_us\":0"), std::string::npos);
+  EXPECT_EQ(trace_log{}.json(5), "{\"recent\":[],\"slowest\":[]}");
+}
+
+TEST(trace_log, writers_never_tear_records)
+{
+  trace_log log{64};
+  std::atomic<bool> stop{};
+  std::vector<std::thread> writers;
+  for (uint64_t w{}; w < 4; ++w)
+  {
+    writers.emplace_back([&log, w]
+                         {
+                           for (uint64_t i{}; i < 20000; ++i)
+                           {
+                             auto const id{w * 100000 + i};
+                             log.record(make_record(id, id * 7));
+                           } });
+  }
+  std::thread reader{[&log, &stop]
+                     {
+                       while (!stop)
+                       {
+                         for (auto const &r : log.snapshot())
+                         {
+                           ASSERT_EQ(r.total_ns, r.id * 7);
+                           ASSERT_EQ(r.storage_calls, r.id * 3);
+                           ASSERT_EQ(trace_record::text(r.uri), "/tree/" + std::to_string(r.id));
+                         }
+                       } }};
+  for (auto &t : writers)
+  {
+    t.join();
+  }
+  stop = true;
+  reader.join();
+  EXPECT_EQ(log.snapshot().size(), 64);
+}
+
+TEST(trace_span, follows_a_request_through_storage)
+{
+  sqlitedb::on_statement = count_storage_call;
+  auto const file{"trees-trace.db"};
+  for (auto const suffix : {"", "-wal", "-shm"})
+  {
+    std::remove((std::string{file} + suffix).c_str());
+  }
+  data_adapter data{file};
+  executor io{1}, compute{2};
+  async_data_adapter async_data{data, io, compute};
+  controller_t controller{async_data, {[](std::string const &id)
+                                       { return id; },
+                                       [](std::string const &id)
+                                       { return id; }}};
+
+  trace_span post{1, "/tree", "/tree"};
+  auto const posted{run_traced(compute, controller.post_tree(controller_t::request{"/tree", "[5<10>15][13<15][11<13>14]", false}), post)};
+  EXPECT_GT(posted.phase_ns[static_cast<size_t>(trace_phase::parse)], 0);
+  EXPECT_GT(posted.phase_ns[static_cast<size_t>(trace_phase::storage)], 0);
+  // a new tree, and for each of the 6 nodes an insert; then 4 binds
+  EXPECT_GE(posted.storage_calls, 11);
+  EXPECT_GE(posted.total_ns, posted.phase_ns[static_cast<size_t>(trace_phase::storage)]);
+
+  auto const tree_id{sync_wait(compute, controller.post_tree(std::string{"[1<2>3]"}))};
+  trace_span query{2, "/tree/*/common-ancestor/#", "/tree/" + tree_id + "/common-ancestor/1/3"};
+  auto const queried{run_traced(compute, controller.common_ancestor(controller_t::request{"/tree/" + tree_id + "/common-ancestor/1/3", ""}), query)};
+  EXPECT_GT(queried.storage_calls, 0);
+  EXPECT_EQ(trace_record::text(queried.route), "/tree/*/common-ancestor/#");
+
+  // untraced work costs nothing to the spans
+  sync_wait(compute, controller.common_ancestor(tree_id, {1, 3}));
+  EXPECT_EQ(query.finish(200).storage_calls, queried.storage_calls);
+}
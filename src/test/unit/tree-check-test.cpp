@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "../../tree-check.h"
+#include "../../tree.h"
+#include "mem-adapter.h"
+
+namespace
+{
+  std::vector<tree_parser::triplet> parse(std::string_view text)
+  {
+    std::vector<tree_parser::triplet> nodes;
+    tree_parser::parse(text, [&nodes](auto node)
+                       { nodes.push_back(node); });
+    return nodes;
+  }
+
+  // The message check_tree throws, or empty if it doesn't.
+  std::string problem(std::string_view text)
+  {
+    try
+    {
+      check_tree(parse(text));
+    }
+    catch (std::runtime_error const &e)
+    {
+      return e.what();
+    }
+    return {};
+  }
+}
+
+TEST(tree_check, accepts_trees_in_any_order)
+{
+  EXPECT_EQ(problem("[5<10>15][5>7][13<15][11<13>14]"), "");
+  EXPECT_EQ(problem("[11<13>14][13<15][5>7][5<10>15]"), "");
+  EXPECT_EQ(problem("[1]"), "");
+  // the same child bound again
+  EXPECT_EQ(problem("[1<2][1<2>3]"), "");
+}
+
+TEST(tree_check, refuses_what_isnt_one_tree)
+{
+  EXPECT_EQ(problem("[1<2>3][2<1]"), "Cycle through node 2.");
+  EXPECT_EQ(problem("[2<1][1<2]"), "Cycle through node 1.");
+  EXPECT_EQ(problem("[1<2][2<3][3<1]"), "Cycle through node 3.");
+  EXPECT_EQ(problem("[1<2][1<3]"), "Node 1 has two parents.");
+  EXPECT_EQ(problem("[1<2][2>1]"), "Node 1 has two parents.");
+  EXPECT_EQ(problem("[1<2][3<2]"), "Node 2 has two left children.");
+  EXPECT_EQ(problem("[2>1][2>3]"), "Node 2 has two right children.");
+  EXPECT_EQ(problem("[1<2][3<4]"), "Not a single tree: 2 roots.");
+  EXPECT_EQ(problem(""), "Empty tree.");
+}
+
+TEST(tree_check, checks_long_chains)
+{
+  std::string text;
+  for (int i{1}; i < 100000; ++i)
+  {
+    text += "[" + std::to_string(i + 1) + "<" + std::to_string(i) + "]";
+  }
+  EXPECT_EQ(problem(text), "");
+  EXPECT_EQ(problem(text + "[1<100000]"), "Cycle through node 1.");
+}
+
+TEST(tree_check, nothing_is_stored_unless_it_is_a_tree)
+{
+  mem_adapter data;
+  EXPECT_THROW(tree<size_t>::parse(data, "[1<2>3][2<1]"), std::runtime_error);
+  EXPECT_THROW(tree<size_t>::parse(data, "[1<2][1<3]"), std::runtime_error);
+  EXPECT_EQ(tree<size_t>::parse(data, "[1<2>3]").id(), 0);
+}
+
+TEST(tree_check, walks_end_on_a_stored_cycle)
+{
+  mem_adapter data;
+  tree<size_t> t{data.new_tree()};
+  auto const one{data.ensure_node(t.id(), 1)}, two{data.ensure_node(t.id(), 2)};
+  data.bind_left(one, two);
+  data.bind_left(two, one);
+  EXPECT_THROW(t.find_common_ancestor(data, 1, 2), std::runtime_error);
+}
+
+TEST(tree_check, guards_walks_without_keeping_the_nodes)
+{
+  // a path of 1000 nodes, then one into a cycle of 37 after 11 steps
+  cycle_guard<int> path;
+  for (int node{1}; node <= 1000; ++node)
+  {
+    path.step(node);
+  }
+  cycle_guard<int> looping;
+  int steps{};
+  EXPECT_THROW(for (;; ++steps) looping.step(steps < 11 ? steps + 1 : 12 + (steps - 11) % 37), std::runtime_error);
+  EXPECT_LE(steps, 3 * (11 + 37));
+}
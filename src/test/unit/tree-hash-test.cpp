@@ -0,0 +1,34 @@
+#include <gtest/gtest.h>
+#include "../../tree-hash.h"
+
+namespace
+{
+  std::vector<tree_parser::triplet> parse(std::string_view text)
+  {
+    std::vector<tree_parser::triplet> triplets;
+    tree_parser::parse(text, [&triplets](auto node)
+                       { triplets.push_back(node); });
+    return triplets;
+  }
+}
+
+TEST(tree_hash, xxh64_matches_the_reference)
+{
+  EXPECT_EQ(xxh64(""), 0xEF46DB3751D8E999ULL);
+  EXPECT_EQ(xxh64("abc"), 0x44BC2CF5AD770999ULL);
+  EXPECT_EQ(xxh64("Nobody inspects the spammish repetition"), 0xFBCEA83C8A378BF1ULL);
+  EXPECT_NE(xxh64("abc", 1), xxh64("abc"));
+  std::string const longer(1000, 'x');
+  EXPECT_NE(xxh64(longer), xxh64(longer.substr(1)));
+}
+
+TEST(tree_hash, canonical_form_ignores_how_a_tree_is_written)
+{
+  auto const h{canonical_tree_hash(parse("[5<10>15][5>7][13<15][11<13>14]"))};
+  EXPECT_EQ(canonical_tree_hash(parse("[11<13>14][13<15][5>7][5<10>15]")), h);
+  EXPECT_EQ(canonical_tree_hash(parse("[5<10>15][5>7][13<15][11<13>14][7][11<13]")), h);
+  // a child on the other side, or a node more, is another tree
+  EXPECT_NE(canonical_tree_hash(parse("[5<10>15][5>7][13<15][11<13>14][14>16]")), h);
+  EXPECT_NE(canonical_tree_hash(parse("[5<10>15][7<5][13<15][11<13>14]")), h);
+  EXPECT_NE(canonical_tree_hash(parse("[1<2]")), canonical_tree_hash(parse("[2>1]")));
+}
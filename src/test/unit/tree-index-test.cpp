@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include "../../tree-index.h"
+
+namespace
+{
+  // [5<10>15][5>7][13<15][11<13>14]
+  flat_tree sample()
+  {
+    flat_tree t;
+    t.add(10, 5, 15);
+    t.add(5, {}, 7);
+    t.add(15, 13, {});
+    t.add(13, 11, 14);
+    return t;
+  }
+}
+
+TEST(tree_index, depths_and_ancestors)
+{
+  tree_index index{sample()};
+  EXPECT_EQ(index.size(), 7);
+  EXPECT_EQ(index.depth(10), 0);
+  EXPECT_EQ(index.depth(14), 3);
+  EXPECT_EQ(index.ancestor(14, 0), 14);
+  EXPECT_EQ(index.ancestor(14, 1), 13);
+  EXPECT_EQ(index.ancestor(14, 3), 10);
+  EXPECT_THROW(index.ancestor(14, 4), std::runtime_error);
+  EXPECT_THROW(index.depth(99), std::runtime_error);
+}
+
+TEST(tree_index, common_ancestor_and_distance)
+{
+  tree_index index{sample()};
+  EXPECT_EQ(index.common_ancestor(11, 14), 13);
+  EXPECT_EQ(index.common_ancestor(7, 14), 10);
+  EXPECT_EQ(index.common_ancestor(15, 14), 15);
+  EXPECT_EQ(index.distance(11, 14), 2);
+  EXPECT_EQ(index.distance(7, 14), 5);
+  EXPECT_EQ(index.distance(10, 10), 0);
+  EXPECT_TRUE(index.is_ancestor(10, 11));
+  EXPECT_TRUE(index.is_ancestor(13, 13));
+  EXPECT_FALSE(index.is_ancestor(5, 11));
+}
+
+TEST(tree_index, forest_and_cycles)
+{
+  flat_tree forest;
+  forest.add(15, 10, 20);
+  forest.add(115, 110, 120);
+  tree_index index{forest};
+  EXPECT_THROW(index.common_ancestor(10, 120), std::runtime_error);
+  EXPECT_FALSE(index.is_ancestor(15, 120));
+
+  flat_tree cycle;
+  cycle.add(1, 2, {});
+  cycle.add(2, 1, {});
+  EXPECT_THROW(tree_index{cycle}, std::runtime_error);
+}
+
+TEST(tree_index, common_ancestor_of_a_set)
+{
+  tree_index index{sample()};
+  EXPECT_EQ(index.common_ancestor(std::vector<int>{11, 14}), 13);
+  EXPECT_EQ(index.common_ancestor(std::vector<int>{14, 11, 13}), 13);
+  EXPECT_EQ(index.common_ancestor(std::vector<int>{11, 14, 7}), 10);
+  EXPECT_EQ(index.common_ancestor(std::vector<int>{14}), 14);
+  EXPECT_THROW(index.common_ancestor(std::vector<int>{}), std::runtime_error);
+}
+
+namespace
+{
+  // A random binary tree over shuffled values, with a long chain hanging
+  // off it so some levels are deep and narrow.
+  flat_tree random_tree(int nodes, unsigned seed)
+  {
+    std::mt19937 rng{seed};
+    std::vector<int> values(nodes);
+    std::iota(values.begin(), values.end(), 1);
+    std::shuffle(values.begin(), values.end(), rng);
+    flat_tree t;
+    t.ensure(values[0]);
+    std::vector<int> open{values[0], values[0]};
+    int next{1};
+    for (; next < nodes * 3 / 4; ++next)
+    {
+      std::uniform_int_distribution<size_t> pick{0, open.size() - 1};
+      auto const slot{pick(rng)};
+      auto const parent{open[slot]};
+      open[slot] = open.back();
+      open.pop_back();
+      t.add(parent, values[next], {});
+      open.push_back(values[next]);
+      open.push_back(values[next]);
+    }
+    for (; next < nodes; ++next)
+    {
+      t.add(values[next - 1], {}, values[next]);
+    }
+    return t;
+  }
+}
+
+TEST(tree_index, parallel_build_matches_sequential)
+{
+  thread_pool pool{4};
+  auto const t{random_tree(60000, 7)};
+  tree_index sequential{t}, parallel{t, pool};
+  ASSERT_EQ(parallel.size(), sequential.size());
+  std::mt19937 rng{11};
+  std::uniform_int_distribution<int> value{1, 60000};
+  for (int i{}; i < 2000; ++i)
+  {
+    auto const a{value(rng)}, b{value(rng)}, c{value(rng)};
+    ASSERT_EQ(parallel.depth(a), sequential.depth(a));
+    ASSERT_EQ(parallel.ancestor(a, sequential.depth(a) / 2), sequential.ancestor(a, sequential.depth(a) / 2));
+    ASSERT_EQ(parallel.distance(a, b), sequential.distance(a, b));
+    ASSERT_EQ(parallel.is_ancestor(a, b), sequential.is_ancestor(a, b));
+    ASSERT_EQ(parallel.common_ancestor(std::vector<int>{a, b, c}), sequential.common_ancestor(std::vector<int>{a, b, c}));
+  }
+}
+
+TEST(tree_index, parallel_build_of_forests_and_cycles)
+{
+  thread_pool pool{2};
+  flat_tree forest;
+  forest.add(15, 10, 20);
+  forest.add(115, 110, 120);
+  tree_index index{forest, pool};
+  EXPECT_EQ(index.depth(120), 1);
+  EXPECT_THROW(index.common_ancestor(10, 120), std::runtime_error);
+
+  flat_tree cycle;
+  cycle.add(1, 2, {});
+  cycle.add(2, 3, {});
+  cycle.add(3, 1, {});
+  EXPECT_THROW((tree_index{cycle, pool}), std::runtime_error);
+}
+
+TEST(tree_index, parallel_build_stops_on_a_cycle_within_its_rounds)
+{
+  thread_pool pool{2};
+  // a path just long enough to need every round
+  for (int length : {1, 2, 3, 4, 5, 4096, 4097, 70000})
+  {
+    flat_tree path;
+    for (int value{1}; value < length; ++value)
+    {
+      path.add(value, value + 1, {});
+    }
+    if (length == 1)
+    {
+      path.add(1, {}, {});
+    }
+    tree_index index{path, pool};
+    EXPECT_EQ(index.depth(length), length - 1);
+  }
+  // and one leading into a long cycle, whose depths would overflow if the
+  // rounds weren't bounded
+  flat_tree looped;
+  for (int value{1}; value < 70000; ++value)
+  {
+    looped.add(value, value + 1, {});
+  }
+  looped.add(70000, 60000, {});
+  EXPECT_THROW((tree_index{looped, pool}), std::runtime_error);
+}
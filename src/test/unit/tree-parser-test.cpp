@@ -72,3 +72,50 @@ TEST(tree_parser, from_test) {
   });
   EXPECT_EQ(current, expected + sizeof(expected)/ sizeof(*expected));
 }
+
+TEST(tree_parser, parallel_matches_sequential) {
+  std::string text;
+  for (int i{}; i < 2000; ++i) {
+    text += "[" + std::to_string(3 * i + 1) + "<" + std::to_string(3 * i + 2) + ">" + std::to_string(3 * i + 3) + "]";
+    if (i % 7 == 0) {
+      text += "[" + std::to_string(3 * i + 3) + "]";
+    }
+  }
+  std::vector<tree_parser::triplet> sequential, parallel;
+  tree_parser::parse(text, [&sequential](auto t){ sequential.push_back(t); });
+  thread_pool pool{4};
+  tree_parser::parse_parallel(text, [&parallel](auto t){ parallel.push_back(t); }, pool, 64);
+  ASSERT_EQ(parallel.size(), sequential.size());
+  for (size_t i{}; i < sequential.size(); ++i) {
+    EXPECT_EQ(parallel[i].left, sequential[i].left);
+    EXPECT_EQ(parallel[i].value, sequential[i].value);
+    EXPECT_EQ(parallel[i].right, sequential[i].right);
+  }
+}
+
+TEST(tree_parser, parallel_reports_the_first_error) {
+  std::string text;
+  for (int i{1}; i < 200; ++i) {
+    text += "[" + std::to_string(i) + "]";
+  }
+  text += "[1<2<3]";
+  text += text;
+  std::string expected;
+  try {
+    tree_parser::parse(text, [](auto){});
+  }
+  catch (std::runtime_error const &e) {
+    expected = e.what();
+  }
+  ASSERT_NE(expected.find(" at 3][1]"), std::string::npos);
+  thread_pool pool{3};
+  int delivered{};
+  try {
+    tree_parser::parse_parallel(text, [&delivered](auto){ ++delivered; }, pool, 50);
+    FAIL();
+  }
+  catch (std::runtime_error const &e) {
+    EXPECT_EQ(e.what(), expected);
+  }
+  EXPECT_EQ(delivered, 199);
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <climits>
+#include "../../tree-stream.h"
+
+namespace
+{
+  std::vector<tree_parser::triplet> sample()
+  {
+    return {{5, 10, 15}, {{}, 5, 7}, {13, 15, {}}, {11, 13, 14}, {{}, 7, {}}, {0, INT_MAX, 1}};
+  }
+
+  std::string encode(tree_format format)
+  {
+    tree_encoder encoder{format};
+    auto result{encoder.header()};
+    for (auto const &node : sample())
+    {
+      encoder.add(node, result);
+    }
+    return result;
+  }
+
+  bool same(std::vector<tree_parser::triplet> const &a, std::vector<tree_parser::triplet> const &b)
+  {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](auto const &x, auto const &y)
+                      { return x.left == y.left && x.value == y.value && x.right == y.right; });
+  }
+}
+
+TEST(tree_stream, text_is_the_bracket_grammar)
+{
+  EXPECT_EQ(encode(tree_format::text), "[5<10>15][5>7][13<15][11<13>14][7][0<2147483647>1]");
+}
+
+TEST(tree_stream, round_trips_whatever_the_pieces)
+{
+  for (auto format : {tree_format::text, tree_format::binary})
+  {
+    auto const encoded{encode(format)};
+    for (size_t piece{1}; piece <= encoded.size(); ++piece)
+    {
+      std::vector<tree_parser::triplet> decoded;
+      tree_decoder decoder;
+      auto const collect = [&decoded](auto node)
+      { decoded.push_back(node); };
+      for (size_t at{}; at < encoded.size(); at += piece)
+      {
+        decoder.feed(std::string_view{encoded}.substr(at, piece), collect);
+      }
+      decoder.finish(collect);
+      EXPECT_TRUE(same(decoded, sample())) << "piece " << piece;
+    }
+  }
+}
+
+TEST(tree_stream, binary_takes_any_int)
+{
+  tree_encoder encoder{tree_format::binary};
+  auto encoded{encoder.header()};
+  encoder.add({-3, INT_MIN, INT_MAX}, encoded);
+  std::vector<tree_parser::triplet> decoded;
+  tree_decoder decoder;
+  decoder.feed(encoded, [&decoded](auto node)
+               { decoded.push_back(node); });
+  EXPECT_TRUE(same(decoded, {{-3, INT_MIN, INT_MAX}}));
+}
+
+TEST(tree_stream, binary_is_compact)
+{
+  EXPECT_LT(encode(tree_format::binary).size(), encode(tree_format::text).size());
+}
+
+TEST(tree_stream, truncated_input_throws)
+{
+  auto const encoded{encode(tree_format::binary)};
+  tree_decoder decoder;
+  decoder.feed(std::string_view{encoded}.substr(0, encoded.size() - 1), [](auto) {});
+  EXPECT_THROW(decoder.finish([](auto) {}), std::runtime_error);
+}
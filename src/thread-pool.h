@@ -0,0 +1,210 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+// Worker threads with a job deque each. A worker runs its own newest job
+// first and, when out of work, steals the oldest job of another worker;
+// jobs submitted from outside are spread round robin. Threads waiting on
+// the pool help run jobs instead of blocking, so nested parallel work can't
+// starve it.
+class thread_pool
+{
+public:
+  explicit thread_pool(size_t threads = default_size())
+      : queues_(std::max<size_t>(threads, 1))
+  {
+    for (size_t i{}; i < queues_.size(); ++i)
+    {
+      workers_.emplace_back([this, i]
+                            { work(i); });
+    }
+  }
+
+  thread_pool(thread_pool const &) = delete;
+  thread_pool(thread_pool &&) = delete;
+
+  ~thread_pool()
+  {
+    {
+      std::lock_guard lock{sleep_mutex_};
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto &w : workers_)
+    {
+      w.join();
+    }
+  }
+
+  static size_t default_size() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+  // One pool for the whole process, sized to the machine.
+  static thread_pool &shared()
+  {
+    static thread_pool pool;
+    return pool;
+  }
+
+  size_t size() const { return workers_.size(); }
+
+  template <typename F>
+  auto submit(F f) -> std::future<decltype(f())>
+  {
+    auto task{std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f))};
+    auto result{task->get_future()};
+    auto const target{current_pool_ == this ? current_index_ : next_queue_++ % queues_.size()};
+    // counted first, so a thief taking the job can't take the count below 0
+    {
+      std::lock_guard lock{sleep_mutex_};
+      ++pending_;
+    }
+    {
+      std::lock_guard lock{queues_[target].mutex};
+      queues_[target].jobs.emplace_back([this, task]
+                                        {
+                                          (*task)();
+                                          finished(); });
+    }
+    wake_.notify_one();
+    return result;
+  }
+
+  // Waits for the future of a job of this pool, running pool jobs
+  // meanwhile, and sleeping while there are none.
+  template <typename T>
+  T wait(std::future<T> &f)
+  {
+    auto const ready = [&f]
+    { return f.wait_for(std::chrono::seconds::zero()) == std::future_status::ready; };
+    while (!ready())
+    {
+      if (run_one())
+      {
+        continue;
+      }
+      std::unique_lock lock{sleep_mutex_};
+      ++waiting_;
+      wake_.wait(lock, [this, &ready]
+                 { return pending_ > 0 || ready(); });
+      --waiting_;
+    }
+    return f.get();
+  }
+
+  // Calls fn(begin, end) over slices of [0, n) of at least grain items, in
+  // parallel, and returns once all of them are done.
+  template <typename F>
+  void parallel_for(size_t n, size_t grain, F const &fn)
+  {
+    auto const slices{std::min(std::max<size_t>(n / std::max<size_t>(grain, 1), 1), 4 * size())};
+    if (slices <= 1)
+    {
+      fn(size_t{}, n);
+      return;
+    }
+    std::vector<std::future<void>> done;
+    for (size_t s{1}; s < slices; ++s)
+    {
+      done.push_back(submit([&fn, begin = n * s / slices, end = n * (s + 1) / slices]
+                            { fn(begin, end); }));
+    }
+    fn(size_t{}, n / slices);
+    for (auto &d : done)
+    {
+      wait(d);
+    }
+  }
+
+private:
+  struct queue
+  {
+    std::mutex mutex;
+    std::deque<std::function<void()>> jobs;
+  };
+
+  bool run_one()
+  {
+    std::function<void()> job;
+    auto const own{current_pool_ == this ? current_index_ : 0};
+    for (size_t i{}; i < queues_.size() && !job; ++i)
+    {
+      auto &q{queues_[(own + i) % queues_.size()]};
+      std::lock_guard lock{q.mutex};
+      if (q.jobs.empty())
+      {
+        continue;
+      }
+      if (i == 0 && current_pool_ == this)
+      {
+        job = std::move(q.jobs.back());
+        q.jobs.pop_back();
+      }
+      else
+      {
+        job = std::move(q.jobs.front());
+        q.jobs.pop_front();
+      }
+    }
+    if (!job)
+    {
+      return false;
+    }
+    {
+      std::lock_guard lock{sleep_mutex_};
+      --pending_;
+    }
+    job();
+    return true;
+  }
+
+  // Wakes those waiting for a job to be done, if any.
+  void finished()
+  {
+    std::lock_guard lock{sleep_mutex_};
+    if (waiting_ > 0)
+    {
+      wake_.notify_all();
+    }
+  }
+
+  void work(size_t index)
+  {
+    current_pool_ = this;
+    current_index_ = index;
+    for (;;)
+    {
+      if (run_one())
+      {
+        continue;
+      }
+      std::unique_lock lock{sleep_mutex_};
+      wake_.wait(lock, [this]
+                 { return stopping_ || pending_ > 0; });
+      if (stopping_ && pending_ == 0)
+      {
+        return;
+      }
+    }
+  }
+
+  static inline thread_local thread_pool *current_pool_{};
+  static inline thread_local size_t current_index_{};
+
+  std::vector<queue> queues_;
+  std::atomic<size_t> next_queue_{};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  size_t pending_{};
+  // threads in wait
+  size_t waiting_{};
+  bool stopping_{};
+  std::vector<std::thread> workers_;
+};
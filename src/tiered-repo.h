@@ -0,0 +1,373 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include "task.h"
+#include "rcu.h"
+#include "async-repo.h"
+#include "tree-query.h"
+
+// When trees move between the tiers of a tiered_repo.
+struct tier_policy
+{
+  using duration = std::chrono::steady_clock::duration;
+
+  // queries within window that make a tree hot
+  size_t promote_after{3};
+  duration window{std::chrono::minutes{1}};
+  // a hot tree not queried for this long goes back to storage only
+  duration idle{std::chrono::minutes{10}};
+  // beyond which the least recently queried hot trees go
+  size_t max_hot{4096};
+};
+
+struct tier_stats
+{
+  uint64_t hot_hits;
+  uint64_t cold_hits;
+  uint64_t promotions;
+  uint64_t demotions;
+  size_t hot_trees;
+
+  std::string json() const
+  {
+    return "{\"hot\":{\"trees\":" + std::to_string(hot_trees) + ",\"hits\":" + std::to_string(hot_hits) +
+           "},\"cold\":{\"hits\":" + std::to_string(cold_hits) + "},\"promotions\":" + std::to_string(promotions) +
+           ",\"demotions\":" + std::to_string(demotions) + '}';
+  }
+};
+
+// Repos that may hold the query index of a tree in memory.
+template <typename R>
+concept tiered_async_repo = async_repo<R> && requires(R r, typename R::tree_key_t tree_id, int (&f)(std::shared_ptr<query_index_t const> const &), std::shared_ptr<query_index_t const> index) {
+  { r.with_hot(tree_id, f) } -> std::same_as<std::optional<int>>;
+  { r.keep_hot(tree_id, index) } -> std::same_as<std::shared_ptr<query_index_t const>>;
+};
+
+// An async_repo keeping the trees queried most in memory, compiled to their
+// query index, and the rest in the wrapped repo only. A tree queried
+// promote_after times within a window is compiled on the compute executor,
+// while the query that tipped it over is answered from storage, unless that
+// query builds the index itself, as path queries do, when it is kept. A tree
+// goes back to storage once idle, as a sweep every second finds, queries or
+// not. Trees are only changed while being
+// created, so creating one just drops what is known about it. Hot trees are
+// published in an rcu_map, so queries of them take no lock, and ingestion,
+// promotions and demotions never hold them up.
+template <async_repo repo_t>
+class tiered_repo
+{
+public:
+  using node_key_t = typename repo_t::node_key_t;
+  using tree_key_t = typename repo_t::tree_key_t;
+  using index_ptr_t = std::shared_ptr<query_index_t const>;
+  using clock_t = std::function<std::chrono::steady_clock::time_point()>;
+
+  tiered_repo(repo_t &cold, executor &compute, tier_policy policy = {},
+              size_t succinct_threshold = default_succinct_threshold, clock_t now = std::chrono::steady_clock::now)
+      : cold_{cold}, compute_{compute}, policy_{policy}, succinct_threshold_{succinct_threshold}, now_{std::move(now)},
+        touch_resolution_{std::min<tier_policy::duration>(sweep_interval, policy.idle / 16)}
+  {
+    sweeper_ = std::thread{[this]
+                           { sweep_periodically(); }};
+  }
+
+  tiered_repo(tiered_repo const &) = delete;
+
+  // promotions hold on to this
+  ~tiered_repo()
+  {
+    std::unique_lock lock{mutex_};
+    stopping_ = true;
+    stop_sweeping_.notify_all();
+    lock.unlock();
+    sweeper_.join();
+    lock.lock();
+    promoted_.wait(lock, [this]
+                   { return promoting_ == 0; });
+  }
+
+  task<node_key_t> get_parent_by_id(node_key_t node_id) { return cold_.get_parent_by_id(node_id); }
+
+  // What is known of a tree is dropped as its creation starts and once it
+  // ends, with commit_tree or drop_tree, rather than at every node added.
+  task<tree_key_t> new_tree()
+  {
+    auto const tree_id{co_await cold_.new_tree()};
+    forget(tree_id);
+    co_return tree_id;
+  }
+
+  task<node_key_t> ensure_node(tree_key_t tree_id, int value) { return cold_.ensure_node(tree_id, value); }
+
+  task<int> get_value_by_id(node_key_t node_id) { return cold_.get_value_by_id(node_id); }
+
+  task<node_key_t> get_id_by_value(tree_key_t tree_id, int value) { return cold_.get_id_by_value(tree_id, value); }
+
+  task<void> bind_left(node_key_t node, node_key_t left) { return cold_.bind_left(node, left); }
+
+  task<void> bind_right(node_key_t node, node_key_t right) { return cold_.bind_right(node, right); }
+
+  task<flat_tree> flatten(tree_key_t tree_id) { return cold_.flatten(tree_id); }
+
+  task<void> create_tree(tree_key_t tree_id)
+  {
+    forget(tree_id);
+    return cold_.create_tree(tree_id);
+  }
+
+  task<void> add_nodes(tree_key_t tree_id, std::vector<tree_parser::triplet> nodes) { return cold_.add_nodes(tree_id, std::move(nodes)); }
+
+  // Even over a repo that doesn't commit, so that every creation ends here.
+  task<void> commit_tree(tree_key_t tree_id)
+  {
+    if constexpr (committing_repo<repo_t>)
+    {
+      co_await cold_.commit_tree(tree_id);
+    }
+    forget(tree_id);
+  }
+
+  task<void> drop_tree(tree_key_t tree_id)
+  {
+    co_await cold_.drop_tree(tree_id);
+    forget(tree_id);
+  }
+
+  task<std::optional<tree_key_t>> find_tree_by_hash(uint64_t hash)
+    requires deduplicating_repo<repo_t>
+  {
+    return cold_.find_tree_by_hash(hash);
+  }
+
+  task<void> remember_tree_hash(uint64_t hash, tree_key_t tree_id)
+    requires deduplicating_repo<repo_t>
+  {
+    return cold_.remember_tree_hash(hash, tree_id);
+  }
+
+  task<std::vector<tree_parser::triplet>> nodes_after(tree_key_t tree_id, std::optional<int> after, size_t limit)
+  {
+    return cold_.nodes_after(tree_id, after, limit);
+  }
+
+  // What f returns for the index of the tree if it is hot, counting a
+  // query of it either way. Never waits on storage, and while the tree is
+  // hot takes no lock: f is called on the index as published, and must not
+  // keep a reference to it, only a copy of the pointer.
+  template <typename F>
+  auto with_hot(tree_key_t tree_id, F f) -> std::optional<std::invoke_result_t<F, index_ptr_t const &>>
+  {
+    auto const now{now_()};
+    sweep(now);
+    auto result{hot_.read(tree_id, [this, now, &f](hot_tree const &tree)
+                          {
+                            hot_hits_.add();
+                            // written seldom, so the line stays shared
+                            if (now - tree.last_used.load(std::memory_order_relaxed) >= touch_resolution_)
+                            {
+                              tree.last_used.store(now, std::memory_order_relaxed);
+                            }
+                            return f(tree.index); })};
+    if (!result)
+    {
+      cold_hit(tree_id, now);
+    }
+    return result;
+  }
+
+  // Makes the tree hot with an index a cold query had to build anyway, if
+  // its queries, that one counted by with_hot, call for a promotion, rather
+  // than have it built again. Returns the index the tree has, or was given.
+  // A promotion under way is dropped.
+  index_ptr_t keep_hot(tree_key_t tree_id, index_ptr_t index)
+  {
+    std::lock_guard lock{mutex_};
+    auto const pos{heat_.find(tree_id)};
+    if (pos == heat_.end() || pos->second.count < policy_.promote_after)
+    {
+      return index;
+    }
+    auto const tree{std::make_shared<hot_tree const>(std::move(index), now_())};
+    auto const kept{hot_.emplace(tree_id, tree)};
+    if (kept == tree)
+    {
+      heat_.erase(tree_id);
+      ++promotions_;
+      shrink_to(policy_.max_hot);
+    }
+    return kept->index;
+  }
+
+  // The index of the tree if it is hot, or nullptr, as with_hot.
+  index_ptr_t hot(tree_key_t tree_id)
+  {
+    return with_hot(tree_id, [](index_ptr_t const &index)
+                    { return index; })
+        .value_or(nullptr);
+  }
+
+  tier_stats stats() const
+  {
+    std::lock_guard lock{mutex_};
+    return {hot_hits_.sum(), cold_hits_, promotions_, demotions_, hot_.size()};
+  }
+
+private:
+  struct hot_tree
+  {
+    hot_tree(index_ptr_t index, std::chrono::steady_clock::time_point last_used) : index{std::move(index)}, last_used{last_used} {}
+
+    index_ptr_t index;
+    // only ever later, give or take touch_resolution_
+    mutable std::atomic<std::chrono::steady_clock::time_point> last_used;
+  };
+
+  // queries of a cold tree in the current window
+  struct heat
+  {
+    size_t count{};
+    std::chrono::steady_clock::time_point since{};
+    // of the promotion under way, if any
+    uint64_t promotion{};
+  };
+
+  // Idle trees are looked for at most this often.
+  static constexpr std::chrono::seconds sweep_interval{1};
+
+  void cold_hit(tree_key_t tree_id, std::chrono::steady_clock::time_point now)
+  {
+    std::unique_lock lock{mutex_};
+    ++cold_hits_;
+    auto &h{heat_[tree_id]};
+    if (h.count == 0 || now - h.since > policy_.window)
+    {
+      h.count = 0;
+      h.since = now;
+    }
+    if (++h.count >= policy_.promote_after && h.promotion == 0)
+    {
+      auto const promotion{h.promotion = ++last_promotion_};
+      ++promoting_;
+      lock.unlock();
+      promote(tree_id, promotion);
+    }
+  }
+
+  void promote(tree_key_t tree_id, uint64_t promotion)
+  {
+    spawn(compute_, compile(tree_id),
+          [this, tree_id, promotion](std::optional<index_ptr_t> index, std::exception_ptr error)
+          {
+            std::lock_guard lock{mutex_};
+            auto pos{heat_.find(tree_id)};
+            // the tree changed meanwhile, or is gone
+            if (pos != heat_.end() && pos->second.promotion == promotion)
+            {
+              heat_.erase(pos);
+              if (!error)
+              {
+                hot_.insert(tree_id, std::make_shared<hot_tree const>(std::move(*index), now_()));
+                ++promotions_;
+                shrink_to(policy_.max_hot);
+              }
+            }
+            if (--promoting_ == 0)
+            {
+              promoted_.notify_all();
+            }
+          });
+  }
+
+  task<index_ptr_t> compile(tree_key_t tree_id)
+  {
+    co_return build_query_index(co_await cold_.flatten(tree_id), succinct_threshold_);
+  }
+
+  void forget(tree_key_t tree_id)
+  {
+    std::lock_guard lock{mutex_};
+    heat_.erase(tree_id);
+    hot_.erase(tree_id);
+  }
+
+  // So idle trees go, and their memory with them, once queries stop.
+  void sweep_periodically()
+  {
+    std::unique_lock lock{mutex_};
+    while (!stop_sweeping_.wait_for(lock, sweep_interval, [this]
+                                    { return stopping_; }))
+    {
+      lock.unlock();
+      sweep(now_());
+      lock.lock();
+    }
+  }
+
+  // By whichever query, or the sweeper, finds it due first; the others go
+  // on.
+  void sweep(std::chrono::steady_clock::time_point now)
+  {
+    auto last{last_sweep_.load(std::memory_order_relaxed)};
+    if (now - last < sweep_interval || !last_sweep_.compare_exchange_strong(last, now))
+    {
+      return;
+    }
+    std::lock_guard lock{mutex_};
+    demotions_ += hot_.erase_if([this, now](tree_key_t, hot_tree const &tree)
+                                { return now - tree.last_used.load(std::memory_order_relaxed) > policy_.idle; });
+    std::erase_if(heat_, [this, now](auto const &entry)
+                  { return entry.second.promotion == 0 && now - entry.second.since > policy_.window; });
+  }
+
+  // Demotes the least recently queried hot trees beyond size.
+  void shrink_to(size_t size)
+  {
+    if (hot_.size() <= size)
+    {
+      return;
+    }
+    std::vector<std::pair<std::chrono::steady_clock::time_point, tree_key_t>> by_use;
+    by_use.reserve(hot_.size());
+    hot_.for_each([&by_use](tree_key_t tree_id, hot_tree const &tree)
+                  { by_use.emplace_back(tree.last_used.load(std::memory_order_relaxed), tree_id); });
+    auto const excess{static_cast<std::ptrdiff_t>(hot_.size() - size)};
+    std::nth_element(by_use.begin(), by_use.begin() + excess, by_use.end());
+    for (auto i{by_use.begin()}; i != by_use.begin() + excess; ++i)
+    {
+      hot_.erase(i->second);
+      ++demotions_;
+    }
+  }
+
+  repo_t &cold_;
+  executor &compute_;
+  tier_policy policy_;
+  size_t succinct_threshold_;
+  clock_t now_;
+  tier_policy::duration touch_resolution_;
+  // for cold trees and changes; hot trees are read without it
+  mutable std::mutex mutex_;
+  std::condition_variable promoted_;
+  rcu_map<tree_key_t, hot_tree> hot_;
+  std::unordered_map<tree_key_t, heat> heat_;
+  std::atomic<std::chrono::steady_clock::time_point> last_sweep_{};
+  uint64_t last_promotion_{};
+  size_t promoting_{};
+  striped_counter hot_hits_;
+  uint64_t cold_hits_{};
+  uint64_t promotions_{};
+  uint64_t demotions_{};
+  bool stopping_{};
+  std::condition_variable stop_sweeping_;
+  std::thread sweeper_;
+};
@@ -0,0 +1,350 @@
+#pragma once
+#include <string_view>
+#include <vector>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TREE_SCANNER_X86
+#endif
+
+enum token_type
+{
+  open_node,
+  value,
+  right_arrow,
+  left_arrow,
+  close_node,
+  end_of_file,
+  invalid
+};
+
+struct token
+{
+  token_type t;
+  int token_value;
+  // offset just past the token in the scanned text
+  size_t end;
+
+  static token next(std::string_view &text)
+  {
+    if (text.size() == 0)
+    {
+      return {token_type::end_of_file, 0, 0};
+    }
+    token result;
+    if (std::isdigit(text.front()))
+    {
+      result.t = token_type::value;
+      result.token_value = text.front() - '0';
+      for (text = {text.data() + 1, text.size() - 1}; !text.empty() && std::isdigit(text.front()); text = {text.data() + 1, text.size() - 1})
+      {
+        result.token_value *= 10;
+        result.token_value += text.front() - '0';
+      }
+    }
+    else
+    {
+      switch (text.front())
+      {
+      case '[':
+        result.t = token_type::open_node;
+        break;
+      case ']':
+        result.t = token_type::close_node;
+        break;
+      case '<':
+        result.t = token_type::left_arrow;
+        break;
+      case '>':
+        result.t = token_type::right_arrow;
+        break;
+
+      default:
+        result.t = token_type::invalid;
+        break;
+      }
+      text = {text.data() + 1, text.size() - 1};
+    }
+    return result;
+  }
+};
+
+// Turns tree text into tokens a stretch at a time. The vector paths find the
+// digits of 64 bytes per step as a bit mask, so every token boundary comes
+// from bit arithmetic; runs of digits are converted eight at a time with SWAR
+// multiply-adds and token types come from a byte table, without branching.
+// The scalar path is token::next.
+class token_scanner
+{
+public:
+  enum class isa
+  {
+    scalar,
+    sse42,
+    avx2
+  };
+
+  static isa best_isa()
+  {
+#if defined(TREE_SCANNER_X86)
+    static isa const best{__builtin_cpu_supports("avx2")     ? isa::avx2
+                          : __builtin_cpu_supports("sse4.2") ? isa::sse42
+                                                             : isa::scalar};
+    return best;
+#else
+    return isa::scalar;
+#endif
+  }
+
+  static bool supported(isa i)
+  {
+#if defined(TREE_SCANNER_X86)
+    return i <= best_isa();
+#else
+    return i == isa::scalar;
+#endif
+  }
+
+  explicit token_scanner(std::string_view text, isa use = best_isa())
+      : text_{text}, isa_{use}
+  {
+  }
+
+  // Replaces out with the tokens of the next stretch of text; false once the
+  // whole text has been scanned.
+  bool fill(std::vector<token> &out)
+  {
+    out.clear();
+    if (pos_ >= text_.size())
+    {
+      return false;
+    }
+    auto const stretch_end{std::min(text_.size(), pos_ + stretch)};
+    switch (isa_)
+    {
+#if defined(TREE_SCANNER_X86)
+    case isa::avx2:
+      scan_blocks<digits_avx2>(stretch_end, out);
+      break;
+    case isa::sse42:
+      scan_blocks<digits_sse42>(stretch_end, out);
+      break;
+#endif
+    default:
+      scan_scalar(stretch_end, out);
+      break;
+    }
+    return true;
+  }
+
+  static std::vector<token> scan_all(std::string_view text, isa use = best_isa())
+  {
+    std::vector<token> result, batch;
+    token_scanner scanner{text, use};
+    while (scanner.fill(batch))
+    {
+      result.insert(result.end(), batch.begin(), batch.end());
+    }
+    return result;
+  }
+
+private:
+  static constexpr size_t stretch{64 * 1024};
+  static constexpr size_t block{64};
+
+  void scan_scalar(size_t stretch_end, std::vector<token> &out)
+  {
+    std::string_view rest{text_.substr(pos_)};
+    while (pos_ < stretch_end)
+    {
+      auto t{token::next(rest)};
+      pos_ = text_.size() - rest.size();
+      t.end = pos_;
+      out.push_back(t);
+    }
+  }
+
+  template <uint64_t (*digits_in)(char const *)>
+  void scan_blocks(size_t stretch_end, std::vector<token> &out)
+  {
+    static auto const types{token_types()};
+    char padded[block + 8]{};
+    char const *const data{text_.data()};
+    auto const size{text_.size()};
+    // locals, so stores into out can't be taken to alias them
+    auto pos{pos_}, skip_until{skip_until_};
+    out.reserve(stretch_end - pos + 1);
+    while (pos < stretch_end)
+    {
+      auto const base{pos};
+      auto const length{std::min(block, size - base)};
+      char const *p{data + base};
+      if (size - base < sizeof(padded))
+      {
+        // near the end, work on a zero padded copy so loads stay in bounds
+        std::memset(padded, 0, sizeof(padded));
+        std::memcpy(padded, p, std::min(size - base, sizeof(padded)));
+        p = padded;
+      }
+      auto const valid{length == block ? ~uint64_t{} : (uint64_t{1} << length) - 1};
+      auto const digit{digits_in(p) & valid};
+      // a token starts at every non digit, and where each run of digits begins
+      auto boundaries{(valid & ~digit) | (digit & ~(digit << 1))};
+      // where each token ends: its last digit, or the symbol itself
+      auto const token_ends{(digit & ~(digit >> 1)) | ~digit};
+      if (skip_until > base)
+      {
+        // the tail of a run of digits that began in an earlier block
+        boundaries &= skip_until - base >= block ? 0 : ~uint64_t{} << (skip_until - base);
+      }
+      while (boundaries)
+      {
+        auto const bit{static_cast<size_t>(__builtin_ctzll(boundaries))};
+        boundaries &= boundaries - 1;
+        auto const is_digit{(digit >> bit) & 1};
+        auto const last{bit + static_cast<size_t>(__builtin_ctzll(token_ends >> bit))};
+        auto const run{last - bit + 1};
+        if (last == block - 1 || run > 16) [[unlikely]]
+        {
+          auto end{base + last + 1};
+          while (is_digit && end < size && data[end] >= '0' && data[end] <= '9')
+          {
+            ++end;
+          }
+          skip_until = end;
+          out.push_back({types[static_cast<unsigned char>(p[bit])], is_digit ? parse_digits(base + bit, end - base - bit) : 0, end});
+          continue;
+        }
+        // computed for symbols too and masked off, rather than branched around
+        uint64_t chunk;
+        std::memcpy(&chunk, p + bit, 8);
+        uint32_t parsed;
+        if (run <= 8)
+        {
+          parsed = parse_short(chunk, run);
+        }
+        else
+        {
+          uint64_t low;
+          std::memcpy(&low, p + bit + run - 8, 8);
+          parsed = parse_short(chunk, run - 8) * 100000000u + parse_eight_digits(low);
+        }
+        parsed &= 0 - static_cast<uint32_t>(is_digit);
+        out.push_back({types[static_cast<unsigned char>(p[bit])], static_cast<int>(parsed), base + last + 1});
+      }
+      pos = std::max(base + length, skip_until);
+    }
+    pos_ = pos;
+    skip_until_ = skip_until;
+  }
+
+  static std::array<token_type, 256> token_types()
+  {
+    std::array<token_type, 256> result;
+    result.fill(token_type::invalid);
+    for (auto c{'0'}; c <= '9'; ++c)
+    {
+      result[c] = token_type::value;
+    }
+    result['['] = token_type::open_node;
+    result[']'] = token_type::close_node;
+    result['<'] = token_type::left_arrow;
+    result['>'] = token_type::right_arrow;
+    return result;
+  }
+
+  // Up to eight digits at the start of chunk, the first in the lowest byte.
+  static uint32_t parse_short(uint64_t chunk, size_t n)
+  {
+    static constexpr uint64_t zeros[]{0x3030303030303030, 0x30303030303030, 0x303030303030, 0x3030303030, 0x30303030, 0x303030, 0x3030, 0x30, 0};
+    // keep the n digits as the high bytes, padded with leading zeros
+    return parse_eight_digits((chunk << (8 * (8 - n))) | zeros[n]);
+  }
+
+  // Eight ASCII digits, the most significant in the lowest byte.
+  static uint32_t parse_eight_digits(uint64_t chunk)
+  {
+    chunk -= 0x3030303030303030;
+    chunk = (chunk * 10) + (chunk >> 8);
+    chunk = (((chunk & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+             (((chunk >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >>
+            32;
+    return static_cast<uint32_t>(chunk);
+  }
+
+  // Accumulates modulo 2^32, as the scalar path does with overflowing ints.
+  int parse_digits(size_t at, size_t length) const
+  {
+    static constexpr uint32_t powers[]{1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+    char const *p{text_.data() + at};
+    if (length < 4)
+    {
+      // short runs are cheaper one digit at a time
+      uint32_t value{};
+      for (size_t i{}; i < length; ++i)
+      {
+        value = value * 10 + (p[i] - '0');
+      }
+      return static_cast<int>(value);
+    }
+    uint32_t value{};
+    while (length)
+    {
+      auto const n{std::min<size_t>(length, 8)};
+      uint64_t chunk;
+      if (p + 8 <= text_.data() + text_.size())
+      {
+        std::memcpy(&chunk, p, 8);
+      }
+      else
+      {
+        chunk = 0;
+        std::memcpy(&chunk, p, n);
+      }
+      // keep the n digits as the high bytes, padded with leading zeros
+      if (n < 8)
+      {
+        chunk = (chunk << (8 * (8 - n))) | (0x3030303030303030 >> (8 * n));
+      }
+      value = value * powers[n] + parse_eight_digits(chunk);
+      p += n;
+      length -= n;
+    }
+    return static_cast<int>(value);
+  }
+
+#if defined(TREE_SCANNER_X86)
+  // a digit is a byte whose unsigned distance from '0' is at most 9
+  __attribute__((target("avx2"))) static uint64_t digits_avx2(char const *p)
+  {
+    auto const zero{_mm256_set1_epi8('0')}, nine{_mm256_set1_epi8(9)};
+    auto const lo{_mm256_sub_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)), zero)};
+    auto const hi{_mm256_sub_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + 32)), zero)};
+    return static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(lo, nine), lo)))) |
+           static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(hi, nine), hi)))) << 32;
+  }
+
+  // PCMPESTRM in range mode matches '0'..'9', sixteen bytes at a time
+  __attribute__((target("sse4.2"))) static uint64_t digits_sse42(char const *p)
+  {
+    auto const range{_mm_setr_epi8('0', '9', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)};
+    uint64_t result{};
+    for (int part{}; part < 4; ++part)
+    {
+      auto const v{_mm_loadu_si128(reinterpret_cast<__m128i const *>(p + 16 * part))};
+      auto const matches{_mm_cmpestrm(range, 2, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_UNIT_MASK)};
+      result |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(matches))) << (16 * part);
+    }
+    return result;
+  }
+#endif
+
+  std::string_view text_;
+  isa isa_;
+  size_t pos_{};
+  size_t skip_until_{};
+};
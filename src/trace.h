@@ -0,0 +1,259 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+// Where the time of a request goes.
+enum class trace_phase
+{
+  route,   // matching the uri, on the event loop
+  queue,   // waiting for a compute thread
+  parse,   // reading the uri and body
+  io_wait, // waiting for the storage thread
+  storage, // in storage calls
+  reply,   // writing the reply, on the event loop
+  count
+};
+
+inline constexpr std::array<char const *, static_cast<size_t>(trace_phase::count)> trace_phase_names{
+    "route", "queue", "parse", "io_wait", "storage", "reply"};
+
+// Statements run by storage on this thread so far; the difference across a
+// repo call is what the call cost.
+inline thread_local uint32_t trace_storage_calls{};
+
+inline void count_storage_call() { ++trace_storage_calls; }
+
+inline uint64_t trace_now_ns()
+{
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// A finished request as kept by trace_log: plain words, so it can be copied
+// in and out of the ring with relaxed atomic accesses.
+struct trace_record
+{
+  static constexpr size_t text_size{64};
+
+  uint64_t id;
+  uint64_t start_ns;
+  uint64_t total_ns;
+  std::array<uint64_t, static_cast<size_t>(trace_phase::count)> phase_ns;
+  uint64_t storage_calls;
+  uint64_t status;
+  // zero padded, so they may not end in '\0'
+  std::array<char, text_size> route;
+  std::array<char, text_size> uri;
+
+  static void copy_text(std::array<char, text_size> &to, std::string_view from)
+  {
+    to.fill('\0');
+    std::memcpy(to.data(), from.data(), std::min(from.size(), to.size()));
+  }
+
+  static std::string_view text(std::array<char, text_size> const &t)
+  {
+    return {t.data(), static_cast<size_t>(std::find(t.begin(), t.end(), '\0') - t.begin())};
+  }
+};
+
+// One request being traced. Phases may be added from any thread.
+class trace_span
+{
+public:
+  trace_span(uint64_t id, std::string_view route, std::string_view uri, uint64_t start_ns = trace_now_ns())
+      : start_ns_{start_ns}
+  {
+    record_.id = id;
+    record_.start_ns = start_ns_;
+    trace_record::copy_text(record_.route, route);
+    trace_record::copy_text(record_.uri, uri);
+  }
+
+  uint64_t start_ns() const { return start_ns_; }
+
+  void add(trace_phase phase, uint64_t ns) { phase_ns_[static_cast<size_t>(phase)].fetch_add(ns, std::memory_order_relaxed); }
+
+  void add_storage_calls(uint64_t calls) { storage_calls_.fetch_add(calls, std::memory_order_relaxed); }
+
+  trace_record finish(int status) const
+  {
+    auto result{record_};
+    result.total_ns = trace_now_ns() - start_ns_;
+    for (size_t i{}; i < phase_ns_.size(); ++i)
+    {
+      result.phase_ns[i] = phase_ns_[i].load(std::memory_order_relaxed);
+    }
+    result.storage_calls = storage_calls_.load(std::memory_order_relaxed);
+    result.status = static_cast<uint64_t>(status);
+    return result;
+  }
+
+private:
+  uint64_t start_ns_;
+  trace_record record_{};
+  std::array<std::atomic<uint64_t>, static_cast<size_t>(trace_phase::count)> phase_ns_{};
+  std::atomic<uint64_t> storage_calls_{};
+};
+
+// Adds the time until it goes out of scope to a phase of the span, if any.
+class trace_timer
+{
+public:
+  trace_timer(trace_span *span, trace_phase phase) : span_{span}, phase_{phase}, start_{span ? trace_now_ns() : 0} {}
+  trace_timer(trace_timer const &) = delete;
+
+  ~trace_timer()
+  {
+    if (span_)
+    {
+      span_->add(phase_, trace_now_ns() - start_);
+    }
+  }
+
+private:
+  trace_span *span_;
+  trace_phase phase_;
+  uint64_t start_;
+};
+
+// The last capacity finished requests. Writers claim a slot with a single
+// fetch_add and never wait; each slot has a sequence number, odd while
+// being written, so readers skip slots that change under them. A writer
+// stalled for a whole lap of the ring may still garble one record, which
+// is fine for diagnostics.
+class trace_log
+{
+public:
+  explicit trace_log(size_t capacity = 4096) : slots_(std::max<size_t>(capacity, 1)) {}
+
+  void record(trace_record const &r)
+  {
+    auto const ticket{next_.fetch_add(1, std::memory_order_relaxed)};
+    auto &slot{slots_[ticket % slots_.size()]};
+    auto const seq{2 * (ticket / slots_.size() + 1)};
+    slot.seq.store(seq - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    copy_words(slot.words, r);
+    slot.seq.store(seq, std::memory_order_release);
+  }
+
+  // Every request still held, oldest first.
+  std::vector<trace_record> snapshot() const
+  {
+    std::vector<trace_record> result;
+    auto const end{next_.load(std::memory_order_acquire)};
+    auto const begin{end > slots_.size() ? end - slots_.size() : 0};
+    for (auto ticket{begin}; ticket < end; ++ticket)
+    {
+      auto const &slot{slots_[ticket % slots_.size()]};
+      auto const seq{2 * (ticket / slots_.size() + 1)};
+      if (slot.seq.load(std::memory_order_acquire) != seq)
+      {
+        continue;
+      }
+      trace_record r;
+      copy_words(r, slot.words);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) == seq)
+      {
+        result.push_back(r);
+      }
+    }
+    return result;
+  }
+
+  // The n most recent and the n slowest requests, as JSON.
+  std::string json(size_t n) const
+  {
+    auto all{snapshot()};
+    std::vector<trace_record> recent(all.end() - static_cast<std::ptrdiff_t>(std::min(n, all.size())), all.end());
+    std::reverse(recent.begin(), recent.end());
+    std::sort(all.begin(), all.end(), [](auto const &a, auto const &b)
+              { return a.total_ns > b.total_ns; });
+    all.resize(std::min(n, all.size()));
+    std::string result{"{\"recent\":"};
+    append(result, recent);
+    result += ",\"slowest\":";
+    append(result, all);
+    result += '}';
+    return result;
+  }
+
+private:
+  static constexpr size_t word_count{sizeof(trace_record) / sizeof(uint64_t)};
+  static_assert(sizeof(trace_record) % sizeof(uint64_t) == 0);
+
+  struct slot
+  {
+    std::atomic<uint64_t> seq{};
+    std::array<uint64_t, word_count> words{};
+  };
+
+  static void copy_words(std::array<uint64_t, word_count> &to, trace_record const &from)
+  {
+    uint64_t w[word_count];
+    std::memcpy(w, &from, sizeof(from));
+    for (size_t i{}; i < word_count; ++i)
+    {
+      std::atomic_ref{to[i]}.store(w[i], std::memory_order_relaxed);
+    }
+  }
+
+  static void copy_words(trace_record &to, std::array<uint64_t, word_count> const &from)
+  {
+    uint64_t w[word_count];
+    for (size_t i{}; i < word_count; ++i)
+    {
+      w[i] = std::atomic_ref{const_cast<uint64_t &>(from[i])}.load(std::memory_order_relaxed);
+    }
+    std::memcpy(&to, w, sizeof(to));
+  }
+
+  static void append_text(std::string &out, std::string_view text)
+  {
+    out += '"';
+    for (auto c : text)
+    {
+      if (c == '"' || c == '\\')
+        out += '\\';
+      if (static_cast<unsigned char>(c) >= 0x20)
+        out += c;
+    }
+    out += '"';
+  }
+
+  static void append(std::string &out, std::vector<trace_record> const &records)
+  {
+    auto const us = [](uint64_t ns)
+    { return std::to_string(ns / 1000); };
+    out += '[';
+    for (auto const &r : records)
+    {
+      if (out.back() != '[')
+        out += ',';
+      out += "{\"id\":" + std::to_string(r.id) + ",\"route\":";
+      append_text(out, trace_record::text(r.route));
+      out += ",\"uri\":";
+      append_text(out, trace_record::text(r.uri));
+      out += ",\"status\":" + std::to_string(r.status) + ",\"total_us\":" + us(r.total_ns);
+      for (size_t i{}; i < r.phase_ns.size(); ++i)
+      {
+        out += ",\"";
+        out += trace_phase_names[i];
+        out += "_us\":" + us(r.phase_ns[i]);
+      }
+      out += ",\"storage_calls\":" + std::to_string(r.storage_calls) + '}';
+    }
+    out += ']';
+  }
+
+  std::vector<slot> slots_;
+  std::atomic<uint64_t> next_{};
+};
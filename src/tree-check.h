@@ -0,0 +1,156 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "tree-parser.h"
+
+// Checks that nodes, given as triplets in any order, make up one tree:
+// each node has at most one parent and one child on each side, there is no
+// cycle, and a single root. The parser only sees one triplet at a time, so
+// [1<2>3][2<1] or [1<2][1<3] get past it, and a walk up such a tree never
+// ends. Each child bound costs a union-find step, so a body is checked in a
+// single linear pass, before anything is stored.
+class tree_checker
+{
+public:
+  void add(tree_parser::triplet const &node)
+  {
+    auto const parent{ensure(node.value)};
+    if (node.left.has_value())
+    {
+      bind(parent, ensure(node.left.value()), left_);
+    }
+    if (node.right.has_value())
+    {
+      bind(parent, ensure(node.right.value()), right_);
+    }
+  }
+
+  // Throws unless the nodes so far have a single root.
+  void finish() const
+  {
+    if (values_.empty())
+    {
+      throw std::runtime_error("Empty tree.");
+    }
+    auto const roots{std::count(parents_.begin(), parents_.end(), none)};
+    if (roots > 1)
+    {
+      throw std::runtime_error("Not a single tree: " + std::to_string(roots) + " roots.");
+    }
+  }
+
+  size_t size() const { return values_.size(); }
+
+private:
+  static constexpr int32_t none{-1};
+
+  int32_t ensure(int value)
+  {
+    auto [pos, inserted] = positions_.try_emplace(value, static_cast<int32_t>(values_.size()));
+    if (inserted)
+    {
+      values_.push_back(value);
+      parents_.push_back(none);
+      left_.push_back(none);
+      right_.push_back(none);
+      sets_.push_back(pos->second);
+      set_sizes_.push_back(1);
+    }
+    return pos->second;
+  }
+
+  // Binding the same child again, as [1<2][1<2>3] does, is harmless.
+  void bind(int32_t parent, int32_t child, std::vector<int32_t> &side)
+  {
+    if (side[parent] == child)
+    {
+      return;
+    }
+    if (side[parent] != none)
+    {
+      throw std::runtime_error("Node " + std::to_string(values_[parent]) + " has two " +
+                               (&side == &left_ ? "left" : "right") + " children.");
+    }
+    if (parents_[child] != none)
+    {
+      throw std::runtime_error("Node " + std::to_string(values_[child]) + " has two parents.");
+    }
+    // each node has one parent at most, so an edge within a set closes a cycle
+    auto a{find(parent)}, b{find(child)};
+    if (a == b)
+    {
+      throw std::runtime_error("Cycle through node " + std::to_string(values_[child]) + '.');
+    }
+    if (set_sizes_[a] < set_sizes_[b])
+    {
+      std::swap(a, b);
+    }
+    sets_[b] = a;
+    set_sizes_[a] += set_sizes_[b];
+    side[parent] = child;
+    parents_[child] = parent;
+  }
+
+  // by size, with path halving, so nearly constant time per node
+  int32_t find(int32_t node)
+  {
+    while (sets_[node] != node)
+    {
+      sets_[node] = sets_[sets_[node]];
+      node = sets_[node];
+    }
+    return node;
+  }
+
+  std::unordered_map<int, int32_t> positions_;
+  std::vector<int> values_;
+  std::vector<int32_t> parents_;
+  std::vector<int32_t> left_;
+  std::vector<int32_t> right_;
+  std::vector<int32_t> sets_;
+  std::vector<int32_t> set_sizes_;
+};
+
+// Counts the steps of a walk up a stored tree, which only a tree stored
+// before trees were checked can send round a cycle. The node reached at
+// each power of two steps is kept, as in Brent's algorithm, and a cycle
+// brings the walk back to it within three times the steps into and round
+// the cycle, so nothing is kept of the nodes seen.
+template <typename node_key_t>
+class cycle_guard
+{
+public:
+  // Throws if node was reached before.
+  void step(node_key_t const &node)
+  {
+    if (steps_ > 0 && node == mark_)
+    {
+      throw std::runtime_error("Cycle detected.");
+    }
+    if (++steps_ == next_mark_)
+    {
+      mark_ = node;
+      next_mark_ *= 2;
+    }
+  }
+
+private:
+  node_key_t mark_{};
+  uint64_t steps_{};
+  uint64_t next_mark_{1};
+};
+
+// Throws unless the nodes make up one tree.
+inline void check_tree(std::vector<tree_parser::triplet> const &nodes)
+{
+  tree_checker checker;
+  for (auto const &node : nodes)
+  {
+    checker.add(node);
+  }
+  checker.finish();
+}
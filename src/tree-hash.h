@@ -0,0 +1,131 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "tree-parser.h"
+
+// XXH64, as in the reference implementation, for content hashes: fast, and
+// with no need to be cryptographic as trees are only compared to trees
+// posted to the same instance.
+inline uint64_t xxh64(std::string_view data, uint64_t seed = 0)
+{
+  constexpr uint64_t p1{0x9E3779B185EBCA87ULL}, p2{0xC2B2AE3D27D4EB4FULL}, p3{0x165667B19E3779F9ULL},
+      p4{0x85EBCA77C2B2AE63ULL}, p5{0x27D4EB2F165667C5ULL};
+  auto const rotl = [](uint64_t x, int r)
+  { return (x << r) | (x >> (64 - r)); };
+  auto const read64 = [](char const *p)
+  {
+    uint64_t v{};
+    for (int i{7}; i >= 0; --i)
+      v = (v << 8) | static_cast<uint8_t>(p[i]);
+    return v;
+  };
+  auto const read32 = [](char const *p)
+  {
+    uint64_t v{};
+    for (int i{3}; i >= 0; --i)
+      v = (v << 8) | static_cast<uint8_t>(p[i]);
+    return v;
+  };
+  auto const round = [&rotl](uint64_t acc, uint64_t input)
+  { return rotl(acc + input * p2, 31) * p1; };
+  auto const merge = [&round](uint64_t acc, uint64_t v)
+  { return (acc ^ round(0, v)) * p1 + p4; };
+
+  auto p{data.data()};
+  auto const end{p + data.size()};
+  uint64_t h;
+  if (data.size() >= 32)
+  {
+    uint64_t v1{seed + p1 + p2}, v2{seed + p2}, v3{seed}, v4{seed - p1};
+    for (; p + 32 <= end; p += 32)
+    {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+  }
+  else
+  {
+    h = seed + p5;
+  }
+  h += data.size();
+  for (; p + 8 <= end; p += 8)
+  {
+    h = rotl(h ^ round(0, read64(p)), 27) * p1 + p4;
+  }
+  if (p + 4 <= end)
+  {
+    h = rotl(h ^ (read32(p) * p1), 23) * p2 + p3;
+    p += 4;
+  }
+  for (; p < end; ++p)
+  {
+    h = rotl(h ^ (static_cast<uint8_t>(*p) * p5), 11) * p1;
+  }
+  h ^= h >> 33;
+  h *= p2;
+  h ^= h >> 29;
+  h *= p3;
+  h ^= h >> 32;
+  return h;
+}
+
+// Apart from the seed 0 of other hashes, such as captured bodies.
+inline constexpr uint64_t canonical_hash_seed{1};
+
+// What the triplets describe rather than how they were written: every
+// node once, by increasing value, with its children, so the order of the
+// triplets, repeated ones and leaves written alone as [v] make no
+// difference. Two trees are the same when their canonical forms are.
+inline std::string canonical_tree(std::vector<tree_parser::triplet> const &triplets)
+{
+  std::map<int, std::pair<std::optional<int>, std::optional<int>>> nodes;
+  for (auto const &node : triplets)
+  {
+    auto &children{nodes[node.value]};
+    if (node.left.has_value())
+    {
+      children.first = node.left;
+      nodes[node.left.value()];
+    }
+    if (node.right.has_value())
+    {
+      children.second = node.right;
+      nodes[node.right.value()];
+    }
+  }
+  std::string canonical;
+  canonical.reserve(nodes.size() * 13);
+  auto const put = [&canonical](int v)
+  {
+    auto const u{static_cast<uint32_t>(v)};
+    for (int shift{}; shift < 32; shift += 8)
+      canonical += static_cast<char>((u >> shift) & 0xff);
+  };
+  for (auto const &[value, children] : nodes)
+  {
+    canonical += static_cast<char>((children.first.has_value() ? 1 : 0) | (children.second.has_value() ? 2 : 0));
+    put(value);
+    if (children.first.has_value())
+      put(children.first.value());
+    if (children.second.has_value())
+      put(children.second.value());
+  }
+  return canonical;
+}
+
+inline uint64_t canonical_tree_hash(std::string_view canonical) { return xxh64(canonical, canonical_hash_seed); }
+
+inline uint64_t canonical_tree_hash(std::vector<tree_parser::triplet> const &triplets)
+{
+  return canonical_tree_hash(canonical_tree(triplets));
+}
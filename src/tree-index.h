@@ -0,0 +1,501 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include "thread-pool.h"
+
+// A finished tree laid out as parallel arrays: node i holds values[i] and
+// its parent's position parents[i] (none for roots).
+struct flat_tree
+{
+  static constexpr int32_t none{-1};
+
+  std::vector<int> values;
+  std::vector<int32_t> parents;
+
+  flat_tree() = default;
+
+  // Adopts finished arrays, as loaded from storage. Nodes are then looked
+  // up by position only, so such a tree isn't to be added to.
+  flat_tree(std::vector<int> values_, std::vector<int32_t> parents_)
+      : values{std::move(values_)}, parents{std::move(parents_)}
+  {
+  }
+
+  size_t size() const { return values.size(); }
+
+  // Appends the node if it is new, and returns its position.
+  int32_t ensure(int value)
+  {
+    auto [pos, inserted] = positions_.try_emplace(value, static_cast<int32_t>(values.size()));
+    if (inserted)
+    {
+      values.push_back(value);
+      parents.push_back(none);
+    }
+    return pos->second;
+  }
+
+  // Adds one row as reported by repo_t::visit_nodes.
+  void add(int value, std::optional<int> left, std::optional<int> right)
+  {
+    auto const node{ensure(value)};
+    if (left.has_value())
+    {
+      parents[ensure(left.value())] = node;
+    }
+    if (right.has_value())
+    {
+      parents[ensure(right.value())] = node;
+    }
+  }
+
+private:
+  std::unordered_map<int, int32_t> positions_;
+};
+
+// Depths, preorder positions and jump pointers over a flat_tree, so path
+// queries are answered in O(log n) without going back to the repository.
+class tree_index
+{
+public:
+  explicit tree_index(flat_tree const &t)
+      : values_{t.values}, depth_(t.size(), unknown), preorder_(t.size())
+  {
+    auto const n{t.size()};
+    by_value_.resize(n);
+    for (size_t i{}; i < n; ++i)
+    {
+      by_value_[i] = {values_[i], static_cast<int32_t>(i)};
+    }
+    std::sort(by_value_.begin(), by_value_.end());
+    compute_depths(t.parents);
+    compute_preorder(t.parents);
+
+    int32_t max_depth{};
+    for (auto d : depth_)
+    {
+      max_depth = std::max(max_depth, d);
+    }
+    size_t levels{1};
+    while ((int32_t{1} << levels) <= max_depth)
+    {
+      ++levels;
+    }
+    // roots point to themselves, so jumping past the top stays there
+    up_.resize(levels, std::vector<int32_t>(n));
+    for (size_t i{}; i < n; ++i)
+    {
+      up_[0][i] = t.parents[i] == flat_tree::none ? static_cast<int32_t>(i) : t.parents[i];
+    }
+    for (size_t k{1}; k < levels; ++k)
+    {
+      for (size_t i{}; i < n; ++i)
+      {
+        up_[k][i] = up_[k - 1][up_[k - 1][i]];
+      }
+    }
+  }
+
+  // Builds the same index with every step spread over the pool: depths by
+  // pointer jumping, which leaves the jump pointer levels behind; subtree
+  // sizes and preorder positions one depth level at a time, children being
+  // placed by prefix sums of their siblings' sizes.
+  tree_index(flat_tree const &t, thread_pool &pool)
+      : values_{t.values}, depth_(t.size()), preorder_(t.size())
+  {
+    auto const n{t.size()};
+    auto const &parents{t.parents};
+    by_value_.resize(n);
+    pool.parallel_for(n, grain, [this](size_t begin, size_t end)
+                      {
+                        for (auto i{begin}; i < end; ++i)
+                          by_value_[i] = {values_[i], static_cast<int32_t>(i)}; });
+    parallel_sort(by_value_, pool);
+
+    jump_pointers(parents, pool);
+
+    // children of each node, in index order
+    std::vector<int32_t> first_child(n + 1), children(n);
+    pool.parallel_for(n, grain, [&](size_t begin, size_t end)
+                      {
+                        for (auto i{begin}; i < end; ++i)
+                          if (parents[i] != flat_tree::none)
+                            std::atomic_ref{first_child[parents[i] + 1]}.fetch_add(1, std::memory_order_relaxed); });
+    parallel_prefix_sum(first_child, pool);
+    {
+      auto next{first_child};
+      pool.parallel_for(n, grain, [&](size_t begin, size_t end)
+                        {
+                          for (auto i{begin}; i < end; ++i)
+                            if (parents[i] != flat_tree::none)
+                              children[std::atomic_ref{next[parents[i]]}.fetch_add(1, std::memory_order_relaxed)] = static_cast<int32_t>(i); });
+    }
+    pool.parallel_for(n, grain, [&](size_t begin, size_t end)
+                      {
+                        for (auto i{begin}; i < end; ++i)
+                          std::sort(children.begin() + first_child[i], children.begin() + first_child[i + 1]); });
+
+    // nodes grouped by depth
+    int32_t max_depth{};
+    for (auto d : depth_)
+    {
+      max_depth = std::max(max_depth, d);
+    }
+    std::vector<int32_t> first_at_depth(static_cast<size_t>(max_depth) + 2), by_depth(n);
+    pool.parallel_for(n, grain, [&](size_t begin, size_t end)
+                      {
+                        for (auto i{begin}; i < end; ++i)
+                          std::atomic_ref{first_at_depth[depth_[i] + 1]}.fetch_add(1, std::memory_order_relaxed); });
+    parallel_prefix_sum(first_at_depth, pool);
+    {
+      auto next{first_at_depth};
+      pool.parallel_for(n, grain, [&](size_t begin, size_t end)
+                        {
+                          for (auto i{begin}; i < end; ++i)
+                            by_depth[std::atomic_ref{next[depth_[i]]}.fetch_add(1, std::memory_order_relaxed)] = static_cast<int32_t>(i); });
+    }
+    auto const level = [&](int32_t d, auto const &fn)
+    {
+      auto const begin{first_at_depth[d]}, count{first_at_depth[d + 1] - begin};
+      pool.parallel_for(static_cast<size_t>(count), grain, [&](size_t from, size_t to)
+                        {
+                          for (auto i{from}; i < to; ++i)
+                            fn(by_depth[begin + i]); });
+    };
+
+    std::vector<int32_t> sizes(n, 1);
+    for (auto d{max_depth}; d > 0; --d)
+    {
+      level(d, [&](int32_t node)
+            { std::atomic_ref{sizes[parents[node]]}.fetch_add(sizes[node], std::memory_order_relaxed); });
+    }
+
+    // roots in index order, then each node lays out its children after itself
+    std::sort(by_depth.begin(), by_depth.begin() + first_at_depth[1]);
+    int32_t offset{};
+    for (auto r{0}; r < first_at_depth[1]; ++r)
+    {
+      preorder_[by_depth[r]] = offset;
+      offset += sizes[by_depth[r]];
+    }
+    for (int32_t d{}; d < max_depth; ++d)
+    {
+      level(d, [&](int32_t node)
+            {
+              auto next{preorder_[node] + 1};
+              for (auto c{first_child[node]}; c < first_child[node + 1]; ++c)
+              {
+                preorder_[children[c]] = next;
+                next += sizes[children[c]];
+              } });
+    }
+  }
+
+  size_t size() const { return values_.size(); }
+
+  bool contains(int value) const { return find(value) != flat_tree::none; }
+
+  int depth(int value) const { return depth_[position(value)]; }
+
+  // The k-th ancestor of value; k == 0 is the node itself.
+  int ancestor(int value, int k) const
+  {
+    auto const node{position(value)};
+    if (k < 0 || k > depth_[node])
+    {
+      throw std::runtime_error("No such ancestor.");
+    }
+    return values_[lift(node, k)];
+  }
+
+  // True when a lies on the path from b to its root (b included).
+  bool is_ancestor(int a, int b) const
+  {
+    auto const pa{position(a)}, pb{position(b)};
+    return depth_[pb] >= depth_[pa] && lift(pb, depth_[pb] - depth_[pa]) == pa;
+  }
+
+  int common_ancestor(int a, int b) const
+  {
+    return values_[lca(position(a), position(b))];
+  }
+
+  // The deepest node that is an ancestor of every value. Subtrees are
+  // contiguous in preorder, so it is the common ancestor of the first and
+  // last values in that order.
+  int common_ancestor(std::vector<int> const &values) const
+  {
+    if (values.empty())
+    {
+      throw std::runtime_error("No values.");
+    }
+    auto first{position(values.front())}, last{first};
+    for (auto value : values)
+    {
+      auto const node{position(value)};
+      if (preorder_[node] < preorder_[first])
+        first = node;
+      if (preorder_[node] > preorder_[last])
+        last = node;
+    }
+    return values_[lca(first, last)];
+  }
+
+  // Number of edges on the path between a and b.
+  int distance(int a, int b) const
+  {
+    auto const pa{position(a)}, pb{position(b)};
+    return depth_[pa] + depth_[pb] - 2 * depth_[lca(pa, pb)];
+  }
+
+private:
+  static constexpr int32_t unknown{-1};
+
+  static constexpr size_t grain{4096};
+
+  int32_t find(int value) const
+  {
+    auto pos{std::lower_bound(by_value_.begin(), by_value_.end(), std::pair{value, int32_t{}})};
+    return pos == by_value_.end() || pos->first != value ? flat_tree::none : pos->second;
+  }
+
+  int32_t position(int value) const
+  {
+    auto const pos{find(value)};
+    if (pos == flat_tree::none)
+    {
+      throw std::runtime_error("Not found.");
+    }
+    return pos;
+  }
+
+  int32_t lift(int32_t node, int32_t k) const
+  {
+    for (size_t level{}; k > 0; ++level, k >>= 1)
+    {
+      if (k & 1)
+      {
+        node = up_[level][node];
+      }
+    }
+    return node;
+  }
+
+  int32_t lca(int32_t a, int32_t b) const
+  {
+    if (depth_[a] < depth_[b])
+    {
+      std::swap(a, b);
+    }
+    a = lift(a, depth_[a] - depth_[b]);
+    if (a == b)
+    {
+      return a;
+    }
+    for (auto level{up_.size()}; level-- > 0;)
+    {
+      if (up_[level][a] != up_[level][b])
+      {
+        a = up_[level][a];
+        b = up_[level][b];
+      }
+    }
+    if (up_[0][a] != up_[0][b])
+    {
+      throw std::runtime_error("No common ancestor.");
+    }
+    return up_[0][a];
+  }
+
+  void compute_depths(std::vector<int32_t> const &parents)
+  {
+    std::vector<int32_t> path;
+    for (size_t i{}; i < parents.size(); ++i)
+    {
+      int32_t node{static_cast<int32_t>(i)};
+      while (depth_[node] == unknown)
+      {
+        path.push_back(node);
+        if (path.size() > parents.size())
+        {
+          throw std::runtime_error("Cycle detected.");
+        }
+        if (parents[node] == flat_tree::none)
+        {
+          break;
+        }
+        node = parents[node];
+      }
+      int32_t d{depth_[node] == unknown ? -1 : depth_[node]};
+      while (!path.empty())
+      {
+        depth_[path.back()] = ++d;
+        path.pop_back();
+      }
+    }
+  }
+
+  void compute_preorder(std::vector<int32_t> const &parents)
+  {
+    auto const n{parents.size()};
+    // children grouped by parent, in a single array
+    std::vector<int32_t> first_child(n + 1), children(n), stack;
+    for (auto p : parents)
+    {
+      if (p != flat_tree::none)
+        ++first_child[p + 1];
+    }
+    for (size_t i{}; i < n; ++i)
+    {
+      first_child[i + 1] += first_child[i];
+    }
+    auto next{first_child};
+    for (size_t i{}; i < n; ++i)
+    {
+      if (parents[i] != flat_tree::none)
+        children[next[parents[i]]++] = static_cast<int32_t>(i);
+    }
+    // roots, and then children, are visited in index order
+    for (auto i{n}; i-- > 0;)
+    {
+      if (parents[i] == flat_tree::none)
+        stack.push_back(static_cast<int32_t>(i));
+    }
+    int32_t order{};
+    while (!stack.empty())
+    {
+      auto const node{stack.back()};
+      stack.pop_back();
+      preorder_[node] = order++;
+      for (auto c{first_child[node + 1]}; c-- > first_child[node];)
+      {
+        stack.push_back(children[c]);
+      }
+    }
+  }
+
+  // Pointer jumping: each round every node adds the distance its pointer
+  // already covers and doubles its jump, until all point at their root,
+  // which takes a round per bit of n and one to find nothing moved. Past
+  // that only a cycle keeps pointers moving, and its depths doubling.
+  void jump_pointers(std::vector<int32_t> const &parents, thread_pool &pool)
+  {
+    auto const n{parents.size()};
+    auto const rounds{static_cast<size_t>(std::bit_width(n)) + 1};
+    up_.emplace_back(n);
+    pool.parallel_for(n, grain, [&](size_t begin, size_t end)
+                      {
+                        for (auto i{begin}; i < end; ++i)
+                        {
+                          auto const root{parents[i] == flat_tree::none};
+                          up_[0][i] = root ? static_cast<int32_t>(i) : parents[i];
+                          depth_[i] = root ? 0 : 1;
+                        } });
+    std::vector<int32_t> next_depth(n);
+    for (;;)
+    {
+      if (up_.size() > rounds)
+      {
+        throw std::runtime_error("Cycle detected.");
+      }
+      auto const &current{up_.back()};
+      std::vector<int32_t> next(n);
+      std::atomic<bool> moved{};
+      pool.parallel_for(n, grain, [&](size_t begin, size_t end)
+                        {
+                          bool any{};
+                          for (auto i{begin}; i < end; ++i)
+                          {
+                            next[i] = current[current[i]];
+                            next_depth[i] = static_cast<int32_t>(std::min<int64_t>(int64_t{depth_[i]} + depth_[current[i]], INT32_MAX));
+                            any |= next[i] != current[i];
+                          }
+                          if (any)
+                            moved = true; });
+      depth_.swap(next_depth);
+      if (!moved)
+      {
+        break;
+      }
+      up_.push_back(std::move(next));
+    }
+    // nodes on a cycle end up pointing at themselves without being roots
+    std::atomic<bool> cycle{};
+    pool.parallel_for(n, grain, [&](size_t begin, size_t end)
+                      {
+                        for (auto i{begin}; i < end; ++i)
+                          if (parents[up_.back()[i]] != flat_tree::none)
+                            cycle = true; });
+    if (cycle)
+    {
+      throw std::runtime_error("Cycle detected.");
+    }
+  }
+
+  // Running sums in place, v[i] becoming v[0] + ... + v[i]. Counts are kept
+  // one slot ahead of what they count, so the sums come out as offsets.
+  static void parallel_prefix_sum(std::vector<int32_t> &v, thread_pool &pool)
+  {
+    auto const slices{std::max<size_t>(1, std::min(pool.size() * 4, v.size() / grain))};
+    std::vector<int32_t> totals(slices + 1);
+    auto const bounds = [&v, slices](size_t s)
+    { return v.size() * s / slices; };
+    pool.parallel_for(slices, 1, [&](size_t begin, size_t end)
+                      {
+                        for (auto s{begin}; s < end; ++s)
+                          for (auto i{bounds(s)}; i < bounds(s + 1); ++i)
+                            totals[s + 1] += v[i]; });
+    for (size_t s{}; s < slices; ++s)
+    {
+      totals[s + 1] += totals[s];
+    }
+    pool.parallel_for(slices, 1, [&](size_t begin, size_t end)
+                      {
+                        for (auto s{begin}; s < end; ++s)
+                        {
+                          auto sum{totals[s]};
+                          for (auto i{bounds(s)}; i < bounds(s + 1); ++i)
+                          {
+                            sum += v[i];
+                            v[i] = sum;
+                          }
+                        } });
+  }
+
+  template <typename T>
+  static void parallel_sort(std::vector<T> &v, thread_pool &pool)
+  {
+    auto const slices{std::max<size_t>(1, std::min(pool.size(), v.size() / grain))};
+    auto const bounds = [&v, slices](size_t s)
+    { return v.begin() + v.size() * s / slices; };
+    pool.parallel_for(slices, 1, [&](size_t begin, size_t end)
+                      {
+                        for (auto s{begin}; s < end; ++s)
+                          std::sort(bounds(s), bounds(s + 1)); });
+    for (size_t width{1}; width < slices; width *= 2)
+    {
+      auto const merges{(slices + 2 * width - 1) / (2 * width)};
+      pool.parallel_for(merges, 1, [&](size_t begin, size_t end)
+                        {
+                          for (auto m{begin}; m < end; ++m)
+                          {
+                            auto const first{m * 2 * width};
+                            auto const middle{std::min(first + width, slices)}, last{std::min(first + 2 * width, slices)};
+                            std::inplace_merge(bounds(first), bounds(middle), bounds(last));
+                          } });
+    }
+  }
+
+  std::vector<int> values_;
+  // (value, position) pairs sorted by value
+  std::vector<std::pair<int, int32_t>> by_value_;
+  std::vector<int32_t> depth_;
+  std::vector<int32_t> preorder_;
+  std::vector<std::vector<int32_t>> up_;
+};
@@ -1,84 +1,99 @@
+#pragma once
 #include <string_view>
 #include <cctype>
 #include <functional>
 #include <optional>
 #include <unordered_map>
 #include <stdexcept>
+#include <vector>
+#include <future>
+#include <exception>
+#include "token-scanner.h"
+#include "thread-pool.h"
 
-enum token_type
+class tree_parser
 {
-  open_node,
-  value,
-  right_arrow,
-  left_arrow,
-  close_node,
-  end_of_file,
-  invalid
-};
+public:
+  struct triplet
+  {
+    std::optional<int> left;
+    int value;
+    std::optional<int> right;
+  };
 
-struct token
-{
-  token_type t;
-  int token_value;
-  
-  static token next(std::string_view &text)
+  using parse_callback = std::function<void(triplet)>;
+
+  // Bodies at least this long are parsed in chunks across a thread pool.
+  static constexpr size_t parallel_threshold{1 << 20};
+
+  static void parse(std::string_view text, parse_callback callback)
   {
-    if (text.size() == 0)
+    if (text.size() >= parallel_threshold && thread_pool::shared().size() > 1)
     {
-      return {token_type::end_of_file};
+      parse_parallel(text, callback, thread_pool::shared());
     }
-    token result;
-    if (std::isdigit(text.front()))
+    else
     {
-      result.t = token_type::value;
-      result.token_value = text.front() - '0';
-      for (text = {text.data() + 1, text.size() - 1}; std::isdigit(text.front()); text = {text.data() + 1, text.size() - 1})
-      {
-        result.token_value *= 10;
-        result.token_value += text.front() - '0';
-      }
+      parse_range(text, 0, text.size(), callback);
     }
-    else
+  }
+
+  // Each bracketed triplet stands alone, so the text is cut after a ']' near
+  // every chunk_size bytes, the chunks are parsed independently and their
+  // triplets are handed to the callback in the original order. The first
+  // error in text order is the one thrown, as if parsed sequentially.
+  static void parse_parallel(std::string_view text, parse_callback callback, thread_pool &pool, size_t chunk_size = parallel_threshold / 4)
+  {
+    struct chunk
     {
-      switch (text.front())
+      std::vector<triplet> triplets;
+      // what stopped the chunk, after the triplets parsed before it
+      std::exception_ptr error;
+    };
+    std::vector<std::future<chunk>> chunks;
+    for (size_t begin{}; begin < text.size();)
+    {
+      auto end{begin + chunk_size < text.size() ? text.find(']', begin + chunk_size - 1) : text.npos};
+      end = end == text.npos ? text.size() : end + 1;
+      chunks.push_back(pool.submit([text, begin, end]
+                                   {
+                                     chunk result;
+                                     try
+                                     {
+                                       parse_range(text, begin, end, [&result](triplet t)
+                                                   { result.triplets.push_back(t); });
+                                     }
+                                     catch (...)
+                                     {
+                                       result.error = std::current_exception();
+                                     }
+                                     return result; }));
+      begin = end;
+    }
+    std::vector<chunk> parsed;
+    parsed.reserve(chunks.size());
+    for (auto &c : chunks)
+    {
+      parsed.push_back(pool.wait(c));
+    }
+    for (auto const &c : parsed)
+    {
+      for (auto const &t : c.triplets)
       {
-      case '[':
-        result.t = token_type::open_node;
-        break;
-      case ']':
-        result.t = token_type::close_node;
-        break;
-      case '<':
-        result.t = token_type::left_arrow;
-        break;
-      case '>':
-        result.t = token_type::right_arrow;
-        break;
-
-      default:
-        result.t = token_type::invalid;
-        break;
+        callback(t);
+      }
+      if (c.error)
+      {
+        std::rethrow_exception(c.error);
       }
-      text = {text.data() + 1, text.size() - 1};
     }
-    return result;
   }
-};
 
-class tree_parser
-{
-public:
-  struct triplet
+private:
+  // Parses text[begin, end), reporting errors against the whole text.
+  static void parse_range(std::string_view original, size_t begin, size_t end, parse_callback callback)
   {
-    std::optional<int> left;
-    int value;
-    std::optional<int> right;
-  };
-
-  using parse_callback = std::function<void(triplet)>;
-  static void parse(std::string_view text, parse_callback callback)
-  {
-    auto const original{text};
+    auto const text{original.substr(begin, end - begin)};
     enum state
     {
       initial,
@@ -151,30 +166,35 @@ public:
                        }}};
 
     triplet res{};
-    for (auto t{token::next(text)}; t.t != token_type::end_of_file; t = token::next(text))
+    token_scanner scanner{text};
+    std::vector<token> tokens;
+    while (scanner.fill(tokens))
     {
-      auto const &s{mechanism.at(status)};
-      auto pos{s.find(t.t)};
-      if (pos == s.end())
-      {
-        throw std::runtime_error("Unable to parse " + std::string(original) + " at " + std::string(text) + ". Last state was " + std::to_string(status) + " last token type " + std::to_string(t.t));
-      }
-      status = mechanism.at(status).at(t.t)(t, res);
-      if (status == emit)
+      for (auto const &t : tokens)
       {
-        if (res.left.has_value() && res.left.value() == res.value) {
-          throw std::runtime_error("Left can't be equal to the value.");
+        auto const &s{mechanism.at(status)};
+        auto pos{s.find(t.t)};
+        if (pos == s.end())
+        {
+          throw std::runtime_error("Unable to parse " + std::string(original) + " at " + std::string(original.substr(begin + t.end)) + ". Last state was " + std::to_string(status) + " last token type " + std::to_string(t.t));
         }
-        if (res.right.has_value()) {
-          if (res.right.value() == res.value) {
-            throw std::runtime_error("Right can't be equal to the value.");
+        status = mechanism.at(status).at(t.t)(t, res);
+        if (status == emit)
+        {
+          if (res.left.has_value() && res.left.value() == res.value) {
+            throw std::runtime_error("Left can't be equal to the value.");
           }
-          if (res.left.has_value() && res.left.value() == res.right.value()) {
-            throw std::runtime_error("Left can't be equal to right.");
+          if (res.right.has_value()) {
+            if (res.right.value() == res.value) {
+              throw std::runtime_error("Right can't be equal to the value.");
+            }
+            if (res.left.has_value() && res.left.value() == res.right.value()) {
+              throw std::runtime_error("Left can't be equal to right.");
+            }
           }
+          callback(res);
+          status = initial;
         }
-        callback(res);
-        status = initial;
       }
     }
   }
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <memory>
+#include <variant>
+#include "tree-index.h"
+#include "succinct-tree.h"
+#include "mini-parser.h"
+
+// Path query index of a tree, in the form suited to its size.
+using query_index_t = std::variant<tree_index, succinct_tree>;
+
+// Trees with more nodes than this are kept in succinct form.
+inline constexpr size_t default_succinct_threshold{1 << 20};
+// and trees with more than this have their index built on the shared pool.
+inline constexpr size_t parallel_index_threshold{1 << 16};
+
+inline std::unique_ptr<query_index_t const> build_query_index(flat_tree const &flat, size_t succinct_threshold)
+{
+  if (flat.size() == 0)
+  {
+    throw std::runtime_error("Not found.");
+  }
+  if (flat.size() > succinct_threshold)
+    return std::make_unique<query_index_t const>(std::in_place_type<succinct_tree>, flat);
+  if (flat.size() > parallel_index_threshold)
+    return std::make_unique<query_index_t const>(std::in_place_type<tree_index>, flat, thread_pool::shared());
+  return std::make_unique<query_index_t const>(std::in_place_type<tree_index>, flat);
+}
+
+// Values come in the uri, /tree/{id}/common-ancestor/{v1}/.../{vn}, and/or
+// the body, separated by commas or slashes, and in the body by whitespace
+// too.
+inline void parse_value_list(std::string_view uri, std::string_view body, std::string &tree_id, std::vector<int> &values)
+{
+  mini_parser p;
+  p.set(p.ignore(2, p.read(tree_id, p.ignore(1, p.read_ints(values)))));
+  for (auto c : uri)
+  {
+    p(c);
+  }
+  p.set(p.read_ints(values, true));
+  p('/');
+  for (auto c : body)
+  {
+    p(c);
+  }
+}
+
+// uris look like /tree/{id}/...
+inline std::string parse_tree_id(std::string_view uri)
+{
+  std::string tree_id;
+  mini_parser p;
+  p.set(p.ignore(2, p.read(tree_id, [](char) {})));
+  for (auto c : uri)
+  {
+    p(c);
+  }
+  return tree_id;
+}
+
+// uris look like /tree/{id}/{operation}/{a}/{b}
+inline void parse_pair(std::string_view uri, std::string &tree_id, int &a, int &b)
+{
+  mini_parser p;
+  p.set(p.ignore(2, p.read(tree_id, p.ignore(1, p.read_int(a, p.read_int(b, p.parse_throw))))));
+  for (auto c : uri)
+  {
+    p(c);
+  }
+}
+
+// How clients name trees, the ids of a store being its own.
+template <typename tree_key_t>
+struct tree_id_translator
+{
+  std::function<std::string(tree_key_t)> to_string;
+  std::function<tree_key_t(std::string const &)> parse;
+};
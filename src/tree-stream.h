@@ -0,0 +1,191 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <stdexcept>
+#include <functional>
+#include "tree-parser.h"
+
+// How a tree travels between instances: the bracket grammar accepted by
+// POST /tree, or a compact binary form of the same triplets. Every node is
+// written, leaves as [v], so a tree comes back exactly as it was.
+enum class tree_format
+{
+  text,
+  binary
+};
+
+// The binary form starts with this, followed by one record per node: a
+// byte of flags (1 = has left, 2 = has right), then the value and the
+// children present as zigzag varints.
+inline constexpr std::string_view binary_tree_magic{"TRB\x01", 4};
+
+class tree_encoder
+{
+public:
+  explicit tree_encoder(tree_format format) : format_{format} {}
+
+  tree_format format() const { return format_; }
+
+  // What comes before the first node.
+  std::string header() const { return format_ == tree_format::binary ? std::string{binary_tree_magic} : std::string{}; }
+
+  void add(tree_parser::triplet const &node, std::string &out) const
+  {
+    if (format_ == tree_format::text)
+    {
+      out += '[';
+      if (node.left.has_value())
+      {
+        out += std::to_string(node.left.value());
+        out += '<';
+      }
+      out += std::to_string(node.value);
+      if (node.right.has_value())
+      {
+        out += '>';
+        out += std::to_string(node.right.value());
+      }
+      out += ']';
+      return;
+    }
+    out += static_cast<char>((node.left.has_value() ? 1 : 0) | (node.right.has_value() ? 2 : 0));
+    put_varint(node.value, out);
+    if (node.left.has_value())
+      put_varint(node.left.value(), out);
+    if (node.right.has_value())
+      put_varint(node.right.value(), out);
+  }
+
+private:
+  static void put_varint(int value, std::string &out)
+  {
+    auto v{(static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31)};
+    while (v >= 0x80)
+    {
+      out += static_cast<char>(v | 0x80);
+      v >>= 7;
+    }
+    out += static_cast<char>(v);
+  }
+
+  tree_format format_;
+};
+
+// Turns either form back into triplets as it arrives, a piece at a time;
+// only an incomplete trailing node is held back between pieces. The format
+// is told apart by the binary magic.
+class tree_decoder
+{
+public:
+  using callback_t = tree_parser::parse_callback;
+
+  void feed(std::string_view piece, callback_t const &cb)
+  {
+    pending_.append(piece);
+    if (!format_.has_value())
+    {
+      if (pending_.size() < binary_tree_magic.size() && binary_tree_magic.starts_with(pending_))
+      {
+        return;
+      }
+      format_ = pending_.starts_with(binary_tree_magic) ? tree_format::binary : tree_format::text;
+      if (format_ == tree_format::binary)
+      {
+        pending_.erase(0, binary_tree_magic.size());
+      }
+    }
+    size_t used{};
+    if (format_ == tree_format::text)
+    {
+      // whole triplets only, the rest waits for the next piece
+      auto const last{pending_.rfind(']')};
+      if (last != std::string::npos)
+      {
+        used = last + 1;
+        tree_parser::parse(std::string_view{pending_}.substr(0, used), cb);
+      }
+    }
+    else
+    {
+      used = decode_records(cb);
+    }
+    pending_.erase(0, used);
+  }
+
+  // Throws if the input ended in the middle of a node.
+  void finish(callback_t const &cb)
+  {
+    if (format_ == tree_format::text && !pending_.empty())
+    {
+      tree_parser::parse(pending_, cb);
+    }
+    else if (!pending_.empty())
+    {
+      throw std::runtime_error("Truncated tree.");
+    }
+    pending_.clear();
+  }
+
+private:
+  size_t decode_records(callback_t const &cb)
+  {
+    size_t pos{};
+    for (;;)
+    {
+      auto at{pos};
+      if (at >= pending_.size())
+      {
+        return pos;
+      }
+      auto const flags{static_cast<unsigned char>(pending_[at++])};
+      if (flags > 3)
+      {
+        throw std::runtime_error("Invalid tree record.");
+      }
+      tree_parser::triplet node{};
+      int value{};
+      if (!get_varint(at, value))
+        return pos;
+      node.value = value;
+      if (flags & 1)
+      {
+        if (!get_varint(at, value))
+          return pos;
+        node.left = value;
+      }
+      if (flags & 2)
+      {
+        if (!get_varint(at, value))
+          return pos;
+        node.right = value;
+      }
+      cb(node);
+      pos = at;
+    }
+  }
+
+  // false when the varint isn't complete yet
+  bool get_varint(size_t &at, int &value) const
+  {
+    uint32_t v{};
+    for (int shift{}; shift < 35; shift += 7)
+    {
+      if (at >= pending_.size())
+      {
+        return false;
+      }
+      auto const byte{static_cast<unsigned char>(pending_[at++])};
+      v |= static_cast<uint32_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+      {
+        value = static_cast<int>((v >> 1) ^ (0 - (v & 1)));
+        return true;
+      }
+    }
+    throw std::runtime_error("Invalid tree record.");
+  }
+
+  std::optional<tree_format> format_;
+  std::string pending_;
+};
@@ -1,5 +1,8 @@
 #pragma once
+#include <set>
 #include "tree-parser.h"
+#include "tree-check.h"
+#include "tree-index.h"
 
 template <typename tree_key_t>
 class tree
@@ -9,26 +12,60 @@ public:
 
   tree_key_t id() const { return tree_id_; }
 
+  // Nothing is stored unless the text is a single tree.
   static tree parse(auto &repo, std::string_view text)
   {
+    std::vector<tree_parser::triplet> nodes;
+    tree_parser::parse(text, [&nodes](auto node)
+                       { nodes.push_back(node); });
+    check_tree(nodes);
     tree t{repo.new_tree()};
-    tree_parser::parse(text, [&repo, &t](auto node)
-                       {
-                         t.add_node(repo, node);
-                       });
+    try
+    {
+      for (auto const &node : nodes)
+      {
+        t.add_node(repo, node);
+      }
+      if constexpr (requires { repo.commit_tree(t.id()); })
+      {
+        repo.commit_tree(t.id());
+      }
+    }
+    catch (...)
+    {
+      // nor what was stored before it failed
+      if constexpr (requires { repo.drop_tree(t.id()); })
+      {
+        repo.drop_tree(t.id());
+      }
+      throw;
+    }
     return t;
   }
 
+  // Throws on a cycle, which only a tree stored before trees were checked
+  // can have.
   template<typename repo_t>
   void visit_ancestors(repo_t &repo, int value, auto cb) const
   {
+    cycle_guard<typename repo_t::node_key_t> guard;
     for (auto ancestor = repo.get_id_by_value(tree_id_, value); ancestor != typename repo_t::node_key_t(); ancestor = repo.get_parent_by_id(ancestor))
     {
+      guard.step(ancestor);
       if (!cb(ancestor))
         break;
     }
   }
 
+  // Loads the whole tree from the repo as parallel value/parent arrays.
+  flat_tree flatten(auto &repo) const
+  {
+    flat_tree result;
+    repo.visit_nodes(tree_id_, [&result](int value, std::optional<int> left, std::optional<int> right)
+                     { result.add(value, left, right); });
+    return result;
+  }
+
   void add_node(auto &repo, auto node)
   {
     auto this_node = repo.ensure_node(tree_id_, node.value);